@@ -7,6 +7,9 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
+
+#include "nbbo/price.hpp"
 
 namespace nbbo {
 
@@ -29,6 +32,20 @@ inline uint64_t ValueAt<uint64_t>(const std::shared_ptr<arrow::Array>& arr,
   }
 }
 
+// Raw ts values of a whole column (uint64, or int64 read as uint64), for
+// batch decoding with nbbo::decode_ts. Null slots hold unspecified values.
+inline const uint64_t* TsValues(const std::shared_ptr<arrow::Array>& arr) {
+  switch (arr->type_id()) {
+    case arrow::Type::UINT64:
+      return static_cast<const arrow::UInt64Array&>(*arr).raw_values();
+    case arrow::Type::INT64:
+      return reinterpret_cast<const uint64_t*>(
+          static_cast<const arrow::Int64Array&>(*arr).raw_values());
+    default:
+      throw std::runtime_error("Unsupported type: " + arr->type()->ToString());
+  }
+}
+
 // Specialization for extracting numeric columns as double or float
 template <>
 inline double ValueAt<double>(const std::shared_ptr<arrow::Array>& arr,
@@ -39,11 +56,67 @@ inline double ValueAt<double>(const std::shared_ptr<arrow::Array>& arr,
           static_cast<const arrow::FloatArray&>(*arr).Value(i));
     case arrow::Type::DOUBLE:
       return static_cast<const arrow::DoubleArray&>(*arr).Value(i);
+    case arrow::Type::INT8:
+      return static_cast<double>(
+          static_cast<const arrow::Int8Array&>(*arr).Value(i));
+    case arrow::Type::INT32:
+      return static_cast<double>(
+          static_cast<const arrow::Int32Array&>(*arr).Value(i));
+    case arrow::Type::INT64:
+      return static_cast<double>(
+          static_cast<const arrow::Int64Array&>(*arr).Value(i));
     default:
       throw std::runtime_error("Unsupported type: " + arr->type()->ToString());
   }
 }
 
+// A whole numeric column as double: the float64 buffer itself, or (other
+// types) ValueAt<double> of every row converted into `scratch`.
+inline const double* DoubleValues(const std::shared_ptr<arrow::Array>& arr,
+                                  std::vector<double>& scratch) {
+  if (arr->type_id() == arrow::Type::DOUBLE) {
+    return static_cast<const arrow::DoubleArray&>(*arr).raw_values();
+  }
+  scratch.resize(static_cast<size_t>(arr->length()));
+  for (int64_t i = 0; i < arr->length(); ++i) {
+    scratch[i] = ValueAt<double>(arr, i);
+  }
+  return scratch.data();
+}
+
+// Price columns as Px: integer columns already hold ticks (price_scale=10000),
+// float columns are legacy dollar files and get converted here.
+inline Px PxAt(const std::shared_ptr<arrow::Array>& arr, int64_t i) {
+  switch (arr->type_id()) {
+    case arrow::Type::INT32:
+      return static_cast<const arrow::Int32Array&>(*arr).Value(i);
+    case arrow::Type::INT64:
+      return static_cast<Px>(
+          static_cast<const arrow::Int64Array&>(*arr).Value(i));
+    case arrow::Type::FLOAT:
+      return px_from_double(
+          static_cast<const arrow::FloatArray&>(*arr).Value(i));
+    case arrow::Type::DOUBLE:
+      return px_from_double(
+          static_cast<const arrow::DoubleArray&>(*arr).Value(i));
+    default:
+      throw std::runtime_error("Unsupported price type: " +
+                               arr->type()->ToString());
+  }
+}
+
+// A whole price column as Px: the int32 buffer itself, or (other types)
+// PxAt of every row converted into `scratch`.
+inline const Px* PxValues(const std::shared_ptr<arrow::Array>& arr,
+                          std::vector<Px>& scratch) {
+  if (arr->type_id() == arrow::Type::INT32) {
+    return static_cast<const arrow::Int32Array&>(*arr).raw_values();
+  }
+  scratch.resize(static_cast<size_t>(arr->length()));
+  for (int64_t i = 0; i < arr->length(); ++i) scratch[i] = PxAt(arr, i);
+  return scratch.data();
+}
+
 inline std::unique_ptr<parquet::arrow::FileReader> open_parquet_reader(
     const std::string& path, std::shared_ptr<arrow::Schema>& out_schema) {
   // Open a Parquet file and return a FileReader
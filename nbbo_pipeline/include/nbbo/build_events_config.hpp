@@ -1,5 +1,15 @@
 #pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include "nbbo/event_types.hpp"
+#include "nbbo/event_writer.hpp"
+#include "nbbo/parquet_writer_config.hpp"
 
 struct BuildEventsConfig {
   // Path to the cleaned per-ms nbbo input file
@@ -12,4 +22,70 @@ struct BuildEventsConfig {
   // Tracks max absolute mid-price change between events
   // if |mid_next - mid| > threshold_next, the event is dropped.
   double threshold_next = 1.0;
+
+  // Extra labels per event (y_h, mid_next_h, tau_h columns), computed in
+  // the same pass as the next-change label
+  std::vector<nbbo::EventHorizon> horizons;
+
+  // Codec, encodings and row-group layout of the events file
+  nbbo::ParquetWriterConfig parquet;
+
+  // Batch size and pooled encoding of the events writer
+  nbbo::EventWriterOptions writer;
 };
+
+// Largest horizons --horizons takes. A clock horizon past a whole day, or
+// more mid changes than any day has, can never resolve; the bounds also keep
+// the count times its unit inside int.
+inline constexpr int64_t kMaxHorizonMs = 86'400'000;
+inline constexpr int64_t kMaxHorizonChanges = 10'000'000;
+
+// Parses a --horizons list such as "5,10ms,100ms,1s": a bare count (or kN)
+// is the N-th next mid change, Nms / Ns a clock horizon. N is plain digits,
+// at least 1 and within the bounds above.
+inline std::vector<nbbo::EventHorizon> parse_event_horizons(
+    const std::string& list) {
+  using Kind = nbbo::EventHorizon::Kind;
+  std::vector<nbbo::EventHorizon> out;
+  size_t pos = 0;
+  while (pos <= list.size()) {
+    const size_t comma = std::min(list.find(',', pos), list.size());
+    const std::string raw = list.substr(pos, comma - pos);
+    std::string item = raw;
+    pos = comma + 1;
+
+    nbbo::EventHorizon h{Kind::kChanges, 0};
+    int64_t scale = 1;
+    if (!item.empty() && item.front() == 'k') {
+      item.erase(0, 1);
+    } else if (item.size() > 2 && item.ends_with("ms")) {
+      h.kind = Kind::kMs;
+      item.resize(item.size() - 2);
+    } else if (item.size() > 1 && item.back() == 's') {
+      h.kind = Kind::kMs;
+      scale = 1000;
+      item.pop_back();
+    }
+    int64_t v = 0;
+    const char* end = item.data() + item.size();
+    const auto [p, ec] = std::from_chars(item.data(), end, v);
+    if (item.empty() || p != end || (ec != std::errc() && ec != std::errc::result_out_of_range)) {
+      throw std::runtime_error("--horizons: bad horizon '" + raw +
+                               "' (expected N, kN, Nms or Ns)");
+    }
+    const int64_t max = h.kind == Kind::kMs ? kMaxHorizonMs : kMaxHorizonChanges;
+    if (ec == std::errc::result_out_of_range || v <= 0 || v > max / scale) {
+      throw std::runtime_error(
+          "--horizons: horizon '" + raw + "' out of range (1 to " +
+          std::to_string(max) + (h.kind == Kind::kMs ? " ms)" : " changes)"));
+    }
+    h.n = static_cast<int>(v * scale);
+    for (const auto& o : out) {
+      if (o.name() == h.name()) {
+        throw std::runtime_error("--horizons: " + h.name() + " given twice");
+      }
+    }
+    out.push_back(h);
+  }
+  return out;
+}
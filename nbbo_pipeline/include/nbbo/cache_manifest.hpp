@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace nbbo {
+
+// Per cache-subdirectory record of which input produced each msbin, and under
+// which Stage A settings. One tab-separated line per input file:
+//
+//   csv  size  mtime  content_hash  settings_fingerprint  msbin
+//
+// An msbin is reusable when its input still has the recorded size and mtime
+// (or, if those moved, the same content hash) and the settings fingerprint
+// matches the current run. The content hash is only recomputed when size or
+// mtime changed, so an unchanged tree costs one stat per input. A rebuild
+// records the hash of the bytes its ingest read (see ContentHasher), so it
+// does not read the input an extra time either.
+//
+// Several manifests of one directory may be live at once (one per symbol in a
+// multi-symbol run); save() keeps the entries the others wrote since load.
+
+struct InputStamp {
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  uint64_t hash = 0;  // 0: not computed
+};
+
+struct ManifestEntry {
+  InputStamp input;
+  uint64_t fingerprint = 0;
+  std::string msbin;  // file name inside the cache subdir
+};
+
+// Word-at-a-time FNV-1a over the raw (compressed) bytes: 8-byte words at
+// file offsets that are multiples of 8, then the tail bytes. A change
+// detector, not a cryptographic hash. Fed incrementally, so a reader that
+// already streams the file (ingest, gzip indexing) gets it without a second
+// read; any split of the input gives the same value.
+class ContentHasher {
+ public:
+  void update(const void* data, size_t n) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    if (carry_n_) {
+      const size_t k = std::min(n, 8 - carry_n_);
+      std::memcpy(carry_ + carry_n_, p, k);
+      carry_n_ += k;
+      p += k;
+      n -= k;
+      if (carry_n_ < 8) return;
+      mix_word(carry_);
+      carry_n_ = 0;
+    }
+    for (; n >= 8; p += 8, n -= 8) mix_word(p);
+    std::memcpy(carry_, p, n);
+    carry_n_ = n;
+  }
+
+  uint64_t value() const {
+    uint64_t h = h_;
+    for (size_t i = 0; i < carry_n_; ++i) h = (h ^ carry_[i]) * 1099511628211ULL;
+    return h;
+  }
+
+ private:
+  void mix_word(const unsigned char* p) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h_ = (h_ ^ w) * 1099511628211ULL;
+  }
+
+  uint64_t h_ = 14695981039346656037ULL;
+  unsigned char carry_[8];
+  size_t carry_n_ = 0;
+};
+
+inline uint64_t hash_file(const std::filesystem::path& p) {
+  std::FILE* f = std::fopen(p.string().c_str(), "rb");
+  if (!f) throw std::runtime_error("cannot open for hashing: " + p.string());
+  std::vector<unsigned char> buf(1 << 20);
+  ContentHasher h;
+  size_t n;
+  while ((n = std::fread(buf.data(), 1, buf.size(), f)) > 0) h.update(buf.data(), n);
+  const bool err = std::ferror(f) != 0;
+  std::fclose(f);
+  if (err) throw std::runtime_error("read failed while hashing: " + p.string());
+  return h.value();
+}
+
+inline InputStamp stat_input(const std::filesystem::path& p) {
+  InputStamp s;
+  s.size = std::filesystem::file_size(p);
+  s.mtime = static_cast<int64_t>(
+      std::filesystem::last_write_time(p).time_since_epoch().count());
+  return s;
+}
+
+class CacheManifest {
+ public:
+  static constexpr const char* kFileName = "manifest.tsv";
+
+  // Missing or unreadable manifests load as empty (everything is rebuilt).
+  static CacheManifest load(const std::filesystem::path& dir) {
+    CacheManifest m;
+    m.path_ = dir / kFileName;
+    std::ifstream in(m.path_);
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream ss(line);
+      std::string csv, hash, fp;
+      ManifestEntry e;
+      if (!std::getline(ss, csv, '\t') || !(ss >> e.input.size >> e.input.mtime >> hash >> fp >> e.msbin)) {
+        continue;
+      }
+      e.input.hash = std::stoull(hash, nullptr, 16);
+      e.fingerprint = std::stoull(fp, nullptr, 16);
+      m.entries_[csv] = std::move(e);
+    }
+    return m;
+  }
+
+  // Tmp file + rename, so readers never see a half-written manifest. Entries
+  // this manifest did not put or refresh are taken from the file as it is
+  // now, so concurrent writers in one process do not drop each other's.
+  void save() {
+    static std::mutex save_mu;
+    std::lock_guard<std::mutex> lk(save_mu);
+    for (auto& [csv, e] : load(path_.parent_path()).entries_) {
+      if (!touched_.count(csv)) entries_[csv] = std::move(e);
+    }
+    const auto tmp = path_.string() + ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::trunc);
+      if (!out) throw std::runtime_error("cannot write manifest: " + tmp);
+      out << "# csv\tsize\tmtime\thash\tfingerprint\tmsbin\n";
+      char hex[2][17];
+      for (const auto& [csv, e] : entries_) {
+        std::snprintf(hex[0], sizeof(hex[0]), "%016llx", static_cast<unsigned long long>(e.input.hash));
+        std::snprintf(hex[1], sizeof(hex[1]), "%016llx", static_cast<unsigned long long>(e.fingerprint));
+        out << csv << '\t' << e.input.size << '\t' << e.input.mtime << '\t' << hex[0]
+            << '\t' << hex[1] << '\t' << e.msbin << '\n';
+      }
+      if (!out) throw std::runtime_error("cannot write manifest: " + tmp);
+    }
+    std::filesystem::rename(tmp, path_);
+    dirty_ = false;
+  }
+
+  bool dirty() const { return dirty_; }
+
+  const ManifestEntry* find(const std::string& csv) const {
+    auto it = entries_.find(csv);
+    return it == entries_.end() ? nullptr : &it->second;
+  }
+
+  void put(const std::string& csv, ManifestEntry e) {
+    entries_[csv] = std::move(e);
+    touched_.insert(csv);
+    dirty_ = true;
+  }
+
+  // True if `csv` (currently stamped `now`, size+mtime only) is unchanged
+  // since its entry was written. A size/mtime mismatch triggers a content
+  // hash; if that still matches, `now` gets the hash and the entry is
+  // refreshed so the next run is a plain stat again.
+  bool input_unchanged(const std::string& csv, const std::filesystem::path& path,
+                       InputStamp& now) {
+    auto it = entries_.find(csv);
+    if (it == entries_.end()) return false;
+    InputStamp& was = it->second.input;
+    if (was.size == now.size && was.mtime == now.mtime) {
+      now.hash = was.hash;
+      return true;
+    }
+    if (was.size != now.size || was.hash == 0) return false;
+    now.hash = hash_file(path);
+    if (now.hash != was.hash) return false;
+    was = now;
+    touched_.insert(csv);
+    dirty_ = true;
+    return true;
+  }
+
+ private:
+  std::filesystem::path path_;
+  std::map<std::string, ManifestEntry> entries_;
+  std::set<std::string> touched_;
+  bool dirty_ = false;
+};
+
+}  // namespace nbbo
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace nbbo {
+
+// Allocation-free CSV scanning for the quote hot loop.
+//
+// Lines and fields are handed out as string_views into a caller-owned block
+// buffer. Separator search is vectorised: one compare + movemask per 32 bytes
+// (AVX2) or 16 bytes (SSE2 / NEON), with a scalar fallback elsewhere. The
+// instruction set is picked at compile time (-march / -mavx2).
+
+#if defined(__AVX2__)
+inline constexpr const char* kCsvScanIsa = "avx2";
+#elif defined(__SSE2__) || defined(_M_X64)
+inline constexpr const char* kCsvScanIsa = "sse2";
+#elif defined(__ARM_NEON)
+inline constexpr const char* kCsvScanIsa = "neon";
+#else
+inline constexpr const char* kCsvScanIsa = "scalar";
+#endif
+
+namespace detail {
+
+#if defined(__AVX2__)
+inline constexpr int kScanWidth = 32;
+inline uint32_t eq_mask(const char* p, char c) {
+  const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  return static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+inline constexpr int kScanWidth = 16;
+inline uint32_t eq_mask(const char* p, char c) {
+  const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  return static_cast<uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+}
+#elif defined(__ARM_NEON)
+inline constexpr int kScanWidth = 16;
+inline uint32_t eq_mask(const char* p, char c) {
+  // NEON has no movemask: narrow each 0x00/0xFF lane to a nibble, then
+  // compress the 64-bit result to one bit per byte.
+  const uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)),
+                                 vdupq_n_u8(static_cast<uint8_t>(c)));
+  const uint64_t nib = vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+  uint32_t m = 0;
+  for (int i = 0; i < 16; ++i) m |= static_cast<uint32_t>((nib >> (4 * i)) & 1) << i;
+  return m;
+}
+#else
+inline constexpr int kScanWidth = 0;
+#endif
+
+inline int ctz32(uint32_t m) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctz(m);
+#else
+  int n = 0;
+  while (!(m & 1u)) { m >>= 1; ++n; }
+  return n;
+#endif
+}
+
+}  // namespace detail
+
+// First occurrence of c in [p, e), or e.
+inline const char* find_byte(const char* p, const char* e, char c) {
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || defined(__ARM_NEON)
+  constexpr int W = detail::kScanWidth;
+  for (; e - p >= W; p += W) {
+    if (uint32_t m = detail::eq_mask(p, c)) return p + detail::ctz32(m);
+  }
+#endif
+  const void* r = std::memchr(p, c, static_cast<size_t>(e - p));
+  return r ? static_cast<const char*>(r) : e;
+}
+
+// Split `line` on ',' into at most `max_fields` views. The last view holds the
+// remainder of the line (commas included) once max_fields-1 separators have
+// been seen, so callers that only need the leading columns stop early.
+// Returns the number of fields written.
+inline int split_csv(std::string_view line, std::string_view* out,
+                     int max_fields) {
+  if (max_fields <= 1) {
+    out[0] = line;
+    return 1;
+  }
+  const char* const e = line.data() + line.size();
+  const char* p = line.data();
+  const char* start = p;
+  int n = 0;
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || defined(__ARM_NEON)
+  constexpr int W = detail::kScanWidth;
+  for (; e - p >= W; p += W) {
+    uint32_t m = detail::eq_mask(p, ',');
+    while (m) {
+      const char* c = p + detail::ctz32(m);
+      out[n++] = std::string_view(start, static_cast<size_t>(c - start));
+      start = c + 1;
+      if (n == max_fields - 1) {
+        out[n++] = std::string_view(start, static_cast<size_t>(e - start));
+        return n;
+      }
+      m &= m - 1;
+    }
+  }
+#endif
+  for (; p < e; ++p) {
+    if (*p != ',') continue;
+    out[n++] = std::string_view(start, static_cast<size_t>(p - start));
+    start = p + 1;
+    if (n == max_fields - 1) break;
+  }
+  out[n++] = std::string_view(start, static_cast<size_t>(e - start));
+  return n;
+}
+
+// Fixed-width digit runs without locale, errno or allocation.
+inline bool parse_digits(const char* p, int n, int& out) {
+  int v = 0;
+  for (int i = 0; i < n; ++i) {
+    const unsigned d = static_cast<unsigned char>(p[i]) - '0';
+    if (d > 9) return false;
+    v = v * 10 + static_cast<int>(d);
+  }
+  out = v;
+  return true;
+}
+
+// "H:MM:SS[.fff...]" or "HH:MM:SS[.fff...]" -> h, m, s, ms. Fractional digits
+// past the millisecond are ignored (truncation, as in the TAQ TIME_M column).
+inline bool parse_hms_ms(std::string_view t, int& h, int& m, int& s, int& ms) {
+  const char* p = t.data();
+  const size_t L = t.size();
+  size_t hl = (L >= 2 && p[1] == ':') ? 1 : 2;
+  if (L < hl + 6 || p[hl] != ':' || p[hl + 3] != ':') return false;
+  if (!parse_digits(p, static_cast<int>(hl), h) ||
+      !parse_digits(p + hl + 1, 2, m) || !parse_digits(p + hl + 4, 2, s)) {
+    return false;
+  }
+  ms = 0;
+  const size_t f = hl + 6;
+  if (L > f && p[f] == '.') {
+    int scale = 100;
+    for (size_t i = f + 1; i < L && scale > 0; ++i, scale /= 10) {
+      const unsigned d = static_cast<unsigned char>(p[i]) - '0';
+      if (d > 9) return false;
+      ms += static_cast<int>(d) * scale;
+    }
+  }
+  return true;
+}
+
+}  // namespace nbbo
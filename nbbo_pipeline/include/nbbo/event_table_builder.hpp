@@ -5,64 +5,141 @@
 
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "nbbo/build_events_config.hpp"
 #include "nbbo/event_types.hpp"
 #include "nbbo/event_writer.hpp"
-
-// builds per-mid-change events and labels them with next move and waiting time
-// from a cleaned NBBO grid
-class EventTableBuilder {
+#include "nbbo/task_pool.hpp"
+#include "nbbo/ts_decode.hpp"
+
+// builds per-mid-change events of whole trading days and labels them with
+// next move and waiting time. All state resets at a day change, so input
+// that starts on a new day can be built independently of what precedes it.
+//
+// With extra horizons, an event that passed the next-change label waits in
+// a per-day FIFO ring until every horizon has resolved: the k-th next mid
+// change has arrived, or a mid change later than the event's ms + n (the
+// mid standing at that time is then the previous change's). Events leave
+// the ring in order; horizons still open at the day's end stay invalid.
+// The ring is not capped: it doubles whenever full, so its memory follows
+// the events waiting inside the longest horizon. That is about N events for
+// a change horizon of N, and every event of the last n ms for a clock
+// horizon; a long Ns horizon on a busy day can keep a large part of the
+// day's events pending. The ring keeps its size across days.
+class DayEventBuilder {
  public:
-  explicit EventTableBuilder(const BuildEventsConfig& cfg);
-
-  // entry point to run pipeline from input file to labeled events output file
-  void run();
-
- private:
-  void ensure_output_dir();
-  void open_input();
-  void init_reader();
-  void process_stream();
+  struct Counts {
+    uint64_t ticks_total = 0;
+    uint64_t events_detected = 0;
+    uint64_t events_written = 0;
+    uint64_t events_dropped_bigmove = 0;
+    uint64_t events_dropped_boundary = 0;
+
+    void add(const Counts& o) {
+      ticks_total += o.ticks_total;
+      events_detected += o.events_detected;
+      events_written += o.events_written;
+      events_dropped_bigmove += o.events_dropped_bigmove;
+      events_dropped_boundary += o.events_dropped_boundary;
+    }
+  };
+
+  // Labeled events are appended to `out` in input order, and their
+  // horizons.size() labels each to `out_h`.
+  DayEventBuilder(nbbo::Px threshold_next_px,
+                  const std::vector<nbbo::EventHorizon>& horizons,
+                  std::vector<nbbo::LabeledEvent>& out,
+                  std::vector<nbbo::HorizonLabel>& out_h)
+      : out_(out),
+        out_h_(out_h),
+        horizons_(horizons),
+        cursor_(horizons.size(), 0),
+        threshold_next_px_(threshold_next_px) {}
 
   void process_batch(const std::shared_ptr<arrow::RecordBatch>& batch);
 
-  void process_row(int64_t i,
-                   const std::shared_ptr<arrow::Array>& ts_arr,
-                   const std::shared_ptr<arrow::Array>& mid_arr,
-                   const std::shared_ptr<arrow::Array>& lr_arr,
-                   const std::shared_ptr<arrow::Array>& bid_sz_arr,
-                   const std::shared_ptr<arrow::Array>& ask_sz_arr,
-                   const std::shared_ptr<arrow::Array>& spread_arr,
-                   const std::shared_ptr<arrow::Array>& bid_arr,
-                   const std::shared_ptr<arrow::Array>& ask_arr);
-
-  void start_new_day(uint32_t day, uint64_t ts, double bid, double ask);
+  // Drops the last day's pending event: it has no next move.
   void finish_day();
 
-  void update_quote_ages(int ms, double bid, double ask);
+  // Counts since the previous call.
+  Counts take_counts() { return std::exchange(counts_, Counts{}); }
+
+ private:
+  // One batch as raw column spans, resolved once in process_batch. Prices
+  // are Px; sizes stay int32 or become double; log_return is float or double.
+  template <typename LrT, typename SzT>
+  struct RowSpans {
+    const uint64_t* ts;
+    const nbbo::Px* mid;
+    const nbbo::Px* spread;
+    const nbbo::Px* bid;
+    const nbbo::Px* ask;
+    const SzT* bid_sz;
+    const SzT* ask_sz;
+    const LrT* lr;
+    const uint8_t* lr_valid;  // log_return null bitmap, nullptr if no nulls
+    int64_t lr_offset;
+    const uint64_t* valid;    // bit i: row i has no null outside log_return;
+                              // nullptr if no column has nulls
+  };
+
+  template <typename LrT, typename SzT>
+  void process_rows(const RowSpans<LrT, SzT>& s, int64_t n);
+
+  template <typename LrT, typename SzT>
+  void process_tick(const RowSpans<LrT, SzT>& s, int64_t i);
+
+  void start_new_day(uint32_t day, int ms, nbbo::Px bid, nbbo::Px ask);
+
+  void update_quote_ages(int ms, nbbo::Px bid, nbbo::Px ask);
 
   static double compute_imbalance(double bid_sz, double ask_sz);
 
   void label_and_emit_prev(const nbbo::LabeledEvent& ev, int ms_curr);
-  void print_summary() const;
-
-  BuildEventsConfig cfg_;
-  std::shared_ptr<arrow::Schema> in_schema_;
-  std::unique_ptr<parquet::arrow::FileReader> reader_;
-  std::shared_ptr<arrow::RecordBatchReader> rb_reader_;
-  nbbo::EventWriter writer_;
 
-  uint64_t ticks_total_ = 0;
-  uint64_t events_detected_ = 0;
-  uint64_t events_written_ = 0;
-  uint64_t events_dropped_bigmove_ = 0;
-  uint64_t events_dropped_boundary_ = 0;
+  // Horizon ring: events that passed the next-change label, waiting for
+  // their horizons.
+  struct Pending {
+    nbbo::LabeledEvent ev;
+    uint64_t id;  // event sequence number
+    int ms;       // ms of day
+    size_t open;  // horizons not resolved yet
+  };
+  Pending& pending_at(uint64_t pos) { return ring_[pos & (ring_.size() - 1)]; }
+  nbbo::HorizonLabel* labels_at(uint64_t pos) {
+    return &ring_h_[(pos & (ring_.size() - 1)) * horizons_.size()];
+  }
+  void push_pending(const nbbo::LabeledEvent& ev, uint64_t id, int ms);
+  void resolve_horizons(const nbbo::LabeledEvent& ev, uint64_t id, int ms);
+  void pop_resolved();
+  void flush_pending();  // day end: the rest leave with open horizons invalid
+  void emit(const nbbo::LabeledEvent& ev, const nbbo::HorizonLabel* h);
+
+  std::vector<nbbo::LabeledEvent>& out_;
+  std::vector<nbbo::HorizonLabel>& out_h_;
+  std::vector<nbbo::EventHorizon> horizons_;
+  std::vector<Pending> ring_;               // power-of-two size
+  std::vector<nbbo::HorizonLabel> ring_h_;  // horizons_.size() per slot
+  uint64_t head_ = 0;                       // ring positions [head_, tail_)
+  uint64_t tail_ = 0;
+  std::vector<uint64_t> cursor_;            // per horizon: next position
+  nbbo::Px threshold_next_px_ = 0;  // threshold_next in Px
+  Counts counts_;
+
+  nbbo::DecodedTs ts_cols_;  // current batch's ts as day / ms of day
+  // Per-batch conversions for columns not stored in the span types.
+  std::vector<nbbo::Px> px_scratch_[4];
+  std::vector<double> size_scratch_[2];
+  std::vector<uint64_t> valid_words_;
 
   uint32_t curr_day_ = 0;
   bool have_day_ = false;
-  double last_bid_price_ = 0.0;
-  double last_ask_price_ = 0.0;
+
+  nbbo::Px last_bid_price_ = 0;
+  nbbo::Px last_ask_price_ = 0;
   int bid_origin_ms_ = 0;
   int ask_origin_ms_ = 0;
   double age_bid_ms_ = 0.0;
@@ -71,4 +148,67 @@ class EventTableBuilder {
   double last_move_sign_ = 0.0;
   bool have_prev_event_ = false;
   nbbo::LabeledEvent prev_event_{};
+  int prev_event_ms_ = 0;  // ms of day of prev_event_
+  uint64_t prev_event_id_ = 0;
+  uint64_t next_event_id_ = 0;
+};
+
+// builds the labeled events file of one cleaned NBBO grid file. The input is
+// cut into runs of row groups that begin on a new day; runs are built as
+// tasks on `pool` and written to the output in order.
+class EventTableBuilder {
+ public:
+  // Log output is written under `log_mu`, shared by builders running at once.
+  EventTableBuilder(const BuildEventsConfig& cfg, nbbo::TaskPool& pool,
+                    std::mutex& log_mu);
+
+  // entry point to run pipeline from input file to labeled events output file
+  void run();
+
+  const DayEventBuilder::Counts& counts() const { return counts_; }
+
+ private:
+  // Row groups [rg_lo, rg_hi); the first row of rg_lo starts a new day.
+  struct Segment {
+    int rg_lo;
+    int rg_hi;
+  };
+
+  void ensure_output_dir();
+  void open_input();
+  void plan_segments();
+  void process_segments();
+
+  // First and last day in row group rg, from its ts statistics or, without
+  // them, from its ts column.
+  std::pair<uint32_t, uint32_t> row_group_days(int rg, int ts_col) const;
+
+  // Builds one segment into `out` / `out_h` on its own reader. With
+  // `stream` every batch's events are written as they come (single-segment
+  // files).
+  DayEventBuilder::Counts build_segment(const Segment& seg,
+                                        std::vector<nbbo::LabeledEvent>& out,
+                                        std::vector<nbbo::HorizonLabel>& out_h,
+                                        bool stream);
+
+  // Appends events and their horizon labels in order, then clears them;
+  // adds c to the totals.
+  void write_events(std::vector<nbbo::LabeledEvent>& events,
+                    std::vector<nbbo::HorizonLabel>& labels,
+                    const DayEventBuilder::Counts& c);
+
+  void print_summary() const;
+
+  BuildEventsConfig cfg_;
+  nbbo::TaskPool& pool_;
+  std::mutex& log_mu_;
+
+  std::shared_ptr<arrow::Schema> in_schema_;
+  std::unique_ptr<parquet::arrow::FileReader> reader_;
+  std::vector<int> all_cols_;
+  std::vector<Segment> segments_;
+  nbbo::EventWriter writer_;
+  nbbo::Px threshold_next_px_ = 0;  // cfg_.threshold_next in Px
+
+  DayEventBuilder::Counts counts_;
 };
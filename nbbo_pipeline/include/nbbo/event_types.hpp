@@ -1,5 +1,8 @@
 #pragma once
 #include <cstdint>
+#include <string>
+
+#include "nbbo/price.hpp"
 
 namespace nbbo {
 
@@ -8,9 +11,9 @@ namespace nbbo {
 struct LabeledEvent {
   uint64_t ts;         // Timestamp of the mid-change
   uint32_t day;        // YYYYMMDD for grouping by trading day
-  double mid;          // Mid-price at event time
-  double mid_next;     // Mid-price at the next mid-change event (same day)
-  double spread;       // ask - bid at event time
+  Px mid;              // Mid-price at event time (1/10000 $)
+  Px mid_next;         // Mid-price at the next mid-change event (same day)
+  Px spread;           // ask - bid at event time (1/10000 $)
   double imbalance;    // (bid_size - ask_size) / (bid_size + ask_size)
   double age_diff_ms;  // Age(bid) - Age(ask) in ms
   double last_move;    // Prev mid-move direction: {-1, 0, +1}
@@ -18,4 +21,28 @@ struct LabeledEvent {
   double tau_ms;       // Time until next mid-change (ms)
 };
 
+// An extra labeling horizon (build_events --horizons): the k-th next mid
+// change of the same day (kChanges), or the mid standing n ms after the
+// event (kMs).
+struct EventHorizon {
+  enum class Kind : uint8_t { kChanges, kMs };
+  Kind kind;
+  int n;
+
+  // Column suffix: k<n> or <n>ms
+  std::string name() const {
+    return kind == Kind::kChanges ? "k" + std::to_string(n)
+                                  : std::to_string(n) + "ms";
+  }
+};
+
+// Label of one event at one EventHorizon. valid is false when the day ended
+// before the horizon did.
+struct HorizonLabel {
+  Px mid_next;     // Mid-price the horizon ends on
+  int32_t tau_ms;  // Time to the mid change that set mid_next (ms)
+  int8_t y;        // Sign(mid_next - mid): {-1, 0, +1}
+  bool valid;
+};
+
 }  // namespace nbbo
@@ -8,38 +8,51 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "nbbo/arrow_utils.hpp"
 #include "nbbo/event_types.hpp"
+#include "nbbo/parquet_writer_config.hpp"
+#include "nbbo/price.hpp"
+#include "nbbo/schema.hpp"
+#include "nbbo/task_pool.hpp"
 
 namespace nbbo {
 
-// Writes nbbo::LabeledEvent rows into a parquet file
+struct EventWriterOptions {
+  int64_t batch_rows = 0;  // rows per batch handed to the encoder; 0 = row group rows
+  bool async = true;       // encode batches as pool tasks
+};
+
+// Writes nbbo::LabeledEvent rows into a parquet file in the compact
+// events_schema() layout (version 2, see nbbo/schema.hpp), plus the
+// columns of each extra labeling horizon in `horizons`.
+// Row groups follow `pq` (by default one per trading day, at most 1M rows).
+//
+// append() stores each field straight into the column buffers of one of two
+// preallocated batches. A full batch (or, with day row groups, the last
+// batch of a day) goes to the encoder, which writes it as arrays: a full
+// batch hands its buffers over without copying (the batch then gets new
+// ones), a short one copies just its rows out and keeps its buffers, so the
+// row groups pending in the writer hold no more memory than their rows.
+//
+// With opt.async each batch is encoded by a task on `pool` while the other
+// one fills, so Parquet encoding overlaps the caller and no writer has a
+// thread of its own; append() waits only when the previous batch is still
+// being encoded (and on a pool thread runs it itself if it has not
+// started). Without a pool the writer keeps a one-thread pool.
 class EventWriter {
  public:
-  explicit EventWriter(const std::string& out_path)
-      : tsb_(arrow::default_memory_pool()),
-        dateb_(arrow::default_memory_pool()),
-        midb_(arrow::default_memory_pool()),
-        mid_nextb_(arrow::default_memory_pool()),
-        sprb_(arrow::default_memory_pool()),
-        imbb_(arrow::default_memory_pool()),
-        agediffb_(arrow::default_memory_pool()),
-        lastmoveb_(arrow::default_memory_pool()),
-        yb_(arrow::default_memory_pool()),
-        taub_(arrow::default_memory_pool()) {
-    schema_ = arrow::schema({
-        arrow::field("ts", arrow::uint64()),
-        arrow::field("date", arrow::uint32()),
-        arrow::field("mid", arrow::float64()),
-        arrow::field("mid_next", arrow::float64()),
-        arrow::field("spread", arrow::float64()),
-        arrow::field("imbalance", arrow::float64()),
-        arrow::field("age_diff_ms", arrow::float64()),
-        arrow::field("last_move", arrow::float64()),
-        arrow::field("y", arrow::float64()),
-        arrow::field("tau_ms", arrow::float64()),
-    });
+  explicit EventWriter(const std::string& out_path,
+                       const ParquetWriterConfig& pq = {},
+                       const EventWriterOptions& opt = {},
+                       const std::vector<EventHorizon>& horizons = {},
+                       TaskPool* pool = nullptr)
+      : rg_rows_(pq.row_group_rows_or(1'000'000)),
+        batch_max_(opt.batch_rows > 0 ? opt.batch_rows : rg_rows_),
+        by_day_(pq.row_groups_by_day),
+        n_horizons_(horizons.size()) {
+    schema_ = events_schema(horizons);
 
     // Open file output stream
     auto of_res = arrow::io::FileOutputStream::Open(out_path);
@@ -50,96 +63,217 @@ class EventWriter {
     auto outfile = *of_res;
 
     // Create Parquet writer
-    auto fw_res = parquet::arrow::FileWriter::Open(
-        *schema_, arrow::default_memory_pool(), outfile);
-    if (!fw_res.ok()) {
-      throw std::runtime_error("create writer failed: " +
-                               fw_res.status().ToString());
+    writer_ = open_parquet_writer(outfile, schema_, pq, rg_rows_);
+    row_groups_ = std::make_unique<RowGroupWriter>(writer_.get(), schema_,
+                                                   rg_rows_, by_day_);
+
+    cur_ = &blocks_[0];
+    allocate(blocks_[0]);
+    if (opt.async) {
+      allocate(blocks_[1]);
+      if (!pool) pool = (own_pool_ = std::make_unique<TaskPool>(1)).get();
+      encoding_ = std::make_unique<TaskGroup>(*pool);
     }
-    writer_ = std::move(fw_res).ValueOrDie();
   }
 
-  void append(const nbbo::LabeledEvent& ev) {
-    // Append one LabeledEvent to the active batch
-    // Automatically triggers a batch flush once `BATCH` rows are buffered.
-    nbbo::ARROW_OK(tsb_.Append(ev.ts));
-    nbbo::ARROW_OK(dateb_.Append(ev.day));
-    nbbo::ARROW_OK(midb_.Append(ev.mid));
-    nbbo::ARROW_OK(mid_nextb_.Append(ev.mid_next));
-    nbbo::ARROW_OK(sprb_.Append(ev.spread));
-    nbbo::ARROW_OK(imbb_.Append(ev.imbalance));
-    nbbo::ARROW_OK(agediffb_.Append(ev.age_diff_ms));
-    nbbo::ARROW_OK(lastmoveb_.Append(ev.last_move));
-    nbbo::ARROW_OK(yb_.Append(ev.y));
-    nbbo::ARROW_OK(taub_.Append(ev.tau_ms));
-
-    if (++batch_rows_ >= BATCH) {
-      flush_batch();
+  EventWriter(const EventWriter&) = delete;
+  EventWriter& operator=(const EventWriter&) = delete;
+
+  // Without close() (an exception upstream) the file is left unfinished;
+  // a batch still being encoded is waited for and its error dropped.
+  ~EventWriter() = default;
+
+  // `h` holds one label per horizon (none without horizons).
+  void append(const nbbo::LabeledEvent& ev, const HorizonLabel* h = nullptr) {
+    // Append one LabeledEvent to the current batch
+    // Automatically hands the batch off once `batch_max_` rows are
+    // buffered, and before the first event of a new day with by_day_.
+    if (by_day_ && ev.day != batch_day_ && cur_->n > 0) hand_off();
+    batch_day_ = ev.day;
+    Block& b = *cur_;
+    const int64_t i = b.n;
+    // Ages and waiting times are whole ms, signs are -1 / 0 / +1
+    b.ts[i] = ev.ts;
+    b.mid[i] = ev.mid;
+    b.mid_next[i] = ev.mid_next;
+    b.spread[i] = ev.spread;
+    b.imbalance[i] = ev.imbalance;
+    b.age_diff_ms[i] = static_cast<int32_t>(ev.age_diff_ms);
+    b.last_move[i] = static_cast<int8_t>(ev.last_move);
+    b.y[i] = static_cast<int8_t>(ev.y);
+    b.tau_ms[i] = static_cast<int32_t>(ev.tau_ms);
+    for (size_t k = 0; k < n_horizons_; ++k) {
+      HorizonColumns& c = b.h[k];
+      const uint8_t bit = static_cast<uint8_t>(1u << (i & 7));
+      c.valid[i >> 3] = h[k].valid ? (c.valid[i >> 3] | bit)
+                                   : (c.valid[i >> 3] & ~bit);
+      c.mid_next[i] = h[k].mid_next;
+      c.y[i] = h[k].y;
+      c.tau_ms[i] = h[k].tau_ms;
+    }
+
+    if (++b.n >= batch_max_) {
+      hand_off();
     }
   }
 
   void close() {
     // Finalize file by:
-    // - Flushing remaining buffered rows
-    // - Closing the parquet writer
-    flush_batch();
-    if (writer_) {
-      nbbo::ARROW_OK(writer_->Close());
-    }
+    // - Waiting for the batch being encoded, then encoding the last one here
+    // - Flushing the last row group and closing the parquet writer
+    if (closed_) return;
+    closed_ = true;
+    total_rows_ += static_cast<uint64_t>(cur_->n);
+    cur_->day = batch_day_;
+    if (encoding_) encoding_->wait();
+    encode(*cur_);
+    row_groups_->flush();
+    nbbo::ARROW_OK(writer_->Close());
   }
 
   uint64_t total_rows() const { return total_rows_; }
 
  private:
-  void flush_batch() {
-    // Convert builders -> RecordBatch -> Parquet
-    // Called automatically every `BATCH` rows or on close()
-    if (batch_rows_ == 0) return;
-
-    auto batch = arrow::RecordBatch::Make(schema_, batch_rows_,
-                                          {
-                                              tsb_.Finish().ValueOrDie(),
-                                              dateb_.Finish().ValueOrDie(),
-                                              midb_.Finish().ValueOrDie(),
-                                              mid_nextb_.Finish().ValueOrDie(),
-                                              sprb_.Finish().ValueOrDie(),
-                                              imbb_.Finish().ValueOrDie(),
-                                              agediffb_.Finish().ValueOrDie(),
-                                              lastmoveb_.Finish().ValueOrDie(),
-                                              yb_.Finish().ValueOrDie(),
-                                              taub_.Finish().ValueOrDie(),
-                                          });
-
-    nbbo::ARROW_OK(writer_->WriteRecordBatch(*batch));
-    total_rows_ += static_cast<uint64_t>(batch_rows_);
-    batch_rows_ = 0;
-
-    // Reset builders for next batch
-    tsb_.Reset();
-    dateb_.Reset();
-    midb_.Reset();
-    mid_nextb_.Reset();
-    sprb_.Reset();
-    imbb_.Reset();
-    agediffb_.Reset();
-    lastmoveb_.Reset();
-    yb_.Reset();
-    taub_.Reset();
+  static constexpr int kColumns = 9;
+  static constexpr int kWidth[kColumns] = {8, 4, 4, 4, 8, 4, 1, 1, 4};
+
+  // Columns of one horizon; the three share one validity bitmap.
+  struct HorizonColumns {
+    std::shared_ptr<arrow::Buffer> valid_buf, bufs[3];
+    uint8_t* valid;
+    Px* mid_next;
+    int8_t* y;
+    int32_t* tau_ms;
+  };
+
+  // One batch of column buffers (schema_ order) and typed views of them.
+  // `fresh` is false once encode() has given the buffers to arrays.
+  struct Block {
+    std::shared_ptr<arrow::Buffer> bufs[kColumns];
+    uint64_t* ts;
+    Px* mid;
+    Px* mid_next;
+    Px* spread;
+    double* imbalance;
+    int32_t* age_diff_ms;
+    int8_t* last_move;
+    int8_t* y;
+    int32_t* tau_ms;
+    std::vector<HorizonColumns> h;
+    int64_t n = 0;
+    uint32_t day = 0;  // day passed to the row-group writer
+    bool fresh = false;
+  };
+
+  // New buffers: the previous ones now belong to written arrays.
+  void allocate(Block& b) const {
+    for (int c = 0; c < kColumns; ++c) {
+      b.bufs[c] = arrow::AllocateBuffer(batch_max_ * kWidth[c]).ValueOrDie();
+    }
+    auto data = [&](int c) { return b.bufs[c]->mutable_data(); };
+    b.ts = reinterpret_cast<uint64_t*>(data(0));
+    b.mid = reinterpret_cast<Px*>(data(1));
+    b.mid_next = reinterpret_cast<Px*>(data(2));
+    b.spread = reinterpret_cast<Px*>(data(3));
+    b.imbalance = reinterpret_cast<double*>(data(4));
+    b.age_diff_ms = reinterpret_cast<int32_t*>(data(5));
+    b.last_move = reinterpret_cast<int8_t*>(data(6));
+    b.y = reinterpret_cast<int8_t*>(data(7));
+    b.tau_ms = reinterpret_cast<int32_t*>(data(8));
+    b.h.resize(n_horizons_);
+    for (auto& c : b.h) {
+      c.valid_buf = arrow::AllocateBuffer((batch_max_ + 7) / 8).ValueOrDie();
+      c.bufs[0] = arrow::AllocateBuffer(batch_max_ * 4).ValueOrDie();
+      c.bufs[1] = arrow::AllocateBuffer(batch_max_).ValueOrDie();
+      c.bufs[2] = arrow::AllocateBuffer(batch_max_ * 4).ValueOrDie();
+      c.valid = c.valid_buf->mutable_data();
+      c.mid_next = reinterpret_cast<Px*>(c.bufs[0]->mutable_data());
+      c.y = reinterpret_cast<int8_t*>(c.bufs[1]->mutable_data());
+      c.tau_ms = reinterpret_cast<int32_t*>(c.bufs[2]->mutable_data());
+    }
+    b.n = 0;
+    b.fresh = true;
+  }
+
+  // Hands the current batch to the encoder and continues in the other one
+  // once its previous encode is done (rethrowing that encode's error).
+  void hand_off() {
+    cur_->day = batch_day_;
+    total_rows_ += static_cast<uint64_t>(cur_->n);
+    if (!encoding_) {
+      encode(*cur_);
+      reuse(*cur_);
+      return;
+    }
+    encoding_->wait();
+    Block* b = cur_;
+    encoding_->run([this, b] { encode(*b); });
+    cur_ = (b == &blocks_[0]) ? &blocks_[1] : &blocks_[0];
+    reuse(*cur_);
+  }
+
+  // Ready for appends after encode(): new buffers if the old ones went out.
+  void reuse(Block& b) const {
+    if (b.fresh) {
+      b.n = 0;
+    } else {
+      allocate(b);
+    }
+  }
+
+  // The first `bytes` of buf as an array buffer: buf itself for a full
+  // batch, else a copy of just those bytes.
+  static std::shared_ptr<arrow::Buffer> rows_of(
+      const std::shared_ptr<arrow::Buffer>& buf, int64_t bytes, bool whole) {
+    return whole ? buf : buf->CopySlice(0, bytes).ValueOrDie();
+  }
+
+  // Convert buffers -> RecordBatch -> Parquet. A pool task with opt.async.
+  void encode(Block& b) {
+    if (b.n == 0) return;
+    const bool whole = b.n == batch_max_;
+    std::vector<std::shared_ptr<arrow::Array>> cols(kColumns);
+    for (int c = 0; c < kColumns; ++c) {
+      cols[c] = arrow::MakeArray(arrow::ArrayData::Make(
+          schema_->field(c)->type(), b.n,
+          {nullptr, rows_of(b.bufs[c], b.n * kWidth[c], whole)}, 0));
+    }
+    // Horizon columns: null count left for Arrow to compute
+    for (const auto& h : b.h) {
+      auto valid = rows_of(h.valid_buf, (b.n + 7) / 8, whole);
+      const int64_t width[3] = {4, 1, 4};
+      for (int k = 0; k < 3; ++k) {
+        const int c = static_cast<int>(cols.size());
+        cols.push_back(arrow::MakeArray(arrow::ArrayData::Make(
+            schema_->field(c)->type(), b.n,
+            {valid, rows_of(h.bufs[k], b.n * width[k], whole)})));
+      }
+    }
+    if (whole) b.fresh = false;
+    row_groups_->write(arrow::RecordBatch::Make(schema_, b.n, std::move(cols)),
+                       b.day);
   }
 
-  // Flush interval
-  static constexpr int64_t BATCH = 1'000'000;
+  // Rows per row group, rows per batch, and day alignment
+  int64_t rg_rows_;
+  int64_t batch_max_;
+  bool by_day_;
+  size_t n_horizons_;
+  uint32_t batch_day_ = 0;
 
   std::shared_ptr<arrow::Schema> schema_;
   std::unique_ptr<parquet::arrow::FileWriter> writer_;
+  std::unique_ptr<RowGroupWriter> row_groups_;
 
-  // Column builders
-  arrow::UInt64Builder tsb_;
-  arrow::UInt32Builder dateb_;
-  arrow::DoubleBuilder midb_, mid_nextb_, sprb_, imbb_, agediffb_, lastmoveb_,
-      yb_, taub_;
+  // Double buffer: one block fills while the other is encoded. The pool
+  // and the group are declared after the blocks so that, on destruction,
+  // an encode still running finishes before the blocks go.
+  Block blocks_[2];
+  Block* cur_ = nullptr;
+  std::unique_ptr<TaskPool> own_pool_;  // async without a shared pool
+  std::unique_ptr<TaskGroup> encoding_;  // the batch being encoded
+  bool closed_ = false;
 
-  int64_t batch_rows_ = 0;
   uint64_t total_rows_ = 0;
 };
 
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace nbbo {
+
+// Rejected quotes and books in Stage A, by (day, kind, venue, minute).
+//
+// Each thread bumps its own GlitchStats: one flat uint32 array per trading
+// day, indexed by kind, venue slot and minute since the start of the counted
+// window, so a bump is an index computation and an increment. Arrays are
+// allocated once per day seen; threads merge after the join. Book-level
+// glitches (consolidated NBBO locked or crossed) count under kConsolidated.
+
+enum class Glitch : uint8_t {
+  kParseFail,          // unparsable price or size
+  kNonposField,        // price or size <= 0 in the CSV
+  kNonposPrice,        // price <= 0 at the book
+  kLockedCrossed,      // venue quote with ask <= bid
+  kNbboLockedCrossed,  // consolidated ask <= bid, millisecond not emitted
+};
+inline constexpr size_t kGlitchKinds = 5;
+inline constexpr const char* kGlitchNames[kGlitchKinds] = {
+    "parse_fail", "nonpos_field", "nonpos_price", "locked_crossed",
+    "nbbo_locked_crossed"};
+
+class GlitchStats {
+ public:
+  static constexpr char kConsolidated = '\0';
+
+  // `venues`: the venue codes counted separately; anything else (and
+  // kConsolidated) shares the last slot. Minutes outside [minute_lo,
+  // minute_hi) clamp to the window's ends.
+  GlitchStats(std::string_view venues, int minute_lo, int minute_hi)
+      : names_(venues), minute_lo_(minute_lo),
+        minutes_(std::max(1, minute_hi - minute_lo)) {
+    slot_.fill(static_cast<uint8_t>(venues.size()));
+    for (size_t i = 0; i < venues.size(); ++i) {
+      slot_[static_cast<uint8_t>(venues[i])] = static_cast<uint8_t>(i);
+    }
+    slots_ = venues.size() + 1;
+  }
+
+  void bump(Glitch g, char venue, uint32_t day, int msod) {
+    if (cur_ == kNone || days_[cur_].first != day) cur_ = day_index(day);
+    const int m = std::clamp(msod / 60000 - minute_lo_, 0, minutes_ - 1);
+    ++days_[cur_].second[(static_cast<size_t>(g) * slots_ + slot_[static_cast<uint8_t>(venue)]) *
+                             minutes_ + m];
+  }
+
+  void merge(const GlitchStats& o) {
+    if (o.slots_ != slots_ || o.minutes_ != minutes_ || o.minute_lo_ != minute_lo_) {
+      throw std::runtime_error("GlitchStats::merge: different layouts");
+    }
+    for (const auto& [day, c] : o.days_) {
+      auto& mine = days_[day_index(day)].second;
+      for (size_t i = 0; i < c.size(); ++i) mine[i] += c[i];
+    }
+  }
+
+  uint64_t total(Glitch g) const {
+    uint64_t n = 0;
+    for (const auto& [day, c] : days_) n += kind_sum(c, g);
+    return n;
+  }
+
+  // Human-readable summary: totals, by hour, by venue, and the worst days.
+  void write_report(const std::filesystem::path& p) const {
+    std::ofstream r(p);
+    if (!r) throw std::runtime_error("cannot write glitch report: " + p.string());
+    r << "NBBO pipeline glitch report\n\nTotals:\n";
+    for (size_t k = 0; k < kGlitchKinds; ++k) {
+      const uint64_t n = total(static_cast<Glitch>(k));
+      if (n) r << std::setw(22) << std::left << kGlitchNames[k] << " : " << n << "\n";
+    }
+    r << "\nBy hour (RTH):\n";
+    for (size_t k = 0; k < kGlitchKinds; ++k) {
+      if (!total(static_cast<Glitch>(k))) continue;
+      std::vector<uint64_t> hours(24, 0);
+      for (const auto& [day, c] : days_) {
+        for (size_t v = 0; v < slots_; ++v) {
+          const uint32_t* row = &c[(k * slots_ + v) * minutes_];
+          for (int m = 0; m < minutes_; ++m) hours[((minute_lo_ + m) / 60) % 24] += row[m];
+        }
+      }
+      r << "\n[" << kGlitchNames[k] << "]\n";
+      for (int h = minute_lo_ / 60; h <= (minute_lo_ + minutes_ - 1) / 60; ++h) {
+        r << "  " << h << ":00 - " << hours[h % 24] << "\n";
+      }
+    }
+    r << "\nBy venue:\n";
+    for (size_t v = 0; v < slots_; ++v) {
+      uint64_t n = 0;
+      for (const auto& [day, c] : days_) {
+        for (size_t k = 0; k < kGlitchKinds; ++k) {
+          const uint32_t* row = &c[(k * slots_ + v) * minutes_];
+          for (int m = 0; m < minutes_; ++m) n += row[m];
+        }
+      }
+      if (n) r << "  " << std::setw(6) << std::left << venue_name(v) << " : " << n << "\n";
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> worst;
+    for (const auto& [day, c] : days_) {
+      uint64_t n = 0;
+      for (uint32_t x : c) n += x;
+      if (n) worst.emplace_back(n, day);
+    }
+    std::sort(worst.begin(), worst.end(), [](const auto& a, const auto& b) {
+      return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    if (worst.size() > kWorstDays) worst.resize(kWorstDays);
+    r << "\nWorst days:\n";
+    for (const auto& [n, day] : worst) r << "  " << day << " : " << n << "\n";
+  }
+
+  // One line per nonzero cell: day,kind,venue,minute,count, with minute as
+  // HH:MM local and venue NBBO for book-level glitches. Sorted by day.
+  void write_csv(const std::filesystem::path& p) const {
+    std::ofstream out(p);
+    if (!out) throw std::runtime_error("cannot write glitch table: " + p.string());
+    out << "day,kind,venue,minute,count\n";
+    std::vector<size_t> order(days_.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return days_[a].first < days_[b].first; });
+    char hhmm[8];
+    for (size_t i : order) {
+      const auto& [day, c] = days_[i];
+      for (size_t k = 0; k < kGlitchKinds; ++k) {
+        for (size_t v = 0; v < slots_; ++v) {
+          const uint32_t* row = &c[(k * slots_ + v) * minutes_];
+          for (int m = 0; m < minutes_; ++m) {
+            if (!row[m]) continue;
+            const int t = minute_lo_ + m;
+            std::snprintf(hhmm, sizeof(hhmm), "%02d:%02d", t / 60, t % 60);
+            out << day << ',' << kGlitchNames[k] << ',' << venue_name(v) << ','
+                << hhmm << ',' << row[m] << '\n';
+          }
+        }
+      }
+    }
+    if (!out) throw std::runtime_error("cannot write glitch table: " + p.string());
+  }
+
+ private:
+  static constexpr size_t kNone = SIZE_MAX;
+  static constexpr size_t kWorstDays = 10;
+
+  size_t day_index(uint32_t day) {
+    for (size_t i = days_.size(); i-- > 0;) {
+      if (days_[i].first == day) return i;
+    }
+    days_.emplace_back(day, std::vector<uint32_t>(kGlitchKinds * slots_ * minutes_, 0));
+    return days_.size() - 1;
+  }
+
+  uint64_t kind_sum(const std::vector<uint32_t>& c, Glitch g) const {
+    const size_t span = slots_ * minutes_;
+    uint64_t n = 0;
+    for (size_t i = static_cast<size_t>(g) * span, e = i + span; i < e; ++i) n += c[i];
+    return n;
+  }
+
+  std::string venue_name(size_t v) const {
+    return v < names_.size() ? std::string(1, names_[v]) : std::string("NBBO");
+  }
+
+  std::array<uint8_t, 256> slot_{};
+  std::string names_;
+  size_t slots_ = 1;
+  int minute_lo_;
+  int minutes_;
+  std::vector<std::pair<uint32_t, std::vector<uint32_t>>> days_;
+  size_t cur_ = kNone;
+};
+
+}  // namespace nbbo
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "nbbo/cache_manifest.hpp"
+#include "nbbo/csv_scan.hpp"
+
+namespace nbbo {
+
+// Random access into a single-member gzip file (zran-style).
+//
+// While inflating the file once, we record an access point at a deflate block
+// boundary roughly every `span` uncompressed bytes. Each point stores the
+// compressed offset, the bit offset inside that byte and the 32 KiB of output
+// that precedes it (the inflate dictionary). Decompression can then restart
+// at any point without touching the bytes before it.
+//
+// Every point also remembers the date (first CSV field, YYYYMMDD) of the first
+// full line that starts at or after it, so a day or month can be located
+// without inflating the rest of a yearly file.
+//
+// The index also keeps the content hash of the gzip file (hash_file), taken
+// from the bytes the build read, so ingest through an index never has to
+// read the file just to hash it.
+
+struct GzAccessPoint {
+  uint64_t out = 0;        // offset in the uncompressed stream
+  uint64_t in = 0;         // offset of the first full compressed byte
+  int bits = 0;            // bits of the byte at in-1 still to be consumed
+  uint32_t first_day = 0;  // YYYYMMDD of first full line at/after out (0: none)
+  bool at_line_start = true;        // byte at out-1 is '\n' (or out == 0)
+  std::vector<unsigned char> window_z;  // zlib-compressed 32 KiB dictionary
+};
+
+class GzIndex {
+ public:
+  static constexpr uint32_t kWindow = 32768;
+  static constexpr uint64_t kDefaultSpan = 4ULL << 20;
+
+  // Inflate the whole file once and collect access points.
+  // Throws on I/O errors, corrupt data or multi-member gzip files.
+  static GzIndex build(const std::filesystem::path& gz_path,
+                       uint64_t span = kDefaultSpan);
+
+  // Load a previously saved index; returns false if it is missing, corrupt,
+  // in an older index format or was built from a different version of the
+  // gzip file (size/mtime).
+  static bool load(const std::filesystem::path& idx_path,
+                   const std::filesystem::path& gz_path, GzIndex& out);
+
+  void save(const std::filesystem::path& idx_path) const;
+
+  const std::vector<GzAccessPoint>& points() const { return points_; }
+  uint64_t total_out() const { return total_out_; }
+  uint64_t content_hash() const { return content_hash_; }
+
+  // Uncompressed end offset of the range that starts at point `i`
+  // when the range stops before point `j` (j == points().size() means EOF).
+  uint64_t end_of(size_t j) const {
+    return j < points_.size() ? points_[j].out : total_out_;
+  }
+
+  // Half-open point range [first, last) whose lines cover every line dated
+  // in [day_lo, day_hi]. Lines outside the range may still be included at the
+  // edges; callers filter by date.
+  std::pair<size_t, size_t> point_range_for_days(uint32_t day_lo,
+                                                 uint32_t day_hi) const {
+    auto key = [](const GzAccessPoint& p) {
+      return p.first_day ? p.first_day : std::numeric_limits<uint32_t>::max();
+    };
+    size_t k = 0;
+    while (k < points_.size() && key(points_[k]) < day_lo) ++k;
+    size_t first = k > 0 ? k - 1 : 0;
+    size_t last = k;
+    while (last < points_.size() && key(points_[last]) <= day_hi) ++last;
+    if (first >= points_.size()) first = points_.empty() ? 0 : points_.size() - 1;
+    if (last <= first) last = std::min(first + 1, points_.size());
+    return {first, last};
+  }
+
+ private:
+  static constexpr char kMagic[8] = {'N', 'B', 'G', 'Z', 'I', 'D', 'X', '2'};
+
+  static int64_t mtime_of(const std::filesystem::path& p) {
+    return static_cast<int64_t>(
+        std::filesystem::last_write_time(p).time_since_epoch().count());
+  }
+
+  std::vector<GzAccessPoint> points_;
+  uint64_t total_out_ = 0;
+  uint64_t span_ = kDefaultSpan;
+  uint64_t gz_size_ = 0;
+  int64_t gz_mtime_ = 0;
+  uint64_t content_hash_ = 0;
+};
+
+// Streams uncompressed bytes starting at an access point.
+class GzRangeReader {
+ public:
+  GzRangeReader(const std::filesystem::path& gz_path, const GzAccessPoint& pt)
+      : in_buf_(1 << 16) {
+    f_ = std::fopen(gz_path.string().c_str(), "rb");
+    if (!f_) throw std::runtime_error("open gzip failed: " + gz_path.string());
+    if (inflateInit2(&strm_, -15) != Z_OK) {
+      std::fclose(f_);
+      throw std::runtime_error("inflateInit2 failed");
+    }
+    const uint64_t pos = pt.in - (pt.bits ? 1 : 0);
+    if (std::fseek(f_, static_cast<long>(pos), SEEK_SET) != 0) {
+      close();
+      throw std::runtime_error("gzip seek failed: " + gz_path.string());
+    }
+    if (pt.bits) {
+      int c = std::getc(f_);
+      if (c == EOF) {
+        close();
+        throw std::runtime_error("gzip index points past EOF");
+      }
+      inflatePrime(&strm_, pt.bits, c >> (8 - pt.bits));
+    }
+    if (pt.out > 0) {
+      std::vector<unsigned char> w(GzIndex::kWindow);
+      uLongf wlen = GzIndex::kWindow;
+      if (uncompress(w.data(), &wlen, pt.window_z.data(),
+                     static_cast<uLong>(pt.window_z.size())) != Z_OK ||
+          wlen != GzIndex::kWindow) {
+        close();
+        throw std::runtime_error("corrupt gzip index window");
+      }
+      inflateSetDictionary(&strm_, w.data(), GzIndex::kWindow);
+    }
+  }
+
+  ~GzRangeReader() { close(); }
+  GzRangeReader(const GzRangeReader&) = delete;
+  GzRangeReader& operator=(const GzRangeReader&) = delete;
+
+  // Read up to n bytes; returns 0 at end of the deflate stream.
+  size_t read(char* dst, size_t n) {
+    strm_.next_out = reinterpret_cast<Bytef*>(dst);
+    strm_.avail_out = static_cast<uInt>(n);
+    while (strm_.avail_out > 0 && !done_) {
+      if (strm_.avail_in == 0) {
+        strm_.avail_in = static_cast<uInt>(
+            std::fread(in_buf_.data(), 1, in_buf_.size(), f_));
+        strm_.next_in = in_buf_.data();
+        if (strm_.avail_in == 0) {
+          done_ = true;
+          break;
+        }
+      }
+      int ret = inflate(&strm_, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        done_ = true;
+      } else if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+                 ret == Z_MEM_ERROR) {
+        throw std::runtime_error("inflate failed while reading gzip range");
+      }
+    }
+    return n - strm_.avail_out;
+  }
+
+ private:
+  void close() {
+    if (f_) {
+      inflateEnd(&strm_);
+      std::fclose(f_);
+      f_ = nullptr;
+    }
+  }
+
+  std::FILE* f_ = nullptr;
+  z_stream strm_{};
+  std::vector<unsigned char> in_buf_;
+  bool done_ = false;
+};
+
+// Yields every line that *starts* in the uncompressed range
+// [points[first].out, end), as views into an internal block buffer.
+// A line straddling `end` is returned whole; the line straddling the start
+// belongs to the previous range and is skipped.
+class GzRangeLines {
+ public:
+  GzRangeLines(const std::filesystem::path& gz_path, const GzAccessPoint& pt,
+               uint64_t end, size_t block = 4 << 20)
+      : reader_(gz_path, pt), buf_(block), pos_(pt.out), end_(end) {
+    skip_partial_ = !pt.at_line_start;
+  }
+
+  bool next(std::string_view& line) {
+    for (;;) {
+      const char* e = buf_.data() + tail_;
+      const char* nl = find_byte(buf_.data() + head_, e, '\n');
+      if (nl == e) nl = nullptr;
+      if (!nl && !eof_) {
+        refill();
+        continue;
+      }
+      size_t len = nl ? static_cast<size_t>(nl - (buf_.data() + head_))
+                      : tail_ - head_;
+      if (!nl && len == 0) return false;
+      const uint64_t line_start = pos_;
+      const char* p = buf_.data() + head_;
+      const size_t adv = nl ? len + 1 : len;
+      head_ += adv;
+      pos_ += adv;
+      if (skip_partial_) {
+        skip_partial_ = false;
+        continue;
+      }
+      if (line_start >= end_) return false;
+      line = std::string_view(p, len);
+      return true;
+    }
+  }
+
+ private:
+  void refill() {
+    if (head_ > 0) {
+      std::memmove(buf_.data(), buf_.data() + head_, tail_ - head_);
+      tail_ -= head_;
+      head_ = 0;
+    }
+    if (tail_ == buf_.size()) buf_.resize(buf_.size() * 2);
+    size_t n = reader_.read(buf_.data() + tail_, buf_.size() - tail_);
+    if (n == 0) eof_ = true;
+    tail_ += n;
+  }
+
+  GzRangeReader reader_;
+  std::vector<char> buf_;
+  size_t head_ = 0, tail_ = 0;
+  uint64_t pos_;
+  uint64_t end_;
+  bool skip_partial_ = false;
+  bool eof_ = false;
+};
+
+// ----------------------------------------------------------------------------
+// GzIndex implementation
+// ----------------------------------------------------------------------------
+
+inline GzIndex GzIndex::build(const std::filesystem::path& gz_path,
+                              uint64_t span) {
+  GzIndex idx;
+  idx.span_ = span;
+  idx.gz_size_ = std::filesystem::file_size(gz_path);
+  idx.gz_mtime_ = mtime_of(gz_path);
+
+  std::FILE* f = std::fopen(gz_path.string().c_str(), "rb");
+  if (!f) throw std::runtime_error("open gzip failed: " + gz_path.string());
+
+  z_stream strm{};
+  if (inflateInit2(&strm, 47) != Z_OK) {  // 47: auto-detect gzip header
+    std::fclose(f);
+    throw std::runtime_error("inflateInit2 failed");
+  }
+  auto fail = [&](const std::string& msg) {
+    inflateEnd(&strm);
+    std::fclose(f);
+    throw std::runtime_error(msg + ": " + gz_path.string());
+  };
+
+  std::vector<unsigned char> input(1 << 16);
+  std::vector<unsigned char> window(kWindow);
+  std::vector<unsigned char> ordered(kWindow);
+
+  // Date scanner for points whose first_day is still unknown.
+  enum class Scan { kIdle, kSkipLine, kReadDate };
+  Scan scan = Scan::kIdle;
+  size_t pending_from = 0;
+  uint32_t day_acc = 0;
+  int digits = 0;
+  auto resolve = [&](uint32_t day) {
+    for (size_t k = pending_from; k < idx.points_.size(); ++k)
+      idx.points_[k].first_day = day;
+    scan = Scan::kIdle;
+  };
+  auto scan_bytes = [&](const unsigned char* b, const unsigned char* e) {
+    while (b < e && scan != Scan::kIdle) {
+      if (scan == Scan::kSkipLine) {
+        const void* nl = std::memchr(b, '\n', static_cast<size_t>(e - b));
+        if (!nl) return;
+        b = static_cast<const unsigned char*>(nl) + 1;
+        scan = Scan::kReadDate;
+        day_acc = 0;
+        digits = 0;
+      } else {
+        unsigned char c = *b++;
+        if (c >= '0' && c <= '9' && digits < 8) {
+          day_acc = day_acc * 10 + (c - '0');
+          ++digits;
+        } else {
+          resolve(digits == 8 ? day_acc : 0);
+        }
+      }
+    }
+  };
+
+  ContentHasher hasher;
+  uint64_t totin = 0, totout = 0, last = 0;
+  int ret = Z_OK;
+  strm.avail_out = 0;
+  do {
+    strm.avail_in =
+        static_cast<uInt>(std::fread(input.data(), 1, input.size(), f));
+    if (std::ferror(f)) fail("read error");
+    if (strm.avail_in == 0) fail("truncated gzip");
+    hasher.update(input.data(), strm.avail_in);
+    strm.next_in = input.data();
+    do {
+      if (strm.avail_out == 0) {
+        strm.avail_out = kWindow;
+        strm.next_out = window.data();
+      }
+      const unsigned char* produced_from = strm.next_out;
+      totin += strm.avail_in;
+      totout += strm.avail_out;
+      ret = inflate(&strm, Z_BLOCK);
+      totin -= strm.avail_in;
+      totout -= strm.avail_out;
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+        fail("inflate failed while indexing");
+      scan_bytes(produced_from, strm.next_out);
+      if (ret == Z_STREAM_END) break;
+
+      // At a deflate block boundary (and not after the last block): add a point.
+      if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+          (totout == 0 || totout - last > span)) {
+        const unsigned left = strm.avail_out;
+        if (left) std::memcpy(ordered.data(), window.data() + kWindow - left, left);
+        if (left < kWindow)
+          std::memcpy(ordered.data() + left, window.data(), kWindow - left);
+
+        GzAccessPoint pt;
+        pt.out = totout;
+        pt.in = totin;
+        pt.bits = strm.data_type & 7;
+        pt.at_line_start = (totout == 0) || ordered[kWindow - 1] == '\n';
+        uLongf zlen = compressBound(kWindow);
+        pt.window_z.resize(zlen);
+        if (compress2(pt.window_z.data(), &zlen, ordered.data(), kWindow, 1) !=
+            Z_OK)
+          fail("compress window failed");
+        pt.window_z.resize(zlen);
+
+        if (scan == Scan::kIdle) pending_from = idx.points_.size();
+        idx.points_.push_back(std::move(pt));
+        // The line at offset 0 is the CSV header; skip it as well.
+        if (scan == Scan::kIdle) {
+          scan = idx.points_.back().at_line_start && totout != 0
+                     ? Scan::kReadDate
+                     : Scan::kSkipLine;
+          day_acc = 0;
+          digits = 0;
+        }
+        last = totout;
+      }
+    } while (strm.avail_in != 0);
+  } while (ret != Z_STREAM_END);
+
+  // A second gzip member would be silently ignored by raw range reads.
+  const bool trailing = strm.avail_in > 0 || std::fgetc(f) != EOF;
+  if (scan != Scan::kIdle) resolve(0);
+  idx.total_out_ = totout;
+  idx.content_hash_ = hasher.value();  // every byte was read unless trailing
+  inflateEnd(&strm);
+  std::fclose(f);
+  if (trailing)
+    throw std::runtime_error("multi-member gzip not indexable: " +
+                             gz_path.string());
+  return idx;
+}
+
+inline void GzIndex::save(const std::filesystem::path& idx_path) const {
+  std::filesystem::create_directories(idx_path.parent_path());
+  const auto tmp = idx_path.string() + ".tmp";
+  {
+    std::ofstream o(tmp, std::ios::binary);
+    if (!o) throw std::runtime_error("open gzip index for write failed: " + tmp);
+    auto put = [&](const auto& v) {
+      o.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    o.write(kMagic, sizeof(kMagic));
+    put(gz_size_);
+    put(gz_mtime_);
+    put(span_);
+    put(total_out_);
+    put(content_hash_);
+    put(static_cast<uint64_t>(points_.size()));
+    for (const auto& p : points_) {
+      put(p.out);
+      put(p.in);
+      put(static_cast<int32_t>(p.bits));
+      put(p.first_day);
+      put(static_cast<uint8_t>(p.at_line_start));
+      put(static_cast<uint32_t>(p.window_z.size()));
+      o.write(reinterpret_cast<const char*>(p.window_z.data()),
+              static_cast<std::streamsize>(p.window_z.size()));
+    }
+    if (!o) throw std::runtime_error("write gzip index failed: " + tmp);
+  }
+  std::filesystem::rename(tmp, idx_path);
+}
+
+inline bool GzIndex::load(const std::filesystem::path& idx_path,
+                          const std::filesystem::path& gz_path, GzIndex& out) {
+  std::error_code ec;
+  if (!std::filesystem::exists(idx_path, ec)) return false;
+  std::ifstream in(idx_path, std::ios::binary);
+  if (!in) return false;
+  auto get = [&](auto& v) {
+    in.read(reinterpret_cast<char*>(&v), sizeof(v));
+    return static_cast<bool>(in);
+  };
+  char magic[sizeof(kMagic)];
+  in.read(magic, sizeof(magic));
+  if (!in || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) return false;
+
+  GzIndex idx;
+  uint64_t n = 0;
+  if (!get(idx.gz_size_) || !get(idx.gz_mtime_) || !get(idx.span_) ||
+      !get(idx.total_out_) || !get(idx.content_hash_) || !get(n))
+    return false;
+  if (idx.gz_size_ != std::filesystem::file_size(gz_path, ec) || ec ||
+      idx.gz_mtime_ != mtime_of(gz_path))
+    return false;
+
+  idx.points_.resize(n);
+  for (auto& p : idx.points_) {
+    int32_t bits = 0;
+    uint8_t at_ls = 0;
+    uint32_t zlen = 0;
+    if (!get(p.out) || !get(p.in) || !get(bits) || !get(p.first_day) ||
+        !get(at_ls) || !get(zlen))
+      return false;
+    if (bits < 0 || bits > 7 || zlen > compressBound(kWindow)) return false;
+    p.bits = bits;
+    p.at_line_start = at_ls != 0;
+    p.window_z.resize(zlen);
+    in.read(reinterpret_cast<char*>(p.window_z.data()), zlen);
+    if (!in) return false;
+  }
+  out = std::move(idx);
+  return true;
+}
+
+}  // namespace nbbo
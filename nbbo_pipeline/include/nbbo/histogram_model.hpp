@@ -3,6 +3,7 @@
 #include <cstdint>
 
 #include "nbbo/histogram_bins.hpp"
+#include "nbbo/price.hpp"
 
 struct CellStats {
   std::uint64_t n = 0;       // total count N_k
@@ -14,7 +15,7 @@ struct CellStats {
 // State vector x_t = (I_t, s_t, age_diff_t, L_t)
 struct TickState {
   double imbalance;    // I_t
-  double spread;       // s_t
+  nbbo::Px spread;     // s_t in Px (1/10000 $)
   double age_diff_ms;  // age_diff_ms = Age(bid) - Age(ask)
   double last_move;    // L_t in {-1,0,+1}
 };
@@ -35,10 +36,10 @@ struct HistogramModel {
 
   // binning (primitive interface)
   int imb_bin(double I) const;
-  int spr_bin(double spread) const;
+  int spr_bin(nbbo::Px spread) const;
   int age_bin(double age_diff_ms) const;
   int last_bin(double L) const;
-  int cell_index(double I, double s, double age_diff_ms, double L) const;
+  int cell_index(double I, nbbo::Px s, double age_diff_ms, double L) const;
 
   // binning (state-based interface)
   int cell_index(const TickState& x) const;
@@ -0,0 +1,1152 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "nbbo/price.hpp"
+#include "nbbo/task_pool.hpp"
+#include "nbbo/time_utils.hpp"
+
+namespace nbbo {
+
+// .msbin v2: the Stage A cache format.
+//
+//   [MsBinHeader, 64 bytes]
+//   [rows]                            row_count rows in timestamp order
+//   [MsBinDay x day_count]            at header.day_table_offset
+//
+// The rows section has one of three layouts (MsBinLayout):
+//   kRows     packed MsBinRow structs (the default)
+//   kColumns  one contiguous column per field in MsBinRow order
+//             (ts[N], bid[N], ask[N], bidSize[N], askSize[N], logret[N])
+//   kPacked   compressed blocks, then MsBinBlock[block_count] and a uint64
+//             block_count just before the day table. Blocks never straddle a
+//             day and decode independently (see msbin_codec below).
+// kRows and kColumns take exactly 28 bytes per row; in every layout a day's
+// rows are [first_row, first_row + row_count).
+//
+// Clock grids with forward fill are stored virtually (kMsBinVirtualFill):
+// only rows that carry a new quote are written, and each day records the
+// fill cap, so the filled 1 ms rows between two of them follow from their
+// timestamps. MsBinFillCursor yields stored rows with their fill counts,
+// MsBinDenseCursor the expanded grid.
+//
+// The header is written last (magic included), so a file left behind by a
+// crashed writer never validates. Readers can size buffers from row_count,
+// seek straight to a day through the day table and reject caches built with
+// different Stage A settings by comparing the fingerprint.
+
+// Prices are Px ticks; mid and spread are derived (px_mid, ask - bid).
+#pragma pack(push, 1)
+struct MsBinRow {
+  uint64_t ts;
+  Px bid, ask;
+  int32_t bidSize, askSize;
+  float logret;
+};
+
+struct MsBinHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t row_size;
+  uint32_t flags;
+  uint32_t day_count;
+  uint64_t row_count;
+  uint64_t fingerprint;  // hash of the Stage A settings that built the file
+  uint64_t min_ts;
+  uint64_t max_ts;
+  uint64_t day_table_offset;
+};
+
+struct MsBinDay {
+  uint32_t day;          // YYYYMMDD
+  uint32_t fill_cap_ms;  // kMsBinVirtualFill: max implied fill run, else 0
+  uint64_t first_row;
+  uint64_t row_count;
+};
+
+struct MsBinBlock {
+  uint64_t offset;  // file offset of the encoded block
+  uint64_t first_row;
+  uint32_t rows;
+  uint32_t bytes;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(MsBinRow) == 28, "msbin row layout");
+static_assert(sizeof(MsBinHeader) == 64, "msbin header layout");
+static_assert(sizeof(MsBinDay) == 24, "msbin day entry layout");
+static_assert(sizeof(MsBinBlock) == 24, "msbin block entry layout");
+
+inline constexpr char kMsBinMagic[8] = {'N', 'B', 'M', 'S', 'B', 'I', 'N', '2'};
+inline constexpr uint32_t kMsBinVersion = 2;
+
+// MsBinHeader::flags
+inline constexpr uint32_t kMsBinClockGrid = 1u << 0;
+inline constexpr uint32_t kMsBinFfill = 1u << 1;
+inline constexpr uint32_t kMsBinColumnar = 1u << 2;  // layout only, not data
+inline constexpr uint32_t kMsBinPacked = 1u << 3;    // layout only, not data
+inline constexpr uint32_t kMsBinLayoutMask = kMsBinColumnar | kMsBinPacked;
+// Virtual clock grid: only rows with quotes are stored; the forward-filled
+// 1 ms rows between two stored rows of a day are implied (see
+// msbin_fill_after) and expanded by MsBinDenseCursor when needed.
+inline constexpr uint32_t kMsBinVirtualFill = 1u << 4;
+
+enum class MsBinLayout { kRows, kColumns, kPacked };
+
+inline uint32_t msbin_layout_flags(MsBinLayout l) {
+  return l == MsBinLayout::kColumns ? kMsBinColumnar
+         : l == MsBinLayout::kPacked ? kMsBinPacked
+                                     : 0u;
+}
+
+inline MsBinLayout msbin_layout_of(uint32_t flags) {
+  return (flags & kMsBinPacked)     ? MsBinLayout::kPacked
+         : (flags & kMsBinColumnar) ? MsBinLayout::kColumns
+                                    : MsBinLayout::kRows;
+}
+
+// CLI / log names: aos, soa, packed.
+inline const char* msbin_layout_name(MsBinLayout l) {
+  return l == MsBinLayout::kColumns ? "soa"
+         : l == MsBinLayout::kPacked ? "packed"
+                                     : "aos";
+}
+
+// FNV-1a, for settings fingerprints.
+inline uint64_t fnv1a64(std::string_view s,
+                        uint64_t h = 14695981039346656037ULL) {
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Number of forward-filled 1 ms rows implied between stored rows at `ts` and
+// `next_ts` of a virtual clock file: the gap, if it stays within the day and
+// `cap`, else none. Matches what Stage A used to materialize row by row.
+inline uint32_t msbin_fill_after(DayMs t, DayMs next, uint32_t cap) {
+  if (t.day() != next.day()) return 0;
+  const int gap = next.ms() - t.ms() - 1;
+  return gap > 0 && static_cast<uint32_t>(gap) <= cap ? static_cast<uint32_t>(gap) : 0u;
+}
+inline uint32_t msbin_fill_after(uint64_t ts, uint64_t next_ts, uint32_t cap) {
+  return msbin_fill_after(to_day_ms(ts), to_day_ms(next_ts), cap);
+}
+
+// A run of n rows as column pointers. Zero-copy views into the mapping for
+// columnar files; for row and packed files the cursor below fills its buffers.
+struct MsBinColumns {
+  size_t n = 0;
+  const uint64_t* ts = nullptr;
+  const Px* bid = nullptr;
+  const Px* ask = nullptr;
+  const int32_t* bidSize = nullptr;
+  const int32_t* askSize = nullptr;
+  const float* logret = nullptr;
+};
+
+// Packed block codec. A block holds up to kPackedBlockRows rows of a single
+// day:
+//
+//   day u32, msod0 u32, bid0, ask0, bidSize0, askSize0 (i32), unit u8
+//   then one record per row or run of rows
+//
+// Each record starts with a tag byte. kRun | (len-1) stands for `len` rows
+// that repeat the previous quote one millisecond later with logret 0 (the
+// ffill pattern). Otherwise the tag says which fields follow: ts as a varint
+// millisecond delta (implicit 1), prices as zigzag varint deltas in `unit`
+// Px (100 when every price in the block is a whole cent), sizes as zigzag
+// varint deltas, and the log return as raw f32, NaN, +0, or "derived" when
+// it is exactly log(mid2 / prev mid2) as the Stage A emitter computes it.
+// The first row of a block is never derived, so blocks stand alone.
+namespace msbin_codec {
+
+inline constexpr size_t kPackedBlockRows = 1 << 16;
+inline constexpr size_t kBlockHeaderBytes = 25;
+
+inline constexpr uint8_t kRun = 0x80;
+inline constexpr uint8_t kLrRaw = 0, kLrDerived = 1, kLrNaN = 2, kLrZero = 3;
+inline constexpr uint8_t kBid = 1 << 2, kAsk = 1 << 3, kBidSz = 1 << 4,
+                         kAskSz = 1 << 5, kTsDelta = 1 << 6;
+
+inline void put_varint(std::vector<uint8_t>& o, uint64_t v) {
+  while (v >= 0x80) {
+    o.push_back(static_cast<uint8_t>(v) | 0x80);
+    v >>= 7;
+  }
+  o.push_back(static_cast<uint8_t>(v));
+}
+
+inline uint64_t get_varint(const uint8_t*& p, const uint8_t* e) {
+  uint64_t v = 0;
+  for (int s = 0; s < 64; s += 7) {
+    if (p >= e) break;
+    const uint8_t b = *p++;
+    v |= static_cast<uint64_t>(b & 0x7f) << s;
+    if (!(b & 0x80)) return v;
+  }
+  throw std::runtime_error("msbin packed block: bad varint");
+}
+
+inline uint64_t zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+inline int64_t unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+inline uint32_t f32_bits(float f) {
+  uint32_t b;
+  std::memcpy(&b, &f, 4);
+  return b;
+}
+
+// The Stage A log return of a row whose mid moved from prev to cur.
+inline bool derive_logret(const MsBinRow& prev, const MsBinRow& cur, float& out) {
+  const int64_t p2 = int64_t{prev.bid} + prev.ask, m2 = int64_t{cur.bid} + cur.ask;
+  if (p2 <= 0 || m2 <= 0) return false;
+  out = static_cast<float>(std::log(static_cast<double>(m2) / static_cast<double>(p2)));
+  return true;
+}
+
+inline bool is_fill(const MsBinRow& prev, int64_t prev_msod, const MsBinRow& cur,
+                    int64_t cur_msod) {
+  return cur_msod == prev_msod + 1 && cur.bid == prev.bid && cur.ask == prev.ask &&
+         cur.bidSize == prev.bidSize && cur.askSize == prev.askSize &&
+         f32_bits(cur.logret) == 0;
+}
+
+// Rows must share one day and be in timestamp order. Appends to `out`.
+inline void encode_block(const MsBinRow* r, size_t n, std::vector<uint8_t>& out) {
+  if (n == 0) return;
+  const uint32_t day = ymd(r[0].ts);
+  Px unit = kPxPerCent;
+  for (size_t i = 0; i < n && unit != 1; ++i) {
+    if (r[i].bid % kPxPerCent || r[i].ask % kPxPerCent) unit = 1;
+  }
+  std::vector<int64_t> msod(n);
+  for (size_t i = 0; i < n; ++i) {
+    const DayMs t = to_day_ms(r[i].ts);
+    if (t.day() != day) throw std::runtime_error("msbin packed block spans days");
+    msod[i] = t.ms();
+  }
+
+  uint8_t hdr[kBlockHeaderBytes];
+  const uint32_t m0 = static_cast<uint32_t>(msod[0]);
+  std::memcpy(hdr, &day, 4);
+  std::memcpy(hdr + 4, &m0, 4);
+  std::memcpy(hdr + 8, &r[0].bid, 4);
+  std::memcpy(hdr + 12, &r[0].ask, 4);
+  std::memcpy(hdr + 16, &r[0].bidSize, 4);
+  std::memcpy(hdr + 20, &r[0].askSize, 4);
+  hdr[24] = static_cast<uint8_t>(unit == 1 ? 1 : 100);
+  out.insert(out.end(), hdr, hdr + kBlockHeaderBytes);
+
+  MsBinRow prev = r[0];
+  int64_t prev_msod = msod[0] - 1;
+  static const uint32_t kNaNBits = f32_bits(std::numeric_limits<float>::quiet_NaN());
+  for (size_t i = 0; i < n;) {
+    if (i > 0 && is_fill(prev, prev_msod, r[i], msod[i])) {
+      size_t len = 1;
+      while (len < 128 && i + len < n &&
+             is_fill(r[i + len - 1], msod[i + len - 1], r[i + len], msod[i + len])) {
+        ++len;
+      }
+      out.push_back(static_cast<uint8_t>(kRun | (len - 1)));
+      i += len;
+      prev = r[i - 1];
+      prev_msod = msod[i - 1];
+      continue;
+    }
+    const MsBinRow& c = r[i];
+    uint8_t tag = 0;
+    const uint32_t lb = f32_bits(c.logret);
+    float d;
+    if (lb == 0) tag |= kLrZero;
+    else if (lb == kNaNBits) tag |= kLrNaN;
+    else if (i > 0 && derive_logret(prev, c, d) && f32_bits(d) == lb) tag |= kLrDerived;
+    else tag |= kLrRaw;
+    if (msod[i] - prev_msod != 1) tag |= kTsDelta;
+    if (c.bid != prev.bid) tag |= kBid;
+    if (c.ask != prev.ask) tag |= kAsk;
+    if (c.bidSize != prev.bidSize) tag |= kBidSz;
+    if (c.askSize != prev.askSize) tag |= kAskSz;
+    out.push_back(tag);
+    if (tag & kTsDelta) put_varint(out, zigzag(msod[i] - prev_msod));
+    if (tag & kBid) put_varint(out, zigzag((int64_t{c.bid} - prev.bid) / unit));
+    if (tag & kAsk) put_varint(out, zigzag((int64_t{c.ask} - prev.ask) / unit));
+    if (tag & kBidSz) put_varint(out, zigzag(int64_t{c.bidSize} - prev.bidSize));
+    if (tag & kAskSz) put_varint(out, zigzag(int64_t{c.askSize} - prev.askSize));
+    if ((tag & 3) == kLrRaw) out.insert(out.end(), reinterpret_cast<const uint8_t*>(&lb),
+                                        reinterpret_cast<const uint8_t*>(&lb) + 4);
+    prev = c;
+    prev_msod = msod[i];
+    ++i;
+  }
+}
+
+// Decodes exactly n rows from [p, p + bytes); throws on malformed input.
+inline void decode_block(const uint8_t* p, size_t bytes, size_t n, MsBinRow* out) {
+  if (n == 0) return;
+  const uint8_t* const e = p + bytes;
+  if (bytes < kBlockHeaderBytes) throw std::runtime_error("msbin packed block: short header");
+  uint32_t day, m0;
+  MsBinRow prev;
+  std::memcpy(&day, p, 4);
+  std::memcpy(&m0, p + 4, 4);
+  std::memcpy(&prev.bid, p + 8, 4);
+  std::memcpy(&prev.ask, p + 12, 4);
+  std::memcpy(&prev.bidSize, p + 16, 4);
+  std::memcpy(&prev.askSize, p + 20, 4);
+  const int64_t unit = p[24];
+  p += kBlockHeaderBytes;
+  prev.logret = 0.0f;
+  int64_t msod = int64_t{m0} - 1;
+  TsClock clock(day);
+
+  for (size_t i = 0; i < n;) {
+    if (p >= e) throw std::runtime_error("msbin packed block: truncated");
+    const uint8_t tag = *p++;
+    if (tag & kRun) {
+      const size_t len = (tag & 0x7f) + 1u;
+      if (i == 0 || i + len > n) throw std::runtime_error("msbin packed block: bad run");
+      prev.logret = 0.0f;
+      for (size_t k = 0; k < len; ++k) {
+        prev.ts = clock.at(++msod);
+        out[i++] = prev;
+      }
+      continue;
+    }
+    MsBinRow c = prev;
+    msod += (tag & kTsDelta) ? unzigzag(get_varint(p, e)) : 1;
+    c.ts = clock.at(msod);
+    if (tag & kBid) c.bid = static_cast<Px>(prev.bid + unzigzag(get_varint(p, e)) * unit);
+    if (tag & kAsk) c.ask = static_cast<Px>(prev.ask + unzigzag(get_varint(p, e)) * unit);
+    if (tag & kBidSz) c.bidSize = static_cast<int32_t>(prev.bidSize + unzigzag(get_varint(p, e)));
+    if (tag & kAskSz) c.askSize = static_cast<int32_t>(prev.askSize + unzigzag(get_varint(p, e)));
+    switch (tag & 3) {
+      case kLrZero: c.logret = 0.0f; break;
+      case kLrNaN: c.logret = std::numeric_limits<float>::quiet_NaN(); break;
+      case kLrDerived:
+        if (i == 0 || !derive_logret(prev, c, c.logret)) {
+          throw std::runtime_error("msbin packed block: bad derived logret");
+        }
+        break;
+      default:
+        if (e - p < 4) throw std::runtime_error("msbin packed block: truncated");
+        std::memcpy(&c.logret, p, 4);
+        p += 4;
+    }
+    out[i++] = c;
+    prev = c;
+  }
+}
+
+}  // namespace msbin_codec
+
+// Read-only mmap of one msbin, any layout.
+class MsBinReader {
+ public:
+  // Header-only validation: magic, version, row size and file size. Older
+  // header-less caches fail here and get rebuilt.
+  static bool probe(const std::filesystem::path& path, MsBinHeader* out = nullptr) {
+    std::error_code ec;
+    const auto sz = std::filesystem::file_size(path, ec);
+    if (ec || sz < sizeof(MsBinHeader)) return false;
+    MsBinHeader h;
+    std::FILE* f = std::fopen(path.string().c_str(), "rb");
+    if (!f) return false;
+    const bool got = std::fread(&h, sizeof(h), 1, f) == 1;
+    std::fclose(f);
+    if (!got || std::memcmp(h.magic, kMsBinMagic, sizeof(h.magic)) != 0 ||
+        h.version != kMsBinVersion || h.row_size != sizeof(MsBinRow) ||
+        sz != h.day_table_offset + uint64_t{h.day_count} * sizeof(MsBinDay)) {
+      return false;
+    }
+    const bool packed = msbin_layout_of(h.flags) == MsBinLayout::kPacked;
+    if (packed ? h.day_table_offset < sizeof(MsBinHeader) + sizeof(uint64_t)
+               : h.day_table_offset != sizeof(MsBinHeader) + h.row_count * sizeof(MsBinRow)) {
+      return false;
+    }
+    if (out) *out = h;
+    return true;
+  }
+
+  explicit MsBinReader(const std::filesystem::path& path) : path_(path) {
+    if (!probe(path, &h_)) {
+      throw std::runtime_error("not a v2 msbin: " + path.string());
+    }
+    size_ = h_.day_table_offset + uint64_t{h_.day_count} * sizeof(MsBinDay);
+    fd_ = ::open(path.string().c_str(), O_RDONLY);
+    if (fd_ < 0) throw std::runtime_error("cannot open msbin: " + path.string());
+    void* m = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (m == MAP_FAILED) {
+      ::close(fd_);
+      throw std::runtime_error("mmap msbin failed: " + path.string());
+    }
+    base_ = static_cast<const unsigned char*>(m);
+    days_.resize(h_.day_count);
+    std::memcpy(days_.data(), base_ + h_.day_table_offset,
+                days_.size() * sizeof(MsBinDay));
+    if (layout() == MsBinLayout::kPacked) load_block_index();
+  }
+
+  ~MsBinReader() {
+    if (base_) ::munmap(const_cast<unsigned char*>(base_), size_);
+    if (fd_ >= 0) ::close(fd_);
+  }
+  MsBinReader(const MsBinReader&) = delete;
+  MsBinReader& operator=(const MsBinReader&) = delete;
+
+  const MsBinHeader& header() const { return h_; }
+  uint64_t rows() const { return h_.row_count; }
+  MsBinLayout layout() const { return msbin_layout_of(h_.flags); }
+  bool columnar() const { return layout() == MsBinLayout::kColumns; }
+  bool packed() const { return layout() == MsBinLayout::kPacked; }
+  bool virtual_fill() const { return (h_.flags & kMsBinVirtualFill) != 0; }
+  uint32_t fill_cap_ms() const { return days_.empty() ? 0 : days_.front().fill_cap_ms; }
+  const std::vector<MsBinBlock>& blocks() const { return blocks_; }
+  const std::vector<MsBinDay>& days() const { return days_; }
+
+  // Row range [first, last) covering YYYYMMDD days in [lo, hi].
+  std::pair<uint64_t, uint64_t> day_range(uint32_t lo, uint32_t hi) const {
+    auto a = std::lower_bound(days_.begin(), days_.end(), lo,
+                              [](const MsBinDay& d, uint32_t v) { return d.day < v; });
+    auto b = std::upper_bound(days_.begin(), days_.end(), hi,
+                              [](uint32_t v, const MsBinDay& d) { return v < d.day; });
+    if (a >= b) return {0, 0};
+    return {a->first_row, (b - 1)->first_row + (b - 1)->row_count};
+  }
+
+  // Copy up to n rows starting at row `first`; returns the number copied.
+  // Packed files decode through a one-block cache, so use one reader per
+  // thread (or decode_block, which is stateless).
+  size_t read(uint64_t first, size_t n, MsBinRow* out) const {
+    if (first >= h_.row_count) return 0;
+    n = static_cast<size_t>(std::min<uint64_t>(n, h_.row_count - first));
+    if (packed()) {
+      for (size_t done = 0; done < n;) {
+        const uint64_t row = first + done;
+        auto it = std::upper_bound(blocks_.begin(), blocks_.end(), row,
+                                   [](uint64_t v, const MsBinBlock& b) { return v < b.first_row; });
+        const size_t b = static_cast<size_t>(it - blocks_.begin()) - 1;
+        if (b != cached_block_) {
+          cache_.resize(blocks_[b].rows);
+          decode_block(b, cache_.data());
+          cached_block_ = b;
+        }
+        const size_t off = static_cast<size_t>(row - blocks_[b].first_row);
+        const size_t m = std::min<size_t>(n - done, blocks_[b].rows - off);
+        std::memcpy(out + done, cache_.data() + off, m * sizeof(MsBinRow));
+        done += m;
+      }
+      return n;
+    }
+    if (!columnar()) {
+      std::memcpy(out, base_ + sizeof(MsBinHeader) + first * sizeof(MsBinRow),
+                  n * sizeof(MsBinRow));
+      return n;
+    }
+    const MsBinColumns c = columns(first, n);
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = MsBinRow{c.ts[i], c.bid[i], c.ask[i], c.bidSize[i],
+                        c.askSize[i], c.logret[i]};
+    }
+    return n;
+  }
+
+  // Decode block b (blocks()[b].rows rows) into out. Packed files only.
+  void decode_block(size_t b, MsBinRow* out) const {
+    const MsBinBlock& k = blocks_.at(b);
+    msbin_codec::decode_block(base_ + k.offset, k.bytes, k.rows, out);
+  }
+
+  // Packed rows in the mapping. Row-layout files only.
+  const MsBinRow* row_data() const {
+    if (layout() != MsBinLayout::kRows) {
+      throw std::runtime_error("msbin is not in the row layout: " + path_.string());
+    }
+    return reinterpret_cast<const MsBinRow*>(base_ + sizeof(MsBinHeader));
+  }
+
+  // Rows [first, first + n): in place for row files, else copied into buf
+  // (which must hold n rows).
+  const MsBinRow* row_data_or(uint64_t first, size_t n, std::vector<MsBinRow>& buf) const {
+    if (layout() == MsBinLayout::kRows) return row_data() + first;
+    read(first, n, buf.data());
+    return buf.data();
+  }
+
+  // Zero-copy column views of rows [first, first + n). Columnar files only.
+  MsBinColumns columns(uint64_t first, size_t n) const {
+    if (!columnar()) {
+      throw std::runtime_error("msbin is not columnar: " + path_.string());
+    }
+    const uint64_t N = h_.row_count;
+    n = static_cast<size_t>(std::min<uint64_t>(n, first < N ? N - first : 0));
+    const unsigned char* p = base_ + sizeof(MsBinHeader);
+    MsBinColumns c;
+    c.n = n;
+    c.ts = reinterpret_cast<const uint64_t*>(p) + first;
+    p += N * sizeof(uint64_t);
+    c.bid = reinterpret_cast<const Px*>(p) + first;
+    p += N * sizeof(Px);
+    c.ask = reinterpret_cast<const Px*>(p) + first;
+    p += N * sizeof(Px);
+    c.bidSize = reinterpret_cast<const int32_t*>(p) + first;
+    p += N * sizeof(int32_t);
+    c.askSize = reinterpret_cast<const int32_t*>(p) + first;
+    p += N * sizeof(int32_t);
+    c.logret = reinterpret_cast<const float*>(p) + first;
+    return c;
+  }
+
+ private:
+  void load_block_index() {
+    uint64_t count;
+    std::memcpy(&count, base_ + h_.day_table_offset - sizeof(count), sizeof(count));
+    const uint64_t index_bytes = count * sizeof(MsBinBlock);
+    if (index_bytes > h_.day_table_offset - sizeof(MsBinHeader) - sizeof(count)) {
+      throw std::runtime_error("msbin block index out of range: " + path_.string());
+    }
+    blocks_.resize(count);
+    std::memcpy(blocks_.data(), base_ + h_.day_table_offset - sizeof(count) - index_bytes,
+                index_bytes);
+    uint64_t rows = 0;
+    for (const auto& b : blocks_) {
+      if (b.first_row != rows || b.offset + b.bytes > h_.day_table_offset) {
+        throw std::runtime_error("msbin block index corrupt: " + path_.string());
+      }
+      rows += b.rows;
+    }
+    if (rows != h_.row_count) {
+      throw std::runtime_error("msbin block index corrupt: " + path_.string());
+    }
+  }
+
+  std::filesystem::path path_;
+  int fd_ = -1;
+  const unsigned char* base_ = nullptr;
+  uint64_t size_ = 0;
+  MsBinHeader h_{};
+  std::vector<MsBinDay> days_;
+  std::vector<MsBinBlock> blocks_;
+  mutable std::vector<MsBinRow> cache_;
+  mutable size_t cached_block_ = SIZE_MAX;
+};
+
+// Sequential block reads over rows [first, last) of one file.
+class MsBinCursor {
+ public:
+  MsBinCursor(const MsBinReader& r, uint64_t first, uint64_t last,
+              size_t block_rows = 1 << 16)
+      : r_(r), next_(first), last_(std::min(last, r.rows())), buf_(block_rows) {}
+  explicit MsBinCursor(const MsBinReader& r) : MsBinCursor(r, 0, r.rows()) {}
+
+  // Next block; 0 at the end.
+  size_t next(const MsBinRow*& rows) {
+    if (next_ >= last_) return 0;
+    const size_t n = r_.read(
+        next_, static_cast<size_t>(std::min<uint64_t>(buf_.size(), last_ - next_)),
+        buf_.data());
+    next_ += n;
+    rows = buf_.data();
+    return n;
+  }
+
+ private:
+  const MsBinReader& r_;
+  uint64_t next_, last_;
+  std::vector<MsBinRow> buf_;
+};
+
+// Sequential column blocks over rows [first, last), whatever the layout.
+// On packed files each step is one whole block when the range allows it (day
+// ranges always do). Given a pool, the following block decodes as a task on
+// it while the caller works on this one; without one, blocks decode inline.
+class MsBinColumnCursor {
+ public:
+  MsBinColumnCursor(const MsBinReader& r, uint64_t first, uint64_t last,
+                    size_t block_rows = 1 << 16, TaskPool* pool = nullptr)
+      : r_(r), next_(first), last_(std::min(last, r.rows())), block_(block_rows) {
+    if (pool && r.packed()) ahead_ = std::make_unique<TaskGroup>(*pool);
+    if (!r.columnar()) {
+      const size_t cap = r.packed() ? std::max(block_, msbin_codec::kPackedBlockRows) : block_;
+      rows_.resize(cap);
+      ts_.resize(cap);
+      bid_.resize(cap);
+      ask_.resize(cap);
+      bsz_.resize(cap);
+      asz_.resize(cap);
+      lr_.resize(cap);
+    }
+  }
+
+  // A look-ahead still running is waited for by ahead_'s destructor.
+  MsBinColumnCursor(const MsBinColumnCursor&) = delete;
+  MsBinColumnCursor& operator=(const MsBinColumnCursor&) = delete;
+
+  bool exhausted() const { return next_ >= last_; }
+
+  // Next block; 0 at the end.
+  size_t next(MsBinColumns& c) {
+    if (next_ >= last_) return 0;
+    size_t n = static_cast<size_t>(std::min<uint64_t>(block_, last_ - next_));
+    if (r_.columnar()) {
+      c = r_.columns(next_, n);
+      next_ += n;
+      return n;
+    }
+    if (!(r_.packed() && next_packed_block(n))) r_.read(next_, n, rows_.data());
+    for (size_t i = 0; i < n; ++i) {
+      const MsBinRow& w = rows_[i];
+      ts_[i] = w.ts;
+      bid_[i] = w.bid;
+      ask_[i] = w.ask;
+      bsz_[i] = w.bidSize;
+      asz_[i] = w.askSize;
+      lr_[i] = w.logret;
+    }
+    c = MsBinColumns{n, ts_.data(), bid_.data(), ask_.data(),
+                     bsz_.data(), asz_.data(), lr_.data()};
+    next_ += n;
+    return n;
+  }
+
+ private:
+  // Decode the block starting at next_ into rows_ if it lies inside the
+  // range; sets n to its row count.
+  bool next_packed_block(size_t& n) {
+    const auto& blocks = r_.blocks();
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), next_,
+                               [](const MsBinBlock& b, uint64_t v) { return b.first_row < v; });
+    if (it == blocks.end() || it->first_row != next_ || next_ + it->rows > last_) {
+      return false;
+    }
+    const size_t b = static_cast<size_t>(it - blocks.begin());
+    if (ahead_block_ == b) {
+      ahead_->wait();
+      rows_.swap(spare_);
+    } else {
+      if (ahead_block_ != SIZE_MAX) {
+        try {
+          ahead_->wait();  // a block we skipped: its outcome does not matter
+        } catch (...) {
+        }
+      }
+      r_.decode_block(b, rows_.data());
+    }
+    n = it->rows;
+    ahead_block_ = SIZE_MAX;
+    if (ahead_ && b + 1 < blocks.size() &&
+        blocks[b + 1].first_row + blocks[b + 1].rows <= last_) {
+      spare_.resize(rows_.size());
+      ahead_block_ = b + 1;
+      ahead_->run([this, b] { r_.decode_block(b + 1, spare_.data()); });
+    }
+    return true;
+  }
+
+  const MsBinReader& r_;
+  uint64_t next_, last_;
+  size_t block_;
+  std::vector<MsBinRow> rows_, spare_;
+  size_t ahead_block_ = SIZE_MAX;  // block being decoded into spare_
+  std::vector<uint64_t> ts_;
+  std::vector<Px> bid_, ask_;
+  std::vector<int32_t> bsz_, asz_;
+  std::vector<float> lr_;
+  std::unique_ptr<TaskGroup> ahead_;  // last: goes before spare_ does
+};
+
+// Stored rows of [first, last) together with the 1 ms rows each one implies
+// on a virtual clock grid: fill[i] rows repeat row i's quote at ts + 1 ms,
+// ts + 2 ms, ... with logret 0. Non-virtual files report no fills. The last
+// row of every block is held back until the next row's ts is known; the last
+// row of the range looks at the row just past it unless that starts a day.
+class MsBinFillCursor {
+ public:
+  MsBinFillCursor(const MsBinReader& r, uint64_t first, uint64_t last,
+                  size_t block_rows = 1 << 16, TaskPool* pool = nullptr)
+      : r_(r), cur_(r, first, last, block_rows, pool),
+        last_(std::min(last, r.rows())),
+        cap_(r.virtual_fill() ? r.fill_cap_ms() : 0) {
+    const size_t cap = std::max(block_rows, msbin_codec::kPackedBlockRows) + 1;
+    ts_.resize(cap);
+    bid_.resize(cap);
+    ask_.resize(cap);
+    bsz_.resize(cap);
+    asz_.resize(cap);
+    lr_.resize(cap);
+    fill_.resize(cap);
+  }
+
+  // Next block; 0 at the end.
+  size_t next(MsBinColumns& c, const uint32_t*& fill) {
+    size_t m = held_ ? 1 : 0;
+    if (held_) {
+      ts_[0] = held_row_.ts;
+      bid_[0] = held_row_.bid;
+      ask_[0] = held_row_.ask;
+      bsz_[0] = held_row_.bidSize;
+      asz_[0] = held_row_.askSize;
+      lr_[0] = held_row_.logret;
+    }
+    MsBinColumns in;
+    while (size_t n = cur_.next(in)) {
+      std::memcpy(ts_.data() + m, in.ts, n * sizeof(uint64_t));
+      std::memcpy(bid_.data() + m, in.bid, n * sizeof(Px));
+      std::memcpy(ask_.data() + m, in.ask, n * sizeof(Px));
+      std::memcpy(bsz_.data() + m, in.bidSize, n * sizeof(int32_t));
+      std::memcpy(asz_.data() + m, in.askSize, n * sizeof(int32_t));
+      std::memcpy(lr_.data() + m, in.logret, n * sizeof(float));
+      m += n;
+      if (m >= 2) break;  // a lone first row waits for its successor
+    }
+    if (m == 0) return 0;
+    held_ = false;
+    size_t out = m;
+    if (cur_.exhausted()) {
+      fill_[m - 1] = 0;
+      if (cap_ && last_ < r_.rows() && !starts_day(last_)) {
+        MsBinRow after;
+        r_.read(last_, 1, &after);
+        fill_[m - 1] = msbin_fill_after(ts_[m - 1], after.ts, cap_);
+      }
+    } else {
+      --out;
+      held_ = true;
+      held_row_ = MsBinRow{ts_[out], bid_[out], ask_[out], bsz_[out], asz_[out], lr_[out]};
+    }
+    if (cap_) {
+      DayMs t = to_day_ms(ts_[0]);  // each ts decoded once
+      for (size_t i = 0; i + 1 < m; ++i) {
+        const DayMs next = to_day_ms(ts_[i + 1]);
+        fill_[i] = msbin_fill_after(t, next, cap_);
+        t = next;
+      }
+    } else {
+      std::fill_n(fill_.data(), m - 1, 0u);
+    }
+    c = MsBinColumns{out, ts_.data(), bid_.data(), ask_.data(),
+                     bsz_.data(), asz_.data(), lr_.data()};
+    fill = fill_.data();
+    return out;
+  }
+
+ private:
+  bool starts_day(uint64_t row) const {
+    const auto& days = r_.days();
+    auto it = std::lower_bound(days.begin(), days.end(), row,
+                               [](const MsBinDay& d, uint64_t v) { return d.first_row < v; });
+    return it != days.end() && it->first_row == row;
+  }
+
+  const MsBinReader& r_;
+  MsBinColumnCursor cur_;
+  uint64_t last_;
+  uint32_t cap_;
+  bool held_ = false;
+  MsBinRow held_row_{};
+  std::vector<uint64_t> ts_;
+  std::vector<Px> bid_, ask_;
+  std::vector<int32_t> bsz_, asz_;
+  std::vector<float> lr_;
+  std::vector<uint32_t> fill_;
+};
+
+// Expands stored rows and their fill counts (as from MsBinFillCursor) into
+// the dense 1 ms grid, in blocks of up to block_rows rows. Runs of stored
+// rows are copied column-wise and fill runs are written as constant columns,
+// so only the ts of fill rows is computed row by row.
+class MsBinDenseExpander {
+ public:
+  explicit MsBinDenseExpander(size_t block_rows = 1 << 16)
+      : block_(block_rows), ts_(block_rows), bid_(block_rows), ask_(block_rows),
+        bsz_(block_rows), asz_(block_rows), lr_(block_rows) {}
+
+  // Start on the next input; `in` and `fill` must stay valid until next()
+  // returns 0.
+  void reset(const MsBinColumns& in, const uint32_t* fill) {
+    in_ = in;
+    fill_ = fill;
+    i_ = 0;
+  }
+
+  // Next dense block of the current input; 0 once it is used up.
+  size_t next(MsBinColumns& c) {
+    size_t m = 0;
+    while (m < block_) {
+      if (fill_left_ > 0) {
+        const size_t k = std::min<size_t>(fill_left_, block_ - m);
+        for (size_t j = 0; j < k; ++j) ts_[m + j] = fill_clock_.at(++fill_ms_);
+        std::fill_n(bid_.data() + m, k, fill_row_.bid);
+        std::fill_n(ask_.data() + m, k, fill_row_.ask);
+        std::fill_n(bsz_.data() + m, k, fill_row_.bidSize);
+        std::fill_n(asz_.data() + m, k, fill_row_.askSize);
+        std::fill_n(lr_.data() + m, k, 0.0f);
+        fill_left_ -= static_cast<uint32_t>(k);
+        m += k;
+        continue;
+      }
+      if (i_ == in_.n) break;
+      // Stored rows up to and including the next one that has a fill run.
+      size_t take = 0;
+      while (i_ + take < in_.n && m + take < block_) {
+        if (fill_[i_ + take++]) break;
+      }
+      std::memcpy(ts_.data() + m, in_.ts + i_, take * sizeof(uint64_t));
+      std::memcpy(bid_.data() + m, in_.bid + i_, take * sizeof(Px));
+      std::memcpy(ask_.data() + m, in_.ask + i_, take * sizeof(Px));
+      std::memcpy(bsz_.data() + m, in_.bidSize + i_, take * sizeof(int32_t));
+      std::memcpy(asz_.data() + m, in_.askSize + i_, take * sizeof(int32_t));
+      std::memcpy(lr_.data() + m, in_.logret + i_, take * sizeof(float));
+      const size_t j = i_ + take - 1;
+      if (fill_[j]) {
+        const DayMs t = to_day_ms(in_.ts[j]);
+        fill_left_ = fill_[j];
+        fill_clock_ = TsClock(t.day());
+        fill_ms_ = t.ms();
+        fill_row_ = MsBinRow{in_.ts[j], in_.bid[j], in_.ask[j],
+                             in_.bidSize[j], in_.askSize[j], 0.0f};
+      }
+      i_ += take;
+      m += take;
+    }
+    c = MsBinColumns{m, ts_.data(), bid_.data(), ask_.data(),
+                     bsz_.data(), asz_.data(), lr_.data()};
+    return m;
+  }
+
+ private:
+  size_t block_;
+  MsBinColumns in_;
+  const uint32_t* fill_ = nullptr;
+  size_t i_ = 0;
+  uint32_t fill_left_ = 0;
+  TsClock fill_clock_;  // fill run timestamps, one step at a time
+  int64_t fill_ms_ = 0;
+  MsBinRow fill_row_{};
+  std::vector<uint64_t> ts_;
+  std::vector<Px> bid_, ask_;
+  std::vector<int32_t> bsz_, asz_;
+  std::vector<float> lr_;
+};
+
+// The dense 1 ms grid of [first, last). For consumers that need every grid
+// row; everything else should use MsBinFillCursor.
+class MsBinDenseCursor {
+ public:
+  MsBinDenseCursor(const MsBinReader& r, uint64_t first, uint64_t last,
+                   size_t block_rows = 1 << 16, TaskPool* pool = nullptr)
+      : src_(r, first, last, block_rows, pool), x_(block_rows) {}
+
+  // Next block; 0 at the end.
+  size_t next(MsBinColumns& c) {
+    while (true) {
+      if (size_t m = x_.next(c)) return m;
+      MsBinColumns in;
+      const uint32_t* fill;
+      if (!src_.next(in, fill)) return 0;
+      x_.reset(in, fill);
+    }
+  }
+
+ private:
+  MsBinFillCursor src_;
+  MsBinDenseExpander x_;
+};
+
+// Rewrite `src` into `dst` in another layout. Rows, day table and fingerprint
+// are unchanged; dst gets its magic only once complete.
+inline void msbin_transcode(const std::filesystem::path& src,
+                            const std::filesystem::path& dst, MsBinLayout layout) {
+  const MsBinReader in(src);
+  MsBinHeader h = in.header();
+  h.flags = (h.flags & ~kMsBinLayoutMask) | msbin_layout_flags(layout);
+
+  std::FILE* f = std::fopen(dst.string().c_str(), "wb");
+  if (!f) throw std::runtime_error("open msbin for write failed: " + dst.string());
+  uint64_t pos = 0;
+  auto put = [&](const void* p, size_t n) {
+    if (n && std::fwrite(p, 1, n, f) != n) {
+      std::fclose(f);
+      throw std::runtime_error("msbin write failed: " + dst.string());
+    }
+    pos += n;
+  };
+
+  MsBinHeader blank = h;
+  std::memset(blank.magic, 0, sizeof(blank.magic));
+  put(&blank, sizeof(blank));
+
+  if (layout == MsBinLayout::kRows) {
+    MsBinCursor cur(in);
+    const MsBinRow* rows;
+    while (size_t n = cur.next(rows)) put(rows, n * sizeof(MsBinRow));
+  } else if (layout == MsBinLayout::kColumns) {
+    // One pass per column; the mapping stays in the page cache between passes.
+    auto column = [&](auto member) {
+      using T = std::remove_cv_t<std::remove_reference_t<decltype(MsBinRow{}.*member)>>;
+      std::vector<T> buf;
+      MsBinCursor cur(in);
+      const MsBinRow* rows;
+      while (size_t n = cur.next(rows)) {
+        buf.resize(n);
+        for (size_t i = 0; i < n; ++i) buf[i] = rows[i].*member;
+        put(buf.data(), n * sizeof(T));
+      }
+    };
+    column(&MsBinRow::ts);
+    column(&MsBinRow::bid);
+    column(&MsBinRow::ask);
+    column(&MsBinRow::bidSize);
+    column(&MsBinRow::askSize);
+    column(&MsBinRow::logret);
+  } else {
+    std::vector<MsBinBlock> index;
+    std::vector<MsBinRow> rows(msbin_codec::kPackedBlockRows);
+    std::vector<uint8_t> enc;
+    for (const MsBinDay& d : in.days()) {
+      for (uint64_t at = d.first_row; at < d.first_row + d.row_count;) {
+        const size_t n = static_cast<size_t>(std::min<uint64_t>(
+            rows.size(), d.first_row + d.row_count - at));
+        in.read(at, n, rows.data());
+        enc.clear();
+        msbin_codec::encode_block(rows.data(), n, enc);
+        index.push_back(MsBinBlock{pos, at, static_cast<uint32_t>(n),
+                                   static_cast<uint32_t>(enc.size())});
+        put(enc.data(), enc.size());
+        at += n;
+      }
+    }
+    const uint64_t count = index.size();
+    put(index.data(), index.size() * sizeof(MsBinBlock));
+    put(&count, sizeof(count));
+  }
+  h.day_table_offset = pos;
+  put(in.days().data(), in.days().size() * sizeof(MsBinDay));
+  if (std::fseek(f, 0, SEEK_SET) != 0) {
+    std::fclose(f);
+    throw std::runtime_error("msbin seek failed: " + dst.string());
+  }
+  put(&h, sizeof(h));
+  if (std::fclose(f) != 0) throw std::runtime_error("msbin write failed: " + dst.string());
+}
+
+// Appends rows in timestamp order, straight into the layout named by the
+// layout bits of `flags`:
+//   kRows     rows are buffered and written as they are.
+//   kPacked   each buffer is one block: it is flushed when full or at the
+//             first row of a new day, so blocks come out exactly as
+//             msbin_transcode cuts them.
+//   kColumns  the ts column goes into the file; since the other columns can
+//             only be placed once the row count is known, each is spilled to
+//             its own side file (<path>.colK) and appended by close().
+// Virtual clock files (kMsBinVirtualFill) record fill_cap_ms in every day.
+class MsBinWriter {
+ public:
+  MsBinWriter(const std::filesystem::path& path, uint64_t fingerprint,
+              uint32_t flags, uint32_t fill_cap_ms = 0, size_t buffer_rows = 1 << 16)
+      : path_(path), layout_(msbin_layout_of(flags)),
+        fill_cap_((flags & kMsBinVirtualFill) ? fill_cap_ms : 0),
+        buf_max_(layout_ == MsBinLayout::kPacked ? msbin_codec::kPackedBlockRows
+                                                 : std::max<size_t>(buffer_rows, 1)) {
+    f_ = std::fopen(path.string().c_str(), "wb");
+    if (!f_) {
+      throw std::runtime_error("open msbin for write failed: " +
+                               path.string());
+    }
+    std::memset(&h_, 0, sizeof(h_));
+    h_.version = kMsBinVersion;
+    h_.row_size = sizeof(MsBinRow);
+    h_.flags = (flags & ~kMsBinLayoutMask) | msbin_layout_flags(layout_);
+    h_.fingerprint = fingerprint;
+    put(&h_, sizeof(h_));  // placeholder: zero magic until close()
+    if (layout_ == MsBinLayout::kColumns) {
+      for (size_t k = 0; k < kSpills; ++k) {
+        spills_[k] = std::fopen(spill_path(k).string().c_str(), "w+b");
+        if (!spills_[k]) {
+          discard();
+          throw std::runtime_error("open msbin column spill failed: " +
+                                   spill_path(k).string());
+        }
+      }
+    }
+    buf_.reserve(buf_max_);
+  }
+
+  ~MsBinWriter() { discard(); }  // not closed: header stays invalid
+  MsBinWriter(const MsBinWriter&) = delete;
+  MsBinWriter& operator=(const MsBinWriter&) = delete;
+
+  void append(const MsBinRow& r) {
+    const uint32_t d = ymd(r.ts);
+    if (days_.empty() || days_.back().day != d) {
+      if (layout_ == MsBinLayout::kPacked) flush();  // blocks never straddle a day
+      days_.push_back(MsBinDay{d, fill_cap_, h_.row_count, 0});
+    }
+    ++days_.back().row_count;
+    if (h_.row_count == 0) h_.min_ts = r.ts;
+    h_.max_ts = r.ts;
+    ++h_.row_count;
+    buf_.push_back(r);
+    if (buf_.size() >= buf_max_) flush();
+  }
+
+  // Whole-day (or any contiguous) block of rows in one write. Packed files
+  // go through the block buffer.
+  void append(const MsBinRow* rows, size_t n) {
+    if (layout_ == MsBinLayout::kPacked) {
+      for (size_t i = 0; i < n; ++i) append(rows[i]);
+      return;
+    }
+    flush();
+    for (size_t i = 0; i < n; ++i) {
+      const uint32_t d = ymd(rows[i].ts);
+      if (days_.empty() || days_.back().day != d) {
+        days_.push_back(MsBinDay{d, fill_cap_, h_.row_count + i, 0});
+      }
+      ++days_.back().row_count;
+    }
+    if (n) {
+      if (h_.row_count == 0) h_.min_ts = rows[0].ts;
+      h_.max_ts = rows[n - 1].ts;
+    }
+    h_.row_count += n;
+    write_rows(rows, n);
+  }
+
+  uint64_t rows() const { return h_.row_count; }
+  const MsBinHeader& header() const { return h_; }  // complete after close()
+
+  void close() {
+    if (!f_) return;
+    flush();
+    if (layout_ == MsBinLayout::kColumns) {
+      // Spills go in column order; each is dropped once copied.
+      std::vector<unsigned char> chunk(1 << 20);
+      for (size_t k = 0; k < kSpills; ++k) {
+        if (std::fflush(spills_[k]) != 0 || std::fseek(spills_[k], 0, SEEK_SET) != 0) fail();
+        size_t n;
+        while ((n = std::fread(chunk.data(), 1, chunk.size(), spills_[k])) > 0) {
+          put(chunk.data(), n);
+        }
+        if (std::ferror(spills_[k])) fail();
+        std::fclose(spills_[k]);
+        spills_[k] = nullptr;
+        std::filesystem::remove(spill_path(k));
+      }
+    } else if (layout_ == MsBinLayout::kPacked) {
+      const uint64_t count = blocks_.size();
+      put(blocks_.data(), blocks_.size() * sizeof(MsBinBlock));
+      put(&count, sizeof(count));
+    }
+    h_.day_count = static_cast<uint32_t>(days_.size());
+    h_.day_table_offset = pos_;
+    put(days_.data(), days_.size() * sizeof(MsBinDay));
+    std::memcpy(h_.magic, kMsBinMagic, sizeof(h_.magic));
+    if (std::fseek(f_, 0, SEEK_SET) != 0) fail();
+    put(&h_, sizeof(h_));
+    const bool ok = std::fclose(f_) == 0;
+    f_ = nullptr;
+    if (!ok) fail();
+  }
+
+ private:
+  static constexpr size_t kSpills = 5;  // bid, ask, bidSize, askSize, logret
+
+  std::filesystem::path spill_path(size_t k) const {
+    return path_.string() + ".col" + std::to_string(k + 1);
+  }
+
+  void flush() {
+    write_rows(buf_.data(), buf_.size());
+    buf_.clear();
+  }
+
+  // rows are the last n rows appended.
+  void write_rows(const MsBinRow* rows, size_t n) {
+    if (n == 0) return;
+    if (layout_ == MsBinLayout::kRows) {
+      put(rows, n * sizeof(MsBinRow));
+    } else if (layout_ == MsBinLayout::kPacked) {
+      enc_.clear();
+      msbin_codec::encode_block(rows, n, enc_);
+      blocks_.push_back(MsBinBlock{pos_, h_.row_count - n, static_cast<uint32_t>(n),
+                                   static_cast<uint32_t>(enc_.size())});
+      put(enc_.data(), enc_.size());
+    } else {
+      auto column = [&](auto member, std::FILE* f) {
+        using T = std::remove_cv_t<std::remove_reference_t<decltype(MsBinRow{}.*member)>>;
+        enc_.resize(n * sizeof(T));
+        T* out = reinterpret_cast<T*>(enc_.data());
+        for (size_t i = 0; i < n; ++i) out[i] = rows[i].*member;
+        if (f) {
+          if (std::fwrite(enc_.data(), 1, enc_.size(), f) != enc_.size()) fail();
+        } else {
+          put(enc_.data(), enc_.size());
+        }
+      };
+      column(&MsBinRow::ts, nullptr);
+      column(&MsBinRow::bid, spills_[0]);
+      column(&MsBinRow::ask, spills_[1]);
+      column(&MsBinRow::bidSize, spills_[2]);
+      column(&MsBinRow::askSize, spills_[3]);
+      column(&MsBinRow::logret, spills_[4]);
+    }
+  }
+
+  void put(const void* p, size_t n) {
+    if (n && std::fwrite(p, 1, n, f_) != n) fail();
+    pos_ += n;
+  }
+  [[noreturn]] void fail() const {
+    throw std::runtime_error("msbin write failed: " + path_.string());
+  }
+
+  // Drops the spills of an unfinished file.
+  void discard() {
+    if (f_) std::fclose(f_);
+    f_ = nullptr;
+    for (size_t k = 0; k < kSpills; ++k) {
+      if (!spills_[k]) continue;
+      std::fclose(spills_[k]);
+      spills_[k] = nullptr;
+      std::error_code ec;
+      std::filesystem::remove(spill_path(k), ec);
+    }
+  }
+
+  std::filesystem::path path_;
+  MsBinLayout layout_;
+  uint32_t fill_cap_;
+  size_t buf_max_;
+  std::FILE* f_ = nullptr;
+  std::FILE* spills_[kSpills] = {};
+  uint64_t pos_ = 0;  // bytes written to f_, header included
+  MsBinHeader h_{};
+  std::vector<MsBinRow> buf_;
+  std::vector<MsBinDay> days_;
+  std::vector<MsBinBlock> blocks_;
+  std::vector<uint8_t> enc_;
+};
+
+}  // namespace nbbo
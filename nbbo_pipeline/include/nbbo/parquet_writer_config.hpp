@@ -0,0 +1,189 @@
+#pragma once
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/util/compression.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/properties.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "nbbo/arrow_utils.hpp"
+
+namespace nbbo {
+
+// Parquet writer settings shared by every tool that writes Parquet
+// (nbbo_pipeline, clean_mid_spikes, build_events).
+//
+// Row groups end at row_group_rows and, with row_groups_by_day, before the
+// first row of every new trading day, so a reader can prune whole days from
+// the row-group statistics and page indexes alone.
+struct ParquetWriterConfig {
+  std::string codec = "snappy";   // zstd | snappy | lz4 | gzip | none
+  int level = 0;                  // codec level; 0 = codec default
+  bool dictionary = true;         // dictionary pages (float columns too, unless bss)
+  bool float_byte_stream_split = false;  // BYTE_STREAM_SPLIT for float/double
+  bool statistics = true;         // column chunk min/max/null counts
+  bool page_index = true;         // column + offset index per page
+  int64_t row_group_rows = 0;     // 0 = the writer's own default
+  bool row_groups_by_day = true;
+  bool use_threads = false;       // encode a row group's columns in parallel
+
+  int64_t row_group_rows_or(int64_t fallback) const {
+    return row_group_rows > 0 ? row_group_rows : fallback;
+  }
+  std::string describe() const {
+    return "codec=" + codec + (level ? ":" + std::to_string(level) : std::string()) +
+           " dict=" + (dictionary ? "on" : "off") +
+           " float_bss=" + (float_byte_stream_split ? "on" : "off") +
+           " stats=" + (statistics ? "on" : "off") +
+           " page_index=" + (page_index ? "on" : "off") +
+           " row_groups=" + (row_group_rows ? std::to_string(row_group_rows) : std::string("default")) +
+           (row_groups_by_day ? "/day" : "");
+  }
+};
+
+inline constexpr const char* kParquetWriterUsage =
+    "  [--parquet-codec zstd|snappy|lz4|gzip|none] [--parquet-level N]\n"
+    "  [--parquet-no-dict] [--parquet-float-bss] [--parquet-no-stats]\n"
+    "  [--parquet-no-page-index] [--row-group-rows N] [--no-day-row-groups]\n";
+
+inline arrow::Compression::type parquet_codec(const std::string& name) {
+  arrow::Compression::type c;
+  if (name == "zstd") c = arrow::Compression::ZSTD;
+  else if (name == "snappy") c = arrow::Compression::SNAPPY;
+  else if (name == "lz4") c = arrow::Compression::LZ4;
+  else if (name == "gzip") c = arrow::Compression::GZIP;
+  else if (name == "none") return arrow::Compression::UNCOMPRESSED;
+  else throw std::runtime_error("unknown parquet codec: " + name);
+  if (!arrow::util::Codec::IsAvailable(c)) {
+    throw std::runtime_error("parquet codec not built into Arrow: " + name);
+  }
+  return c;
+}
+
+// Consumes argv[i] (and its value) if it is a writer flag. Returns false for
+// anything else so callers fall through to their own arguments.
+inline bool parse_parquet_writer_arg(int argc, char** argv, int& i,
+                                     ParquetWriterConfig& cfg) {
+  const std::string a = argv[i];
+  auto value = [&]() -> std::string {
+    if (i + 1 >= argc) throw std::runtime_error("missing value for " + a);
+    return argv[++i];
+  };
+  if (a == "--parquet-codec") {
+    cfg.codec = value();
+    parquet_codec(cfg.codec);  // validate now, not at the first open
+  } else if (a == "--parquet-level") {
+    cfg.level = std::stoi(value());
+  } else if (a == "--parquet-no-dict") {
+    cfg.dictionary = false;
+  } else if (a == "--parquet-float-bss") {
+    cfg.float_byte_stream_split = true;
+  } else if (a == "--parquet-no-stats") {
+    cfg.statistics = false;
+  } else if (a == "--parquet-no-page-index") {
+    cfg.page_index = false;
+  } else if (a == "--row-group-rows") {
+    cfg.row_group_rows = std::stoll(value());
+    if (cfg.row_group_rows <= 0) throw std::runtime_error("--row-group-rows must be > 0");
+  } else if (a == "--no-day-row-groups") {
+    cfg.row_groups_by_day = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline std::shared_ptr<parquet::WriterProperties> parquet_writer_properties(
+    const ParquetWriterConfig& cfg, const arrow::Schema& schema,
+    int64_t row_group_rows) {
+  parquet::WriterProperties::Builder b;
+  b.compression(parquet_codec(cfg.codec));
+  if (cfg.level != 0) b.compression_level(cfg.level);
+  if (cfg.dictionary) b.enable_dictionary(); else b.disable_dictionary();
+  if (cfg.statistics) b.enable_statistics(); else b.disable_statistics();
+  if (cfg.page_index) b.enable_write_page_index(); else b.disable_write_page_index();
+  b.max_row_group_length(row_group_rows);
+  if (cfg.float_byte_stream_split) {
+    for (const auto& f : schema.fields()) {
+      const auto id = f->type()->id();
+      if (id != arrow::Type::FLOAT && id != arrow::Type::DOUBLE) continue;
+      b.disable_dictionary(f->name());  // dictionary would take precedence
+      b.encoding(f->name(), parquet::Encoding::BYTE_STREAM_SPLIT);
+    }
+  }
+  return b.build();
+}
+
+inline std::unique_ptr<parquet::arrow::FileWriter> open_parquet_writer(
+    const std::shared_ptr<arrow::io::OutputStream>& out,
+    const std::shared_ptr<arrow::Schema>& schema,
+    const ParquetWriterConfig& cfg, int64_t row_group_rows) {
+  auto arrow_props = parquet::ArrowWriterProperties::Builder()
+                         .set_use_threads(cfg.use_threads)
+                         ->build();
+  auto fw_res = parquet::arrow::FileWriter::Open(
+      *schema, arrow::default_memory_pool(), out,
+      parquet_writer_properties(cfg, *schema, row_group_rows), arrow_props);
+  if (!fw_res.ok()) {
+    throw std::runtime_error("create writer failed: " +
+                             fw_res.status().ToString());
+  }
+  return std::move(fw_res).ValueOrDie();
+}
+
+// Writes record batches as explicit row groups: pending rows are flushed as
+// one row group when they reach `max_rows` or, with by_day, when a batch for
+// a different trading day arrives. Batches passed with day 0 never force a
+// cut.
+class RowGroupWriter {
+ public:
+  RowGroupWriter(parquet::arrow::FileWriter* writer,
+                 std::shared_ptr<arrow::Schema> schema, int64_t max_rows,
+                 bool by_day)
+      : writer_(writer), schema_(std::move(schema)), max_rows_(max_rows),
+        by_day_(by_day) {}
+
+  void write(std::shared_ptr<arrow::RecordBatch> batch, uint32_t day) {
+    if (by_day_ && day != 0 && day != day_ && rows_ > 0) flush();
+    if (day != 0) day_ = day;
+    int64_t off = 0;
+    const int64_t n = batch->num_rows();
+    while (off < n) {
+      const int64_t take = std::min(n - off, max_rows_ - rows_);
+      pending_.push_back(off == 0 && take == n ? batch : batch->Slice(off, take));
+      rows_ += take;
+      off += take;
+      if (rows_ >= max_rows_) flush();
+    }
+  }
+
+  void flush() {
+    if (rows_ == 0) return;
+    auto table = arrow::Table::FromRecordBatches(schema_, pending_).ValueOrDie();
+    ARROW_OK(writer_->WriteTable(*table, rows_));
+    pending_.clear();
+    rows_ = 0;
+    ++row_groups_;
+  }
+
+  uint64_t row_groups() const { return row_groups_; }
+
+ private:
+  parquet::arrow::FileWriter* writer_;
+  std::shared_ptr<arrow::Schema> schema_;
+  int64_t max_rows_;
+  bool by_day_;
+  std::vector<std::shared_ptr<arrow::RecordBatch>> pending_;
+  int64_t rows_ = 0;
+  uint32_t day_ = 0;
+  uint64_t row_groups_ = 0;
+};
+
+}  // namespace nbbo
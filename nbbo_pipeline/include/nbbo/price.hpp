@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+
+namespace nbbo {
+
+// Fixed-point prices. TAQ quotes carry at most four decimals, so a price is an
+// int32 count of 1/10000 dollar; SPY-range prices fit with room to spare
+// (int32 max ~ $214k). Parsing happens once at ingest; spreads, mid moves and
+// thresholds downstream are exact integer arithmetic.
+//
+// Parquet columns holding Px carry the key-value metadata
+// price_scale=10000 so readers can tell ticks from legacy float dollars.
+using Px = int32_t;
+
+inline constexpr int kPxDecimals = 4;
+inline constexpr Px kPxScale = 10000;   // Px per dollar
+inline constexpr Px kPxPerCent = 100;   // Px per 1-cent tick
+inline constexpr const char* kPxScaleKey = "price_scale";
+inline constexpr const char* kPxScaleValue = "10000";
+
+constexpr double px_to_double(Px p) {
+  return static_cast<double>(p) / kPxScale;
+}
+
+inline Px px_from_double(double dollars) {
+  return static_cast<Px>(std::llround(dollars * kPxScale));
+}
+
+// (bid + ask) / 2, rounded down to the nearest Px. Exact for cent quotes.
+constexpr Px px_mid(Px bid, Px ask) {
+  return static_cast<Px>((static_cast<int64_t>(bid) + ask) >> 1);
+}
+
+// Decimal "123", "123.4", "123.4567" -> Px. Digits past the fourth decimal
+// round half-up. No sign, exponent or locale; rejects anything else.
+inline bool parse_px(std::string_view s, Px& out) {
+  const char* p = s.data();
+  const char* const e = p + s.size();
+  if (p == e) return false;
+
+  int64_t v = 0;
+  const char* const int_start = p;
+  for (; p < e && *p != '.'; ++p) {
+    const unsigned d = static_cast<unsigned char>(*p) - '0';
+    if (d > 9) return false;
+    v = v * 10 + d;
+    if (v > INT32_MAX / kPxScale) return false;
+  }
+  bool any_digits = p != int_start;
+  v *= kPxScale;
+
+  if (p < e) {  // '.'
+    ++p;
+    int64_t scale = kPxScale / 10;
+    bool round_up = false;
+    for (int i = 0; p < e; ++p, ++i) {
+      const unsigned d = static_cast<unsigned char>(*p) - '0';
+      if (d > 9) return false;
+      any_digits = true;
+      if (i < kPxDecimals) {
+        v += d * scale;
+        scale /= 10;
+      } else if (i == kPxDecimals) {
+        round_up = d >= 5;
+      }
+    }
+    if (round_up) ++v;
+  }
+  if (!any_digits || v > INT32_MAX) return false;
+  out = static_cast<Px>(v);
+  return true;
+}
+
+}  // namespace nbbo
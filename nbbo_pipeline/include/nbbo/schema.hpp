@@ -2,20 +2,94 @@
 #include <arrow/api.h>
 
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "nbbo/event_types.hpp"
+#include "nbbo/price.hpp"
 
 namespace nbbo {
 
+// Prices (mid, spread, bid, ask) are int32 Px ticks of 1/10000 dollar; the
+// schema metadata carries price_scale so readers can tell them from the
+// legacy float32 dollar layout.
 inline std::shared_ptr<arrow::Schema> nbbo_schema() {
-  return arrow::schema({
+  return arrow::schema(
+      {
+          arrow::field("ts", arrow::uint64()),
+          arrow::field("mid", arrow::int32()),
+          arrow::field("log_return", arrow::float32()),
+          arrow::field("bid_size", arrow::int32()),
+          arrow::field("ask_size", arrow::int32()),
+          arrow::field("spread", arrow::int32()),
+          arrow::field("bid", arrow::int32()),
+          arrow::field("ask", arrow::int32()),
+      },
+      arrow::key_value_metadata({kPxScaleKey}, {kPxScaleValue}));
+}
+
+// Virtual clock grid (nbbo_pipeline --clock-virtual): the nbbo_schema rows
+// that carry a new quote, plus valid_until_ms, the last millisecond since
+// midnight (inclusive) the quote stands for on the 1 ms grid. Every ms in
+// (ts, valid_until_ms] is a forward-filled row with the same prices and sizes
+// and log return 0.
+inline constexpr const char* kValidUntilColumn = "valid_until_ms";
+
+inline std::shared_ptr<arrow::Schema> nbbo_virtual_clock_schema() {
+  auto base = nbbo_schema();
+  auto fields = base->fields();
+  fields.push_back(arrow::field(kValidUntilColumn, arrow::int32()));
+  return arrow::schema(fields, base->metadata());
+}
+
+// Labeled events (build_events), version 2: signs (last_move, y) are int8,
+// millisecond quantities (age_diff_ms, tau_ms) int32 and prices int32 Px;
+// the trading day is ts / 1e9 and has no column. Version 1 files have no
+// events_schema key, a uint32 date column and float64 age_diff_ms,
+// last_move, y and tau_ms. Readers look columns up by name and take both.
+// Each extra horizon h adds nullable mid_next_<h> (int32 Px), y_<h> (int8)
+// and tau_<h> (int32 ms) columns, null where the day ended first.
+inline constexpr const char* kEventsSchemaKey = "events_schema";
+inline constexpr int kEventsSchemaVersion = 2;
+
+inline std::shared_ptr<arrow::Schema> events_schema(
+    const std::vector<EventHorizon>& horizons = {}) {
+  arrow::FieldVector fields = {
       arrow::field("ts", arrow::uint64()),
-      arrow::field("mid", arrow::float32()),
-      arrow::field("log_return", arrow::float32()),
-      arrow::field("bid_size", arrow::float32()),
-      arrow::field("ask_size", arrow::float32()),
-      arrow::field("spread", arrow::float32()),
-      arrow::field("bid", arrow::float32()),
-      arrow::field("ask", arrow::float32()),
-  });
+      arrow::field("mid", arrow::int32()),
+      arrow::field("mid_next", arrow::int32()),
+      arrow::field("spread", arrow::int32()),
+      arrow::field("imbalance", arrow::float64()),
+      arrow::field("age_diff_ms", arrow::int32()),
+      arrow::field("last_move", arrow::int8()),
+      arrow::field("y", arrow::int8()),
+      arrow::field("tau_ms", arrow::int32()),
+  };
+  for (const auto& h : horizons) {
+    fields.push_back(arrow::field("mid_next_" + h.name(), arrow::int32()));
+    fields.push_back(arrow::field("y_" + h.name(), arrow::int8()));
+    fields.push_back(arrow::field("tau_" + h.name(), arrow::int32()));
+  }
+  return arrow::schema(
+      fields,
+      arrow::key_value_metadata(
+          {kPxScaleKey, kEventsSchemaKey},
+          {kPxScaleValue, std::to_string(kEventsSchemaVersion)}));
+}
+
+// Schema version of an events file: its events_schema key, 1 without one.
+// Throws for versions newer than this build reads.
+inline int events_schema_version(const arrow::Schema& schema) {
+  const auto& md = schema.metadata();
+  const int k = md ? md->FindKey(kEventsSchemaKey) : -1;
+  if (k < 0) return 1;
+  const int v = std::stoi(md->value(k));
+  if (v < 1 || v > kEventsSchemaVersion) {
+    throw std::runtime_error("unsupported events schema version " +
+                             md->value(k));
+  }
+  return v;
 }
 
 }  // namespace nbbo
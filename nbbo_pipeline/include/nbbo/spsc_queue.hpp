@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <semaphore>
+#include <utility>
+#include <vector>
+
+namespace nbbo {
+
+// Bounded single-producer single-consumer ring. Each index is touched by one
+// side only; two counting semaphores (free slots, filled slots) carry the
+// hand-off and block a side only when the ring is full or empty, which is
+// the backpressure. close() aborts: pending items are dropped and both push
+// and pop return false from then on, so a failing side can release the
+// other.
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t capacity)
+      : buf_(capacity), slots_(static_cast<std::ptrdiff_t>(capacity)), items_(0) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  bool push(T v) {
+    slots_.acquire();
+    if (closed_.load(std::memory_order_acquire)) {
+      slots_.release();
+      return false;
+    }
+    buf_[tail_++ % buf_.size()] = std::move(v);
+    items_.release();
+    return true;
+  }
+
+  bool pop(T& v) {
+    items_.acquire();
+    if (closed_.load(std::memory_order_acquire)) {
+      items_.release();
+      return false;
+    }
+    v = std::move(buf_[head_++ % buf_.size()]);
+    slots_.release();
+    return true;
+  }
+
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    slots_.release();
+    items_.release();
+  }
+
+ private:
+  std::vector<T> buf_;
+  size_t head_ = 0;  // consumer only
+  size_t tail_ = 0;  // producer only
+  std::counting_semaphore<> slots_, items_;
+  std::atomic<bool> closed_{false};
+};
+
+}  // namespace nbbo
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "nbbo/msbin.hpp"
+
+namespace nbbo {
+
+// Log-return distribution of one msbin, for exact winsor cutoffs.
+//
+// Floats are ranked through an order-preserving uint32 key (sign bit flipped
+// for positives, all bits for negatives), so a quantile is a radix select over
+// keys: the top 16 bits pick a coarse bin, the low 16 bits the value in it.
+//
+// Stage A counts every distinct finite key while it writes the msbin and
+// stores the counts in a sidecar (<msbin>.tail). Quote data has few distinct
+// returns (ticks over a narrow price range), so the table stays small; past
+// kMaxExactKeys it folds into the 65536 coarse bins and Stage B resolves the
+// low 16 bits with one scan of that file.
+//
+// Sidecar: [TailFileHeader, 64 bytes][TailBin x bins], bins sorted by key.
+// Exact sidecars hold one bin per distinct key; coarse ones one per nonempty
+// top-16-bit prefix (key = prefix << 16). The header repeats the msbin's
+// fingerprint, row count and ts range; any mismatch reads as missing. On
+// virtual clock grids the counts include the implied fill rows (log return
+// 0), so they exceed the stored row count.
+
+inline uint32_t tail_key(float v) {
+  uint32_t b;
+  std::memcpy(&b, &v, sizeof(b));
+  return b ^ ((b >> 31) ? 0xFFFFFFFFu : 0x80000000u);
+}
+
+inline float tail_value(uint32_t k) {
+  const uint32_t b = k ^ ((k >> 31) ? 0x80000000u : 0xFFFFFFFFu);
+  float v;
+  std::memcpy(&v, &b, sizeof(v));
+  return v;
+}
+
+inline constexpr int kTailFineBits = 16;
+inline constexpr size_t kTailBins = size_t{1} << kTailFineBits;  // per level
+
+// Index of the bin holding 0-based rank `r` of a kTailBins histogram; `r`
+// becomes the rank inside that bin. Caller guarantees r < sum(hist).
+inline uint32_t tail_locate(const uint64_t* hist, uint64_t& r) {
+  for (uint32_t b = 0; b < kTailBins; ++b) {
+    if (r < hist[b]) return b;
+    r -= hist[b];
+  }
+  return kTailBins - 1;
+}
+
+#pragma pack(push, 1)
+struct TailFileHeader {
+  char magic[8];  // "NBTAIL01"
+  uint32_t version;
+  uint32_t flags;  // kTailExact
+  uint64_t fingerprint;
+  uint64_t row_count;
+  uint64_t min_ts;
+  uint64_t max_ts;
+  uint64_t finite;  // sum of bin counts
+  uint64_t bins;
+};
+struct TailBin {
+  uint32_t key;
+  uint32_t reserved;
+  uint64_t count;
+};
+#pragma pack(pop)
+static_assert(sizeof(TailFileHeader) == 64, "tail sidecar header is 64 bytes");
+static_assert(sizeof(TailBin) == 16, "tail bin is 16 bytes");
+
+inline constexpr char kTailMagic[8] = {'N', 'B', 'T', 'A', 'I', 'L', '0', '1'};
+inline constexpr uint32_t kTailVersion = 1;
+inline constexpr uint32_t kTailExact = 1u << 0;
+
+inline std::filesystem::path tail_sidecar_path(const std::filesystem::path& msbin) {
+  return msbin.string() + ".tail";
+}
+
+class TailStats {
+ public:
+  static constexpr size_t kMaxExactKeys = size_t{1} << 20;
+
+  TailStats() = default;
+  TailStats(TailStats&&) = default;
+  TailStats& operator=(TailStats&&) = default;
+  TailStats(const TailStats&) = delete;  // last_ points into exact_
+  TailStats& operator=(const TailStats&) = delete;
+
+  // Non-finite values (day-boundary NaNs) are not counted. Runs of one value
+  // (forward-filled zeros) skip the hash lookup.
+  void add(float v) {
+    if (!(std::fabs(v) <= std::numeric_limits<float>::max())) return;
+    const uint32_t k = tail_key(v);
+    ++n_;
+    if (!exact_ok_) {
+      ++coarse_[k >> kTailFineBits];
+      return;
+    }
+    if (last_ && k == last_key_) {
+      ++*last_;
+      return;
+    }
+    last_key_ = k;
+    last_ = &++exact_[k];
+    if (exact_.size() > kMaxExactKeys) fold();
+  }
+
+  // `count` copies of v at once: the implied zero-return fills of a virtual
+  // clock grid.
+  void add(float v, uint64_t count) {
+    if (count == 0 || !(std::fabs(v) <= std::numeric_limits<float>::max())) return;
+    const uint32_t k = tail_key(v);
+    n_ += count;
+    if (!exact_ok_) {
+      coarse_[k >> kTailFineBits] += count;
+      return;
+    }
+    if (!(last_ && k == last_key_)) {
+      last_key_ = k;
+      last_ = &exact_[k];
+    }
+    *last_ += count;
+    if (exact_.size() > kMaxExactKeys) fold();
+  }
+
+  void merge(const TailStats& o) {
+    n_ += o.n_;
+    if (o.exact_ok_) {
+      for (const auto& [k, c] : o.exact_) {
+        if (exact_ok_) {
+          exact_[k] += c;
+        } else {
+          coarse_[k >> kTailFineBits] += c;
+        }
+      }
+      if (exact_ok_ && exact_.size() > kMaxExactKeys) fold();
+    } else {
+      if (exact_ok_) fold();
+      for (size_t b = 0; b < kTailBins; ++b) coarse_[b] += o.coarse_[b];
+    }
+  }
+
+  uint64_t count() const { return n_; }
+  bool exact() const { return exact_ok_; }
+
+  // hist[k >> 16] += count, kTailBins entries.
+  void add_coarse_to(uint64_t* hist) const {
+    if (!exact_ok_) {
+      for (size_t b = 0; b < kTailBins; ++b) hist[b] += coarse_[b];
+      return;
+    }
+    for (const auto& [k, c] : exact_) hist[k >> kTailFineBits] += c;
+  }
+
+  // hist[k & 0xFFFF] += count for keys under `prefix`. exact() only.
+  void add_fine_to(uint32_t prefix, uint64_t* hist) const {
+    for (const auto& [k, c] : exact_) {
+      if ((k >> kTailFineBits) == prefix) hist[k & (kTailBins - 1)] += c;
+    }
+  }
+
+  // Tmp file + rename, so a reader never sees a partial sidecar.
+  void save(const std::filesystem::path& path, const MsBinHeader& msb) const {
+    std::vector<TailBin> bins;
+    if (exact_ok_) {
+      bins.reserve(exact_.size());
+      for (const auto& [k, c] : exact_) bins.push_back(TailBin{k, 0, c});
+      std::sort(bins.begin(), bins.end(),
+                [](const TailBin& a, const TailBin& b) { return a.key < b.key; });
+    } else {
+      for (size_t b = 0; b < kTailBins; ++b) {
+        if (coarse_[b]) bins.push_back(TailBin{static_cast<uint32_t>(b << kTailFineBits), 0, coarse_[b]});
+      }
+    }
+    TailFileHeader h{};
+    std::memcpy(h.magic, kTailMagic, sizeof(h.magic));
+    h.version = kTailVersion;
+    h.flags = exact_ok_ ? kTailExact : 0u;
+    h.fingerprint = msb.fingerprint;
+    h.row_count = msb.row_count;
+    h.min_ts = msb.min_ts;
+    h.max_ts = msb.max_ts;
+    h.finite = n_;
+    h.bins = bins.size();
+
+    const std::string tmp = path.string() + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot write tail sidecar: " + tmp);
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+    if (ok && !bins.empty()) ok = std::fwrite(bins.data(), sizeof(TailBin), bins.size(), f) == bins.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok) throw std::runtime_error("cannot write tail sidecar: " + tmp);
+    std::filesystem::rename(tmp, path);
+  }
+
+  // False (out untouched) if the sidecar is missing, malformed or was not
+  // written for the msbin described by `msb`.
+  static bool load(const std::filesystem::path& path, const MsBinHeader& msb, TailStats& out) {
+    std::FILE* f = std::fopen(path.string().c_str(), "rb");
+    if (!f) return false;
+    TailFileHeader h{};
+    std::vector<TailBin> bins;
+    bool ok = std::fread(&h, sizeof(h), 1, f) == 1 &&
+              std::memcmp(h.magic, kTailMagic, sizeof(h.magic)) == 0 &&
+              h.version == kTailVersion && h.fingerprint == msb.fingerprint &&
+              h.row_count == msb.row_count && h.min_ts == msb.min_ts &&
+              h.max_ts == msb.max_ts && h.bins <= h.finite &&
+              (h.finite <= h.row_count || (msb.flags & kMsBinVirtualFill));
+    if (ok) {
+      bins.resize(h.bins);
+      ok = std::fread(bins.data(), sizeof(TailBin), bins.size(), f) == bins.size() &&
+           std::fgetc(f) == EOF;
+    }
+    std::fclose(f);
+    if (!ok) return false;
+
+    TailStats s;
+    const bool exact = (h.flags & kTailExact) != 0;
+    if (!exact) s.fold();
+    uint64_t sum = 0;
+    for (const TailBin& b : bins) {
+      sum += b.count;
+      if (exact) {
+        s.exact_.emplace(b.key, b.count);
+      } else {
+        s.coarse_[b.key >> kTailFineBits] += b.count;
+      }
+    }
+    if (sum != h.finite) return false;
+    s.n_ = sum;
+    out = std::move(s);
+    return true;
+  }
+
+ private:
+  void fold() {
+    coarse_.assign(kTailBins, 0);
+    for (const auto& [k, c] : exact_) coarse_[k >> kTailFineBits] += c;
+    exact_ = {};
+    exact_ok_ = false;
+    last_ = nullptr;
+  }
+
+  std::unordered_map<uint32_t, uint64_t> exact_;
+  std::vector<uint64_t> coarse_;  // kTailBins once !exact_ok_
+  uint64_t* last_ = nullptr;
+  uint32_t last_key_ = 0;
+  uint64_t n_ = 0;
+  bool exact_ok_ = true;
+};
+
+}  // namespace nbbo
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace nbbo {
+
+// Fixed set of worker threads shared by everything one process runs in
+// parallel (all stages of all symbols). Each worker has its own deque: tasks
+// it submits go to the back and it takes from the back, idle workers steal
+// from the front of the others'. Tasks submitted from other threads go to a
+// shared inbound queue.
+//
+// Every task belongs to a TaskGroup. TaskGroup::wait() on a pool thread first
+// runs the group's tasks that nobody has started yet, so a task may wait for
+// tasks it submitted without tying up the pool or deadlocking it; elsewhere
+// it just blocks. Tasks are meant to be coarse (a file, a day, a chunk).
+class TaskPool;
+
+class TaskGroup {
+ public:
+  explicit TaskGroup(TaskPool& pool) : pool_(pool) {}
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+  ~TaskGroup() {
+    try {
+      wait();
+    } catch (...) {
+    }
+  }
+
+  inline void run(std::function<void()> fn);
+
+  // Returns once every task has finished; rethrows the first exception.
+  inline void wait();
+
+ private:
+  friend class TaskPool;
+  struct Task {
+    std::function<void()> fn;
+    TaskGroup* group = nullptr;
+    std::atomic<bool> claimed{false};
+  };
+
+  // Runs t unless someone already has. Only the claimant touches the group.
+  static void execute(Task& t) {
+    if (t.claimed.exchange(true, std::memory_order_acq_rel)) return;
+    TaskGroup& g = *t.group;
+    std::exception_ptr e;
+    try {
+      t.fn();
+    } catch (...) {
+      e = std::current_exception();
+    }
+    t.fn = nullptr;
+    std::lock_guard<std::mutex> lk(g.mu_);
+    if (e && !g.err_) g.err_ = e;
+    if (--g.pending_ == 0) g.cv_.notify_all();
+  }
+
+  TaskPool& pool_;
+  std::vector<std::shared_ptr<Task>> tasks_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  size_t pending_ = 0;
+  std::exception_ptr err_;
+};
+
+class TaskPool {
+ public:
+  explicit TaskPool(int threads) : n_(static_cast<size_t>(std::max(1, threads))) {
+    for (size_t i = 0; i <= n_; ++i) queues_.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < n_; ++i) threads_.emplace_back([this, i] { loop(i); });
+  }
+  TaskPool(const TaskPool&) = delete;
+  TaskPool& operator=(const TaskPool&) = delete;
+  ~TaskPool() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+  }
+
+  int size() const { return static_cast<int>(n_); }
+  bool on_worker() const { return tls_pool_ == this; }
+
+ private:
+  friend class TaskGroup;
+  using TaskPtr = std::shared_ptr<TaskGroup::Task>;
+  struct Queue {
+    std::mutex mu;
+    std::deque<TaskPtr> q;
+  };
+
+  void push(TaskPtr t) {
+    Queue& q = on_worker() ? *queues_[tls_index_] : *queues_.back();
+    {
+      std::lock_guard<std::mutex> lk(q.mu);
+      q.q.push_back(std::move(t));
+    }
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      ++queued_;
+    }
+    cv_.notify_one();
+  }
+
+  // Own deque from the back, then the inbound queue, then steal.
+  TaskPtr take(size_t self) {
+    TaskPtr t;
+    auto pop = [&](Queue& q, bool back) {
+      std::lock_guard<std::mutex> lk(q.mu);
+      if (q.q.empty()) return false;
+      if (back) {
+        t = std::move(q.q.back());
+        q.q.pop_back();
+      } else {
+        t = std::move(q.q.front());
+        q.q.pop_front();
+      }
+      return true;
+    };
+    bool got = pop(*queues_[self], true) || pop(*queues_[n_], false);
+    for (size_t k = 1; !got && k < n_; ++k) got = pop(*queues_[(self + k) % n_], false);
+    if (!got) return nullptr;
+    std::lock_guard<std::mutex> lk(mu_);
+    --queued_;
+    return t;
+  }
+
+  void loop(size_t self) {
+    tls_pool_ = this;
+    tls_index_ = self;
+    while (true) {
+      if (TaskPtr t = take(self)) {
+        TaskGroup::execute(*t);
+        continue;
+      }
+      std::unique_lock<std::mutex> lk(mu_);
+      cv_.wait(lk, [&] { return stop_ || queued_ > 0; });
+      if (stop_ && queued_ == 0) return;
+    }
+  }
+
+  const size_t n_;
+  std::vector<std::unique_ptr<Queue>> queues_;  // one per worker + inbound
+  std::vector<std::thread> threads_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  size_t queued_ = 0;  // entries in all queues, started or not
+  bool stop_ = false;
+
+  static inline thread_local const TaskPool* tls_pool_ = nullptr;
+  static inline thread_local size_t tls_index_ = 0;
+};
+
+inline void TaskGroup::run(std::function<void()> fn) {
+  auto t = std::make_shared<Task>();
+  t->fn = std::move(fn);
+  t->group = this;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    ++pending_;
+  }
+  tasks_.push_back(t);
+  pool_.push(std::move(t));
+}
+
+inline void TaskGroup::wait() {
+  if (pool_.on_worker()) {
+    for (const auto& t : tasks_) execute(*t);
+  }
+  std::unique_lock<std::mutex> lk(mu_);
+  cv_.wait(lk, [&] { return pending_ == 0; });
+  tasks_.clear();
+  if (err_) std::rethrow_exception(std::exchange(err_, nullptr));
+}
+
+}  // namespace nbbo
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <compare>
 #include <cstdint>
 #include <string>
 #include <cstdio>   // std::snprintf
@@ -20,7 +21,13 @@ namespace nbbo {
 //   - Milliseconds-since-midnight computation
 //   - Incrementing a timestamp by 1 ms (intraday, no calendar roll)
 //   - Conversion between day integers (YYYYMMDD) and strings ("YYYY-MM-DD")
+//   - DayMs, the compact (day, ms-of-day) form hot loops carry instead, and
+//     TsClock, which turns ascending ms-of-day back into timestamps
 //   - Modern C++20 <chrono>-based wrappers for working with timestamps.
+//
+// Whole-column decoding (AVX2 / AVX-512 with runtime dispatch) is in
+// nbbo/ts_decode.hpp: it needs <immintrin.h> and target attributes, which
+// the many row-at-a-time users of this header have no use for.
 
 // --------------------- Low-level integer helpers ---------------------
 
@@ -54,47 +61,99 @@ inline bool same_day(uint64_t a, uint64_t b) {
   return ymd(a) == ymd(b);
 }
 
+// --------------------- Compact time ---------------------
+
+// Trading day (YYYYMMDD) in the high 32 bits and milliseconds since midnight
+// in the low 32 bits of one uint64. Orders like the decimal encoding, and a
+// same-day test, the ms of day and a step of n ms are a shift, a truncation
+// and an add. Loops that look at every row carry DayMs; the decimal
+// YYYYMMDDHHMMSSmmm form is only decoded or produced where rows enter or
+// leave files (CSV, msbin, Parquet). Steps never roll into the next day.
+struct DayMs {
+  uint64_t v = 0;
+
+  static constexpr DayMs of(uint32_t day, int ms) {
+    return DayMs{(static_cast<uint64_t>(day) << 32) | static_cast<uint32_t>(ms)};
+  }
+  constexpr uint32_t day() const { return static_cast<uint32_t>(v >> 32); }
+  constexpr int ms() const { return static_cast<int>(static_cast<uint32_t>(v)); }
+  constexpr DayMs plus_ms(int n) const { return DayMs{v + static_cast<uint64_t>(n)}; }
+  constexpr explicit operator bool() const { return v != 0; }
+
+  friend constexpr auto operator<=>(DayMs, DayMs) = default;
+};
+
+// YYYYMMDDHHMMSSmmm -> DayMs. The time of day is split off first so the
+// field extraction runs on 32-bit values. Read as a number, HHMMSSmmm
+// overcounts each hour by 1e7 - 3.6e6 and each minute by 1e5 - 6e4 ms, i.e.
+// by 40000 * (HHMM + 60 * HH); two divisions give both fields
+// (nbbo/ts_decode.hpp does the same on whole columns).
+constexpr DayMs to_day_ms(uint64_t ts) {
+  const uint32_t t = static_cast<uint32_t>(ts % 1000000000ULL);  // HHMMSSmmm
+  const uint32_t hhmm = t / 100000U;
+  const uint32_t ms = t - 40000U * (hhmm + 60U * (hhmm / 100U));
+  return DayMs::of(static_cast<uint32_t>(ts / 1000000000ULL), static_cast<int>(ms));
+}
+
+// DayMs -> YYYYMMDDHHMMSSmmm. For ascending runs within a day, TsClock below
+// avoids the divisions.
+constexpr uint64_t to_legacy_ts(DayMs t) {
+  const uint32_t ms = static_cast<uint32_t>(t.ms());
+  const uint32_t hms = (ms / 3600000U * 100U + ms / 60000U % 60U) * 100U + ms / 1000U % 60U;
+  return static_cast<uint64_t>(t.day()) * 1000000000ULL + static_cast<uint64_t>(hms) * 1000ULL + ms % 1000U;
+}
+
+static_assert(to_day_ms(20240102093000123ULL) == DayMs::of(20240102, 34200123));
+static_assert(to_legacy_ts(DayMs::of(20240102, 57599999)) == 20240102155959999ULL);
+
 // Milliseconds since midnight, using the HH:MM:SS.mmm components.
-inline int ms_since_midnight(uint64_t ts) {
-  return ((hh(ts) * 60 + mm(ts)) * 60 + ss(ts)) * 1000 + mmm(ts);
+constexpr int ms_since_midnight(uint64_t ts) {
+  return to_day_ms(ts).ms();
 }
 
 // Increment timestamp by 1 ms, keeping the YYYYMMDD date fields consistent
 // with the existing representation. This does NOT do full calendar arithmetic
 // (e.g. month length or leap year checks); it assumes the caller stays within
-// a valid intraday range.
-inline uint64_t inc_ms(uint64_t ts) {
-  int H   = hh(ts);
-  int M   = mm(ts);
-  int S   = ss(ts);
-  int MS  = mmm(ts);
-
-  // Extract calendar date "as stored".
-  int Y   = static_cast<int>(ts / 1000000000000ULL);
-  int Mon = static_cast<int>((ts / 10000000000ULL) % 100ULL);
-  int D   = static_cast<int>((ts / 100000000ULL) % 100ULL);
-
-  if (++MS == 1000) {
-    MS = 0;
-    if (++S == 60) {
-      S = 0;
-      if (++M == 60) {
-        M = 0;
-        ++H;
-        // Note: if H reaches 24, behavior is up to the caller; this function
-        // does not roll to the next day/month/year.
+// a valid intraday range. Runs of steps should go through TsClock.
+constexpr uint64_t inc_ms(uint64_t ts) {
+  return ts % 1000ULL != 999ULL ? ts + 1 : to_legacy_ts(to_day_ms(ts).plus_ms(1));
+}
+
+// Milliseconds since midnight -> YYYYMMDDHHMMSSmmm for one day. Small forward
+// steps carry digit by digit, so the per-row cost has no division.
+class TsClock {
+ public:
+  explicit TsClock(uint32_t day = 0) : base_(uint64_t{day} * 1000000000ULL) {}
+
+  uint64_t at(int64_t msod) {
+    const int64_t d = msod - msod_;
+    if (msod_ >= 0 && d >= 0 && d < 1000) {
+      ms_ += static_cast<int>(d);
+      if (ms_ >= 1000) {
+        ms_ -= 1000;
+        if (++s_ == 60) {
+          s_ = 0;
+          if (++m_ == 60) {
+            m_ = 0;
+            ++h_;
+          }
+        }
       }
+    } else {
+      ms_ = static_cast<int>(msod % 1000);
+      s_ = static_cast<int>((msod / 1000) % 60);
+      m_ = static_cast<int>((msod / 60000) % 60);
+      h_ = static_cast<int>(msod / 3600000);
     }
+    msod_ = msod;
+    return base_ + static_cast<uint64_t>(((h_ * 100 + m_) * 100 + s_) * 1000 + ms_);
   }
 
-  return static_cast<uint64_t>(Y)   * 1000000000000ULL +
-         static_cast<uint64_t>(Mon) * 10000000000ULL  +
-         static_cast<uint64_t>(D)   * 100000000ULL    +
-         static_cast<uint64_t>(H)   * 10000000ULL     +
-         static_cast<uint64_t>(M)   * 100000ULL       +
-         static_cast<uint64_t>(S)   * 1000ULL         +
-         static_cast<uint64_t>(MS);
-}
+ private:
+  uint64_t base_;
+  int64_t msod_ = -1;
+  int h_ = 0, m_ = 0, s_ = 0, ms_ = 0;
+};
 
 // Extract the 4-digit year (YYYY) from the timestamp.
 inline int year_from_ts(uint64_t ts) {
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NBBO_TS_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "nbbo/time_utils.hpp"
+
+namespace nbbo {
+
+// Batch decoding of YYYYMMDDHHMMSSmmm timestamps into a day (YYYYMMDD) and a
+// millisecond-of-day column, for tools that read a whole ts column at a time.
+//
+// Rows are sorted, so a batch is almost always a few long runs of one day.
+// The vector kernels check that every lane lies in the current day's
+// [day * 1e9, (day + 1) * 1e9) range with two compares; the time of day is
+// then a subtraction, and its HHMM and HH fields come from 32x32->64-bit
+// multiplies by reciprocals (exact for any time of day below 1e9). A group
+// that leaves the day goes through the scalar to_day_ms and moves the range.
+//
+// Unlike csv_scan.hpp the kernel is picked at run time, so a plain -O3 build
+// still uses AVX2 / AVX-512 where the CPU has them.
+
+enum class TsDecodeIsa : uint8_t { kScalar, kAvx2, kAvx512 };
+
+inline const char* ts_decode_isa_name(TsDecodeIsa isa) {
+  switch (isa) {
+    case TsDecodeIsa::kAvx512: return "avx512";
+    case TsDecodeIsa::kAvx2: return "avx2";
+    default: return "scalar";
+  }
+}
+
+// Best kernel this CPU runs; probed once.
+inline TsDecodeIsa ts_decode_isa() {
+#if defined(NBBO_TS_DECODE_X86)
+  static const TsDecodeIsa isa = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return TsDecodeIsa::kAvx512;
+    if (__builtin_cpu_supports("avx2")) return TsDecodeIsa::kAvx2;
+    return TsDecodeIsa::kScalar;
+  }();
+  return isa;
+#else
+  return TsDecodeIsa::kScalar;
+#endif
+}
+
+namespace detail {
+
+inline constexpr uint64_t kTsPerDay = 1000000000ULL;
+// floor(t / 1e5) == (t * kRecip1e5) >> 48 and floor(a / 100) ==
+// (a * kRecip100) >> 19 for every t < 1e9, a < 1e4. These are the only
+// inputs the kernels give them: t is a time of day (the range check keeps
+// ts inside [day * 1e9, (day + 1) * 1e9)) and a = floor(t / 1e5) <= 9999,
+// both below 2^32 as _mm*_mul_epu32 needs. Outside these ranges the
+// reciprocals are not exact.
+inline constexpr uint32_t kRecip1e5 = 2814749768U;
+inline constexpr uint32_t kRecip100 = 5243U;
+
+// Proof by boundaries: (x * r) >> s never decreases as x grows, so it equals
+// floor(x / d) on all of [0, limit) iff it does so at every multiple of d
+// and just below it.
+constexpr bool reciprocal_exact(uint64_t d, uint64_t r, int s, uint64_t limit) {
+  for (uint64_t q = 1; q * d <= limit; ++q) {
+    if (((q * d * r) >> s) != q || (((q * d - 1) * r) >> s) != q - 1) return false;
+  }
+  return ((limit - 1) * r >> s) == (limit - 1) / d;
+}
+static_assert(reciprocal_exact(100000, kRecip1e5, 48, kTsPerDay));
+static_assert(reciprocal_exact(100, kRecip100, 19, 10000));
+
+// Scalar decode of [i, e); returns the day of the last row.
+inline uint32_t decode_ts_scalar(const uint64_t* ts, size_t i, size_t e,
+                                 uint32_t* day, int32_t* ms, uint32_t cur) {
+  for (; i < e; ++i) {
+    const DayMs t = to_day_ms(ts[i]);
+    day[i] = cur = t.day();
+    ms[i] = t.ms();
+  }
+  return cur;
+}
+
+#if defined(NBBO_TS_DECODE_X86)
+__attribute__((target("avx2"))) inline void decode_ts_avx2(
+    const uint64_t* ts, size_t n, uint32_t* day, int32_t* ms) {
+  uint32_t cur = static_cast<uint32_t>(ts[0] / kTsPerDay);
+  const __m256i r1e5 = _mm256_set1_epi64x(kRecip1e5);
+  const __m256i r100 = _mm256_set1_epi64x(kRecip100);
+  const __m256i k60 = _mm256_set1_epi64x(60);
+  const __m256i k40000 = _mm256_set1_epi64x(40000);
+  const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    // Signed compares: timestamps stay far below 2^63, anything else fails.
+    const int64_t base = static_cast<int64_t>(uint64_t{cur} * kTsPerDay);
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ts + i));
+    const __m256i lo = _mm256_set1_epi64x(base - 1);
+    const __m256i hi = _mm256_set1_epi64x(base + static_cast<int64_t>(kTsPerDay));
+    const __m256i in = _mm256_and_si256(_mm256_cmpgt_epi64(v, lo), _mm256_cmpgt_epi64(hi, v));
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(in)) != 0xF) {
+      cur = decode_ts_scalar(ts, i, i + 4, day, ms, cur);
+      continue;
+    }
+    const __m256i t = _mm256_sub_epi64(v, _mm256_set1_epi64x(base));
+    const __m256i hhmm = _mm256_srli_epi64(_mm256_mul_epu32(t, r1e5), 48);
+    const __m256i hh = _mm256_srli_epi64(_mm256_mul_epu32(hhmm, r100), 19);
+    const __m256i k = _mm256_add_epi64(hhmm, _mm256_mul_epu32(hh, k60));
+    const __m256i m = _mm256_sub_epi64(t, _mm256_mul_epu32(k, k40000));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ms + i),
+                     _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(m, even)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(day + i),
+                     _mm_set1_epi32(static_cast<int>(cur)));
+  }
+  decode_ts_scalar(ts, i, n, day, ms, cur);
+}
+
+// GCC 12 flags the _mm512_undefined_* placeholders in its own intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) inline void decode_ts_avx512(
+    const uint64_t* ts, size_t n, uint32_t* day, int32_t* ms) {
+  uint32_t cur = static_cast<uint32_t>(ts[0] / kTsPerDay);
+  const __m512i r1e5 = _mm512_set1_epi64(kRecip1e5);
+  const __m512i r100 = _mm512_set1_epi64(kRecip100);
+  const __m512i k60 = _mm512_set1_epi64(60);
+  const __m512i k40000 = _mm512_set1_epi64(40000);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const uint64_t base = uint64_t{cur} * kTsPerDay;
+    const __m512i v = _mm512_loadu_si512(ts + i);
+    const __mmask8 in = _mm512_cmpge_epu64_mask(v, _mm512_set1_epi64(static_cast<int64_t>(base))) &
+                        _mm512_cmplt_epu64_mask(v, _mm512_set1_epi64(static_cast<int64_t>(base + kTsPerDay)));
+    if (in != 0xFF) {
+      cur = decode_ts_scalar(ts, i, i + 8, day, ms, cur);
+      continue;
+    }
+    const __m512i t = _mm512_sub_epi64(v, _mm512_set1_epi64(static_cast<int64_t>(base)));
+    const __m512i hhmm = _mm512_srli_epi64(_mm512_mul_epu32(t, r1e5), 48);
+    const __m512i hh = _mm512_srli_epi64(_mm512_mul_epu32(hhmm, r100), 19);
+    const __m512i k = _mm512_add_epi64(hhmm, _mm512_mul_epu32(hh, k60));
+    const __m512i m = _mm512_sub_epi64(t, _mm512_mul_epu32(k, k40000));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ms + i), _mm512_cvtepi64_epi32(m));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(day + i),
+                        _mm256_set1_epi32(static_cast<int>(cur)));
+  }
+  decode_ts_scalar(ts, i, n, day, ms, cur);
+}
+#pragma GCC diagnostic pop
+#endif
+
+}  // namespace detail
+
+// day[i], ms[i] = to_day_ms(ts[i]) for i < n. Any value decodes the way
+// to_day_ms would decode it (null slots included), so results do not depend
+// on the kernel.
+inline void decode_ts(const uint64_t* ts, size_t n, uint32_t* day, int32_t* ms,
+                      TsDecodeIsa isa = ts_decode_isa()) {
+  if (n == 0) return;
+#if defined(NBBO_TS_DECODE_X86)
+  if (isa == TsDecodeIsa::kAvx512) return detail::decode_ts_avx512(ts, n, day, ms);
+  if (isa == TsDecodeIsa::kAvx2) return detail::decode_ts_avx2(ts, n, day, ms);
+#endif
+  (void)isa;
+  detail::decode_ts_scalar(ts, 0, n, day, ms, 0);
+}
+
+// Reusable day / ms-of-day columns for one batch at a time.
+struct DecodedTs {
+  std::vector<uint32_t> day;
+  std::vector<int32_t> ms;
+
+  void decode(const uint64_t* ts, size_t n) {
+    if (day.size() < n) {
+      day.resize(n);
+      ms.resize(n);
+    }
+    decode_ts(ts, n, day.data(), ms.data());
+  }
+};
+
+}  // namespace nbbo
@@ -10,15 +10,7 @@ THRESHOLD_NEXT="1.0"
 
 mkdir -p "$OUT_DIR"
 
-declare -a YEARS=("2018" "2019" "2020" "2021" "2022" "2023")
-
-for Y in "${YEARS[@]}"; do
-  IN="$IN_DIR/SPY_${Y}.parquet"
-  OUT="$OUT_DIR/SPY_${Y}_events.parquet"
-
-  echo "[events] \"$IN\" -> \"$OUT\" threshold_next=\$$THRESHOLD_NEXT"
-  "$BIN" \
-      --in "$IN" \
-      --out "$OUT" \
-      --threshold-next "$THRESHOLD_NEXT"
-done
+# All years in one process; files and their days share one worker pool.
+echo "[events] \"$IN_DIR\" -> \"$OUT_DIR\" SPY 2018-2023 threshold_next=\$$THRESHOLD_NEXT"
+"$BIN" --in "$IN_DIR" --out "$OUT_DIR" --sym SPY --years 2018:2023 \
+  --threshold-next "$THRESHOLD_NEXT"
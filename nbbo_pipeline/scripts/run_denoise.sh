@@ -10,11 +10,7 @@ THR="100"
 
 mkdir -p "$OUT_DIR"
 
-declare -a YEARS=("2018" "2019" "2020" "2021" "2022" "2023")
-
-for Y in "${YEARS[@]}"; do
-  IN="$IN_DIR/SPY_${Y}.parquet"
-  OUT="$OUT_DIR/SPY_${Y}.parquet"
-  echo "[denoise] \"$IN\" -> \"$OUT\" threshold=\$$THR"
-  "$BIN" --in "$IN" --out "$OUT" --thr "$THR" --progress 10000000
-done
+# All years in one process, one file per worker thread.
+echo "[denoise] \"$IN_DIR\" -> \"$OUT_DIR\" SPY 2018-2023 threshold=\$$THR"
+"$BIN" --in "$IN_DIR" --out "$OUT_DIR" --sym SPY --years 2018:2023 \
+  --thr "$THR" --progress 10000000
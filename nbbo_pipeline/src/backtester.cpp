@@ -11,19 +11,21 @@
 #include <vector>
 
 #include "nbbo/arrow_utils.hpp"
+#include "nbbo/schema.hpp"
+#include "nbbo/time_utils.hpp"
 
 namespace nbbo {
 namespace {
 
-using UInt64Array = arrow::UInt64Array;
 using UInt32Array = arrow::UInt32Array;
-using DoubleArray = arrow::DoubleArray;
 
 // A small RAII wrapper that streams LabeledEvent rows from a Parquet file.
 //
 // Invariants:
 //  - Constructor verifies the schema has the expected columns and projects
-//    only those columns.
+//    only those columns. Both events layouts are read (nbbo/schema.hpp):
+//    version 1 has a date column and float64 signs / ms quantities, version 2
+//    derives the day from ts and stores int8 / int32.
 //  - next(ev) returns true and fully-populates ev, or returns false at EOF.
 class LabeledEventStream {
  public:
@@ -43,17 +45,22 @@ class LabeledEventStream {
   int64_t row_index_ = 0;
   int64_t row_count_ = 0;
 
+  bool has_date_ = false;  // version 1 files carry a date column
+
   // Column views for the current batch (projected in a fixed order).
-  std::shared_ptr<UInt64Array> ts_arr_;
-  std::shared_ptr<UInt32Array> day_arr_;
-  std::shared_ptr<DoubleArray> mid_arr_;
-  std::shared_ptr<DoubleArray> mid_next_arr_;
-  std::shared_ptr<DoubleArray> spread_arr_;
-  std::shared_ptr<DoubleArray> imb_arr_;
-  std::shared_ptr<DoubleArray> age_arr_;
-  std::shared_ptr<DoubleArray> last_move_arr_;
-  std::shared_ptr<DoubleArray> y_arr_;
-  std::shared_ptr<DoubleArray> tau_arr_;
+  const uint64_t* ts_ = nullptr;
+  std::shared_ptr<UInt32Array> day_arr_;  // nullptr without a date column
+  // Prices: int32 Px (current) or float64 dollars (legacy); read via PxAt.
+  std::shared_ptr<arrow::Array> mid_arr_;
+  std::shared_ptr<arrow::Array> mid_next_arr_;
+  std::shared_ptr<arrow::Array> spread_arr_;
+  // Feature / label columns of either layout as double, per batch.
+  const double* imb_ = nullptr;
+  const double* age_ = nullptr;
+  const double* last_move_ = nullptr;
+  const double* y_ = nullptr;
+  const double* tau_ = nullptr;
+  std::vector<double> scratch_[5];
 
   void reset_batch();
   bool load_next_nonempty_batch();
@@ -64,7 +71,10 @@ LabeledEventStream::LabeledEventStream(const std::string& events_path)
   // Open parquet reader and fetch schema (RAII: reader_ owns file resource).
   reader_ = open_parquet_reader(events_path, schema_);
 
-  // Look up required columns by name in the schema.
+  // Rejects files written by a newer build_events.
+  events_schema_version(*schema_);
+
+  // Look up required columns by name in the schema; date is optional.
   const int ts_idx        = schema_->GetFieldIndex("ts");
   const int day_idx       = schema_->GetFieldIndex("date");
   const int mid_idx       = schema_->GetFieldIndex("mid");
@@ -76,7 +86,7 @@ LabeledEventStream::LabeledEventStream(const std::string& events_path)
   const int y_idx         = schema_->GetFieldIndex("y");
   const int tau_idx       = schema_->GetFieldIndex("tau_ms");
 
-  if (ts_idx < 0 || day_idx < 0 || mid_idx < 0 || mid_next_idx < 0 ||
+  if (ts_idx < 0 || mid_idx < 0 || mid_next_idx < 0 ||
       spread_idx < 0 || imb_idx < 0 || age_idx < 0 ||
       last_move_idx < 0 || y_idx < 0 || tau_idx < 0) {
     throw std::runtime_error(
@@ -85,8 +95,10 @@ LabeledEventStream::LabeledEventStream(const std::string& events_path)
 
   // Project only the columns we need, in a fixed order.
   std::vector<int> col_indices = {
-      ts_idx, day_idx, mid_idx, mid_next_idx, spread_idx,
+      ts_idx, mid_idx, mid_next_idx, spread_idx,
       imb_idx, age_idx, last_move_idx, y_idx, tau_idx};
+  has_date_ = day_idx >= 0;
+  if (has_date_) col_indices.push_back(day_idx);
 
   auto maybe_reader = reader_->GetRecordBatchReader(col_indices);
   if (!maybe_reader.ok()) {
@@ -105,16 +117,12 @@ void LabeledEventStream::reset_batch() {
   row_index_ = 0;
   row_count_ = 0;
 
-  ts_arr_.reset();
+  ts_ = nullptr;
   day_arr_.reset();
   mid_arr_.reset();
   mid_next_arr_.reset();
   spread_arr_.reset();
-  imb_arr_.reset();
-  age_arr_.reset();
-  last_move_arr_.reset();
-  y_arr_.reset();
-  tau_arr_.reset();
+  imb_ = age_ = last_move_ = y_ = tau_ = nullptr;
 }
 
 bool LabeledEventStream::load_next_nonempty_batch() {
@@ -144,16 +152,18 @@ bool LabeledEventStream::load_next_nonempty_batch() {
     row_index_ = 0;
 
     // Columns come in the same order as col_indices in the constructor.
-    ts_arr_        = std::static_pointer_cast<UInt64Array>(batch_->column(0));
-    day_arr_       = std::static_pointer_cast<UInt32Array>(batch_->column(1));
-    mid_arr_       = std::static_pointer_cast<DoubleArray>(batch_->column(2));
-    mid_next_arr_  = std::static_pointer_cast<DoubleArray>(batch_->column(3));
-    spread_arr_    = std::static_pointer_cast<DoubleArray>(batch_->column(4));
-    imb_arr_       = std::static_pointer_cast<DoubleArray>(batch_->column(5));
-    age_arr_       = std::static_pointer_cast<DoubleArray>(batch_->column(6));
-    last_move_arr_ = std::static_pointer_cast<DoubleArray>(batch_->column(7));
-    y_arr_         = std::static_pointer_cast<DoubleArray>(batch_->column(8));
-    tau_arr_       = std::static_pointer_cast<DoubleArray>(batch_->column(9));
+    ts_           = TsValues(batch_->column(0));
+    mid_arr_      = batch_->column(1);
+    mid_next_arr_ = batch_->column(2);
+    spread_arr_   = batch_->column(3);
+    imb_          = DoubleValues(batch_->column(4), scratch_[0]);
+    age_          = DoubleValues(batch_->column(5), scratch_[1]);
+    last_move_    = DoubleValues(batch_->column(6), scratch_[2]);
+    y_            = DoubleValues(batch_->column(7), scratch_[3]);
+    tau_          = DoubleValues(batch_->column(8), scratch_[4]);
+    if (has_date_) {
+      day_arr_ = std::static_pointer_cast<UInt32Array>(batch_->column(9));
+    }
     return true;
   }
 }
@@ -168,16 +178,16 @@ bool LabeledEventStream::next(LabeledEvent& ev) {
 
   const int64_t i = row_index_++;
 
-  ev.ts          = ts_arr_->Value(i);
-  ev.day         = day_arr_->Value(i);
-  ev.mid         = mid_arr_->Value(i);
-  ev.mid_next    = mid_next_arr_->Value(i);
-  ev.spread      = spread_arr_->Value(i);
-  ev.imbalance   = imb_arr_->Value(i);
-  ev.age_diff_ms = age_arr_->Value(i);
-  ev.last_move   = last_move_arr_->Value(i);
-  ev.y           = y_arr_->Value(i);
-  ev.tau_ms      = tau_arr_->Value(i);
+  ev.ts          = ts_[i];
+  ev.day         = day_arr_ ? day_arr_->Value(i) : ymd(ev.ts);
+  ev.mid         = PxAt(mid_arr_, i);
+  ev.mid_next    = PxAt(mid_next_arr_, i);
+  ev.spread      = PxAt(spread_arr_, i);
+  ev.imbalance   = imb_[i];
+  ev.age_diff_ms = age_[i];
+  ev.last_move   = last_move_[i];
+  ev.y           = y_[i];
+  ev.tau_ms      = tau_[i];
 
   return true;
 }
@@ -198,7 +208,7 @@ std::optional<TradeRecord> HistogramEdgeStrategy::OnEvent(
   }
 
   // Guard against bad data.
-  if (ev.mid <= 0.0 || ev.spread <= 0.0) {
+  if (ev.mid <= 0 || ev.spread <= 0) {
     return std::nullopt;
   }
 
@@ -218,11 +228,17 @@ std::optional<TradeRecord> HistogramEdgeStrategy::OnEvent(
     return std::nullopt;
   }
 
+  // Prices are Px; ratios of two Px need no scaling, dollar amounts
+  // (fee, slippage) are divided by the mid in dollars.
+  const double mid_px    = static_cast<double>(ev.mid);
+  const double mid_usd   = px_to_double(ev.mid);
+  const double spread_px = static_cast<double>(ev.spread);
+
   // Expected edge from histogram, in return space per $1 notional.
   // We approximate a one-tick mid move as spread / 2.
-  const double delta_m = 0.5 * ev.spread;
+  const double delta_m = 0.5 * spread_px;
   const double expected_edge_ret =
-      direction_score * (delta_m / ev.mid);
+      direction_score * (delta_m / mid_px);
 
   // Costs, initialized to zero so Legacy mode can keep them off.
   double c_spread = 0.0;
@@ -232,9 +248,9 @@ std::optional<TradeRecord> HistogramEdgeStrategy::OnEvent(
 
   // Shared cost computation for the “cost on” modes.
   auto compute_costs = [&] {
-    c_spread = ev.spread / ev.mid;
-    c_fee    = 2.0 * cfg_.fee_price / ev.mid;  // in/out legs
-    c_slip   = cfg_.slip_price / ev.mid;
+    c_spread = spread_px / mid_px;
+    c_fee    = 2.0 * cfg_.fee_price / mid_usd;  // in/out legs
+    c_slip   = cfg_.slip_price / mid_usd;
     cost_ret = c_spread + c_fee + c_slip;
   };
 
@@ -290,7 +306,7 @@ std::optional<TradeRecord> HistogramEdgeStrategy::OnEvent(
 
   // Realized price move over one step, converted to return.
   const double gross_ret =
-      side * ((next_event->mid - ev.mid) / ev.mid);
+      side * (static_cast<double>(next_event->mid - ev.mid) / mid_px);
 
   // Net return after applying all costs in return space.
   const double net_ret = gross_ret - cost_ret;
@@ -300,9 +316,9 @@ std::optional<TradeRecord> HistogramEdgeStrategy::OnEvent(
   trade.ts_in             = ev.ts;
   trade.ts_out            = next_event->ts;
   trade.day               = ev.day;
-  trade.mid_in            = ev.mid;
-  trade.mid_out           = next_event->mid;
-  trade.spread_in         = ev.spread;
+  trade.mid_in            = mid_usd;
+  trade.mid_out           = px_to_double(next_event->mid);
+  trade.spread_in         = px_to_double(ev.spread);
   trade.direction_score   = direction_score;
   trade.expected_edge_ret = expected_edge_ret;
   trade.cost_ret          = cost_ret;
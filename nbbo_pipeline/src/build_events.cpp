@@ -1,17 +1,31 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "nbbo/build_events_config.hpp"
 #include "nbbo/event_table_builder.hpp"
+#include "nbbo/task_pool.hpp"
+#include "nbbo/timing.hpp"
+
+namespace fs = std::filesystem;
 
 static void usage_and_exit(const char* argv0) {
   std::fprintf(stderr,
                R"(Usage:
   %s --in <input_clean.parquet> --out <events.parquet>
-       [--threshold-next <dollars>]
-
+       [--threshold-next <dollars>] [--workers N]
+       [--horizons LIST] [--writer-batch-rows N] [--sync-writer]
+  %s --in <dir> --out <dir> [--sym SYM] [--years Y0:Y1] [--workers N] [...]
+%s
 Description:
   Reads a cleaned per-ms NBBO Parquet file (event grid) and constructs
   per-mid-change events on each day. For each mid-change event `t`
@@ -32,19 +46,50 @@ Description:
     - The last mid-change of each day (no next move on same day)
     - Any event where |mid_next_t - mid_t| > threshold-next
 
+  --horizons adds labels at other horizons in the same pass, e.g.
+  --horizons 5,10ms,100ms,1s. N (or kN) is the N-th next mid change of the
+  day; Nms / Ns is the mid standing that long after the event. Each horizon
+  h adds mid_next_h, y_h and tau_h (ms to the change that set mid_next_h),
+  null where the day ends first; threshold-next still decides which events
+  are written.
+
+  Days are independent, so the input is cut into runs of row groups that
+  start on a new day (found from the ts column statistics) and the runs are
+  built concurrently on --workers threads (default: all cores), then
+  written in order. With a directory, every *.parquet in it (narrowed with
+  --sym SYM and --years Y0:Y1) becomes <name>_events.parquet in --out; all
+  files share the one pool.
+
+  Events are written in batches of --writer-batch-rows rows (default: the
+  row-group size), each encoded by a task on the same pool while the next
+  batch fills; --sync-writer encodes them on the building thread instead.
+
 Example:
   %s --in data/out/event_clean/SPY_2020.parquet \
      --out data/research/events/SPY_2020_events.parquet \
      --threshold-next 1.0
+  %s --in data/out/event_clean --out data/research/events \
+     --sym SPY --years 2018:2023
 )",
-               argv0, argv0);
+               argv0, argv0, nbbo::kParquetWriterUsage, argv0, argv0);
   std::exit(2);
 }
 
-static BuildEventsConfig parse_args(int argc, char** argv) {
-  // Minimal command-line parser that populates BuildEventsConfig.
 
+struct Args {
+  // in_path / out_path are files, or directories for many files
   BuildEventsConfig cfg;
+  std::string sym;
+  int year_lo = 0;
+  int year_hi = 0;
+  int workers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+};
+
+static Args parse_args(int argc, char** argv) {
+  // Minimal command-line parser that populates BuildEventsConfig.
+
+  Args args;
+  BuildEventsConfig& cfg = args.cfg;
 
   for (int i = 1; i < argc; ++i) {
     std::string a = argv[i];
@@ -54,8 +99,40 @@ static BuildEventsConfig parse_args(int argc, char** argv) {
       cfg.out_path = argv[++i];
     } else if (a == "--threshold-next" && i + 1 < argc) {
       cfg.threshold_next = std::stod(argv[++i]);
+    } else if (a == "--sym" && i + 1 < argc) {
+      args.sym = argv[++i];
+    } else if (a == "--workers" && i + 1 < argc) {
+      args.workers = std::max(1, std::atoi(argv[++i]));
+    } else if (a == "--years" && i + 1 < argc) {
+      const std::string v = argv[++i];
+      const size_t c = v.find(':');
+      try {
+        args.year_lo = std::stoi(v.substr(0, c));
+        args.year_hi = c == std::string::npos ? args.year_lo
+                                              : std::stoi(v.substr(c + 1));
+      } catch (...) {
+        std::fprintf(stderr, "--years: expected Y0:Y1\n");
+        usage_and_exit(argv[0]);
+      }
+    } else if (a == "--horizons" && i + 1 < argc) {
+      try {
+        cfg.horizons = parse_event_horizons(argv[++i]);
+      } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        usage_and_exit(argv[0]);
+      }
+    } else if (a == "--writer-batch-rows" && i + 1 < argc) {
+      cfg.writer.batch_rows = std::stoll(argv[++i]);
+      if (cfg.writer.batch_rows <= 0) {
+        std::fprintf(stderr, "--writer-batch-rows must be > 0\n");
+        usage_and_exit(argv[0]);
+      }
+    } else if (a == "--sync-writer") {
+      cfg.writer.async = false;
     } else if (a == "--help" || a == "-h") {
       usage_and_exit(argv[0]);
+    } else if (nbbo::parse_parquet_writer_arg(argc, argv, i, cfg.parquet)) {
+      // codec / encoding / row-group flags
     } else {
       std::fprintf(stderr, "Unknown or incomplete arg: %s\n", a.c_str());
       usage_and_exit(argv[0]);
@@ -66,26 +143,139 @@ static BuildEventsConfig parse_args(int argc, char** argv) {
     usage_and_exit(argv[0]);
   }
 
-  return cfg;
+  return args;
+}
+
+// Year from a SYM_YYYY.parquet name, or -1.
+static int year_of(const fs::path& p) {
+  const std::string stem = p.stem().string();
+  const size_t us = stem.rfind('_');
+  if (us == std::string::npos || stem.size() - us != 5) return -1;
+  int y = 0;
+  for (size_t i = us + 1; i < stem.size(); ++i) {
+    if (stem[i] < '0' || stem[i] > '9') return -1;
+    y = y * 10 + (stem[i] - '0');
+  }
+  return y;
+}
+
+// (input, output) pairs: the file itself, or the selected files of a
+// directory as <name>_events.parquet in --out.
+static std::vector<std::pair<std::string, std::string>> list_jobs(
+    const Args& args) {
+  std::vector<std::pair<std::string, std::string>> jobs;
+  if (!fs::is_directory(args.cfg.in_path)) {
+    jobs.emplace_back(args.cfg.in_path, args.cfg.out_path);
+    return jobs;
+  }
+  for (const auto& e : fs::directory_iterator(args.cfg.in_path)) {
+    const fs::path& p = e.path();
+    if (!e.is_regular_file() || p.extension() != ".parquet") continue;
+    const int y = year_of(p);
+    if (!args.sym.empty() &&
+        (y < 0 || p.stem().string() != args.sym + "_" + std::to_string(y))) {
+      continue;
+    }
+    if (args.year_lo && (y < args.year_lo || y > args.year_hi)) continue;
+    const fs::path out =
+        fs::path(args.cfg.out_path) / (p.stem().string() + "_events.parquet");
+    jobs.emplace_back(p.string(), out.string());
+  }
+  std::sort(jobs.begin(), jobs.end());
+  if (!jobs.empty()) fs::create_directories(args.cfg.out_path);
+  return jobs;
 }
 
 int main(int argc, char** argv) {
   // Parse args and run the event builder pipeline
-  BuildEventsConfig cfg = parse_args(argc, argv);
+  using Clock = std::chrono::steady_clock;
+  const auto start = Clock::now();
 
+  Args args;
+  std::vector<std::pair<std::string, std::string>> jobs;
   try {
-    // EventTableBuilder performs the following:
-    // - Reads the cleaned nbbo files
-    // - Detects mid-change events
-    // - Generates and labels features (events)
-    // - Writes final output to parquet file
-
-    EventTableBuilder builder(cfg);
-    builder.run();
-
+    args = parse_args(argc, argv);
+    jobs = list_jobs(args);
   } catch (const std::exception& e) {
     std::fprintf(stderr, "FATAL: %s\n", e.what());
     return 1;
   }
-  return 0;
+  if (jobs.empty()) {
+    std::fprintf(stderr, "no matching .parquet files in %s\n",
+                 args.cfg.in_path.c_str());
+    return 1;
+  }
+
+  // EventTableBuilder performs the following for each file:
+  // - Reads the cleaned nbbo file, one task per run of days on the pool
+  // - Detects mid-change events
+  // - Generates and labels features (events)
+  // - Writes final output to parquet file, in timestamp order
+  //
+  // Files are tasks on the same pool, so a few large years and the day runs
+  // inside them all share --workers threads.
+  int rc = 0;
+  std::mutex log_mu;
+  DayEventBuilder::Counts all;
+  {
+    nbbo::TaskPool pool(args.workers);
+    nbbo::TaskGroup files(pool);
+    for (const auto& [in, out] : jobs) {
+      files.run([&, in = in, out = out] {
+        BuildEventsConfig cfg = args.cfg;
+        cfg.in_path = in;
+        cfg.out_path = out;
+        try {
+          EventTableBuilder builder(cfg, pool, log_mu);
+          builder.run();
+          std::lock_guard<std::mutex> lk(log_mu);
+          all.add(builder.counts());
+        } catch (const std::exception& e) {
+          std::lock_guard<std::mutex> lk(log_mu);
+          std::fprintf(stderr, "FATAL: %s: %s\n", in.c_str(), e.what());
+          rc = 1;
+        }
+      });
+    }
+    files.wait();
+  }
+  if (jobs.size() > 1) {
+    std::cout << "=== total (" << jobs.size() << " files) ===\n";
+    std::cout << "  ticks_total = " << all.ticks_total << "\n";
+    std::cout << "  events_written = " << all.events_written << "\n";
+  }
+
+  // Wall-clock timing for the whole invocation.
+  nbbo::TimingRegistry::Instance().Add("build_events::wall_clock",
+                                       Clock::now() - start);
+
+  // Build args summary for the timing log.
+  std::vector<std::string> targs;
+  targs.emplace_back("in=" + args.cfg.in_path);
+  targs.emplace_back("out=" + args.cfg.out_path);
+  if (!args.sym.empty()) targs.emplace_back("sym=" + args.sym);
+  if (args.year_lo) {
+    targs.emplace_back("years=" + std::to_string(args.year_lo) + ":" +
+                       std::to_string(args.year_hi));
+  }
+  targs.emplace_back("workers=" + std::to_string(args.workers));
+  targs.emplace_back("threshold_next=" +
+                     std::to_string(args.cfg.threshold_next));
+  if (!args.cfg.horizons.empty()) {
+    std::string hs;
+    for (const auto& h : args.cfg.horizons) {
+      hs += (hs.empty() ? "" : ",") + h.name();
+    }
+    targs.emplace_back("horizons=" + hs);
+  }
+  targs.emplace_back("parquet=" + args.cfg.parquet.describe());
+  targs.emplace_back(
+      "writer=" + std::string(args.cfg.writer.async ? "async" : "sync") +
+      (args.cfg.writer.batch_rows
+           ? "/" + std::to_string(args.cfg.writer.batch_rows)
+           : std::string()));
+
+  const std::string timing_path = "data/research/profile/timing_log.txt";
+  nbbo::WriteTimingReport(timing_path, "EventTableBuilder::run", targs);
+  return rc;
 }
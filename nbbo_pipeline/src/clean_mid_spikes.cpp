@@ -11,37 +11,50 @@
 #include <cstring>
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <memory>
 #include <iostream>
+#include <sstream>
 #include <filesystem>
 #include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
 #include "nbbo/arrow_utils.hpp"
+#include "nbbo/parquet_writer_config.hpp"
+#include "nbbo/price.hpp"
+#include "nbbo/task_pool.hpp"
 #include "nbbo/time_utils.hpp"
 #include "nbbo/timing.hpp"
+#include "nbbo/ts_decode.hpp"
 
-using arrow::Status;
-using arrow::Result;
+namespace fs = std::filesystem;
 
 static void usage_and_exit(const char* argv0) {
     std::fprintf(stderr,
 R"(Usage:
   %s --in <input.parquet> --out <output.parquet> [--thr <dollars>] [--progress <rows>]
-
+  %s --in <dir> --out <dir> [--sym SYM] [--years Y0:Y1] [--workers N] [...]
+%s
 Description:
   Removes intra-day mid-price jumps with |Δmid| >= threshold (default 100)
-  and any rows where the mid price itself exceeds 1000.
+  and any rows where the mid-price itself exceeds 1000.
   The Δmid is computed versus the last *kept* tick within the same day.
   First tick of each day is always tested only against the level filter;
   inter-day jumps are allowed.
 
+  With a directory, every *.parquet in it is cleaned into --out under the
+  same name, --workers files at a time (default: all cores). --sym keeps
+  SYM_YYYY.parquet files only, --years those whose name ends in _YYYY
+  within [Y0, Y1].
+
 Example:
   %s --in data/out/event/SPY_2020.parquet \
      --out data/out/event_clean_thr100/SPY_2020.parquet --thr 100
+  %s --in data/out/event --out data/out/event_clean --sym SPY --years 2018:2023
 )",
-    argv0, argv0);
+    argv0, argv0, nbbo::kParquetWriterUsage, argv0, argv0);
     std::exit(2);
 }
 
@@ -49,275 +62,433 @@ struct SpikeExample {
     uint32_t day;
     uint64_t ts_prev;
     uint64_t ts_curr;
-    double   mid_prev;
-    double   mid_curr;
-    double   delta;
+    nbbo::Px mid_prev;
+    nbbo::Px mid_curr;
+    nbbo::Px delta;
 };
 
-int main(int argc, char** argv) {
-    using Clock = std::chrono::steady_clock;
-    const auto program_start = Clock::now();
+// Kept / removed rows per trading day. Rows arrive sorted, so the current
+// day's slot is reused until the day changes; a new day is looked up from
+// the back and appended if unseen.
+struct DayCounts {
+    struct Day { uint32_t day; uint64_t kept = 0, removed = 0; };
+    std::vector<Day> days;
+    size_t cur = SIZE_MAX;
+
+    Day& at(uint32_t d) {
+        if (cur != SIZE_MAX && days[cur].day == d) return days[cur];
+        for (cur = days.size(); cur-- > 0;) {
+            if (days[cur].day == d) return days[cur];
+        }
+        days.push_back(Day{d});
+        cur = days.size() - 1;
+        return days[cur];
+    }
+};
+
+// A row group is filtered with one gather once more than 1 row in this many
+// is dropped; below that its kept runs are written as slices.
+static constexpr int64_t kGatherDropRate = 64;
 
-    std::string in_path, out_path;
+struct CleanConfig {
     double threshold = 100.0;           // delete rows with |Δmid| >= threshold
+    double mid_max = 1000.0;            // delete rows with mid > mid_max
+    nbbo::Px threshold_px = 0;
+    nbbo::Px mid_max_px = 0;
     int64_t progress_every = 10'000'000;
-    const double MID_MAX = 1000.0;      // delete rows with mid > MID_MAX
-    const std::size_t MAX_EXAMPLES = 10;
+    nbbo::ParquetWriterConfig pq;       // output codec / encodings / row groups
+};
 
-    for (int i = 1; i < argc; ++i) {
-        std::string a = argv[i];
-        if (a == "--in" && i + 1 < argc) in_path = argv[++i];
-        else if (a == "--out" && i + 1 < argc) out_path = argv[++i];
-        else if (a == "--thr" && i + 1 < argc) threshold = std::stod(argv[++i]);
-        else if (a == "--progress" && i + 1 < argc) progress_every = std::stoll(argv[++i]);
-        else if (a == "--help" || a == "-h") usage_and_exit(argv[0]);
-        else { std::fprintf(stderr, "Unknown or incomplete arg: %s\n", a.c_str()); usage_and_exit(argv[0]); }
-    }
-    if (in_path.empty() || out_path.empty()) usage_and_exit(argv[0]);
+struct CleanTotals {
+    uint64_t rows_in = 0, rows_out = 0, removed = 0;
+    uint64_t removed_by_delta = 0, removed_by_level = 0;
+};
 
-    // Main-timer scope for all the heavy lifting.
-    {
-        NBBO_SCOPE_TIMER("clean_mid_spikes_main");
+static void check(const arrow::Status& st, const char* what) {
+    if (!st.ok()) throw std::runtime_error(std::string(what) + " failed: " + st.ToString());
+}
 
-        try {
-            std::filesystem::create_directories(std::filesystem::path(out_path).parent_path());
-        } catch (...) {}
+// The column's values as one array (a row group read can come back chunked).
+static std::shared_ptr<arrow::Array> single_chunk(const std::shared_ptr<arrow::ChunkedArray>& c) {
+    if (c->num_chunks() == 1) return c->chunk(0);
+    auto r = arrow::Concatenate(c->chunks());
+    if (!r.ok()) throw std::runtime_error("Concatenate failed: " + r.status().ToString());
+    return *r;
+}
 
-        // Input
-        std::shared_ptr<arrow::Schema> schema;
-        std::unique_ptr<parquet::arrow::FileReader> reader;
-        {
-            NBBO_SCOPE_TIMER("clean_mid_spikes_open_input");
-            reader = nbbo::open_parquet_reader(in_path, schema);
-        }
-        Status st;
+// Cleans one file. Each row group is read in two projections: `ts` and `mid`
+// first, for the keep mask, then the other columns, which are only filtered
+// and passed through. The report (what a single-file run prints) goes to rep.
+static CleanTotals clean_file(const fs::path& in_path, const fs::path& out_path,
+                              const CleanConfig& cfg, std::ostream& rep, std::mutex& log_mu) {
+    NBBO_SCOPE_TIMER("clean_mid_spikes_file");
+    const std::size_t MAX_EXAMPLES = 10;
+    const std::string tag = in_path.filename().string();
 
-        // Output
-        auto of_res = arrow::io::FileOutputStream::Open(out_path);
-        if (!of_res.ok()) { std::cerr << "open output failed: " << of_res.status().ToString() << "\n"; return 1; }
-        auto outfile = *of_res;
+    try {
+        fs::create_directories(out_path.parent_path());
+    } catch (...) {}
 
-        std::unique_ptr<parquet::arrow::FileWriter> writer;
-        {
-            NBBO_SCOPE_TIMER("clean_mid_spikes_create_writer");
-            auto fw_res = parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(), outfile);
-            if (!fw_res.ok()) { std::cerr << "create writer failed: " << fw_res.status().ToString() << "\n"; return 1; }
-            writer = std::move(fw_res).ValueOrDie();
-        }
+    // Input
+    std::shared_ptr<arrow::Schema> schema;
+    std::unique_ptr<parquet::arrow::FileReader> reader;
+    {
+        NBBO_SCOPE_TIMER("clean_mid_spikes_open_input");
+        reader = nbbo::open_parquet_reader(in_path.string(), schema);
+    }
+    const int ts_idx = schema->GetFieldIndex("ts");
+    const int mid_idx = schema->GetFieldIndex("mid");
+    if (ts_idx < 0 || mid_idx < 0) throw std::runtime_error("input lacks 'ts' or 'mid'");
+    std::vector<int> other_cols;
+    for (int i = 0; i < schema->num_fields(); ++i) {
+        if (i != ts_idx && i != mid_idx) other_cols.push_back(i);
+    }
 
-        // Stream record batches over all row groups and all columns
-        std::vector<int> all_row_groups;
-        {
-            auto* pq_reader = reader->parquet_reader();
-            int nrg = pq_reader->metadata()->num_row_groups();
-            all_row_groups.reserve(nrg);
-            for (int i = 0; i < nrg; ++i) all_row_groups.push_back(i);
-            std::cout << "=== " << in_path << " ===\n";
-            std::cout << "  row_groups=" << nrg << " threshold=$" << threshold
-                      << " mid_max=" << MID_MAX << "\n";
-        }
-        std::vector<int> all_cols(schema->num_fields());
-        for (int i = 0; i < schema->num_fields(); ++i) all_cols[i] = i;
+    // Output
+    auto of_res = arrow::io::FileOutputStream::Open(out_path.string());
+    if (!of_res.ok()) throw std::runtime_error("open output failed: " + of_res.status().ToString());
+    auto outfile = *of_res;
 
-        std::shared_ptr<arrow::RecordBatchReader> rb_reader;
-        {
-            NBBO_SCOPE_TIMER("clean_mid_spikes_get_rb_reader");
-            auto rb_res = reader->GetRecordBatchReader(all_row_groups, all_cols);
-            if (!rb_res.ok()) {
-                std::cerr << "GetRecordBatchReader failed: "
-                          << rb_res.status().ToString() << "\n";
-                return 1;
+    // Row groups follow trading days (capped at 1M rows) unless the
+    // --parquet-* / --row-group-rows flags say otherwise.
+    const nbbo::ParquetWriterConfig& pq = cfg.pq;
+    const int64_t rg_rows = pq.row_group_rows_or(1'000'000);
+    std::unique_ptr<parquet::arrow::FileWriter> writer;
+    {
+        NBBO_SCOPE_TIMER("clean_mid_spikes_create_writer");
+        writer = nbbo::open_parquet_writer(outfile, schema, pq, rg_rows);
+    }
+    nbbo::RowGroupWriter row_groups(writer.get(), schema, rg_rows, pq.row_groups_by_day);
+
+    const int nrg = reader->parquet_reader()->metadata()->num_row_groups();
+    rep << "=== " << in_path.string() << " ===\n";
+    rep << "  row_groups=" << nrg << " threshold=$" << cfg.threshold
+        << " mid_max=" << cfg.mid_max << "\n";
+    rep << "  parquet: " << pq.describe() << "\n";
+
+    CleanTotals tot;
+    uint32_t last_day = 0;
+    uint64_t last_ts = 0;
+    nbbo::Px last_mid = 0;
+    bool have_last = false;
+
+    DayCounts per_day;
+    std::vector<SpikeExample> delta_examples;
+    nbbo::DecodedTs ts_cols, out_days;  // per batch, decoded in one pass
+    std::vector<int64_t> drops;         // row group positions not kept
+
+    // Rows [a, b) of src to the writer, split where the trading day changes
+    // so row groups can end on day boundaries. The whole batch goes as is.
+    auto write_runs = [&](const std::shared_ptr<arrow::RecordBatch>& src, int64_t a, int64_t b,
+                          const uint32_t* day) {
+        while (a < b) {
+            int64_t e = b;
+            if (pq.row_groups_by_day) {
+                for (e = a + 1; e < b && day[e] == day[a]; ++e) {}
             }
-            rb_reader = std::move(rb_res).ValueOrDie();
+            row_groups.write(e - a == src->num_rows() ? src : src->Slice(a, e - a),
+                             pq.row_groups_by_day ? day[a] : 0);
+            a = e;
         }
+    };
 
-        uint64_t total_rows_in = 0, total_rows_out = 0, total_removed = 0;
-        uint64_t removed_by_delta = 0, removed_by_level = 0;
-
-        uint32_t last_day = 0;
-        uint64_t last_ts = 0;
-        double last_mid = 0.0;
-        bool have_last = false;
-
-        std::unordered_map<uint32_t, uint64_t> kept_per_day, removed_per_day;
-        std::vector<SpikeExample> delta_examples;
-
-        {
-            NBBO_SCOPE_TIMER("clean_mid_spikes_process_batches");
-
-            while (true) {
-                std::shared_ptr<arrow::RecordBatch> batch;
-                auto br = rb_reader->ReadNext(&batch);
-                if (!br.ok()) { std::cerr << "ReadNext failed: " << br.ToString() << "\n"; return 1; }
-                if (!batch) break;  // done
-
-                const int64_t n = batch->num_rows();
-                if (n == 0) continue;
-
-                auto ts_arr  = batch->GetColumnByName("ts");
-                auto mid_arr = batch->GetColumnByName("mid");
-                if (!ts_arr || !mid_arr) { std::cerr << "batch missing 'ts' or 'mid'\n"; return 1; }
-
-                arrow::BooleanBuilder keep_builder;
-                auto rs = keep_builder.Reserve(n);
-                if (!rs.ok()) {
-                    std::cerr << "BooleanBuilder::Reserve failed: "
-                              << rs.ToString() << "\n";
-                    return 1;
+    {
+        NBBO_SCOPE_TIMER("clean_mid_spikes_process_batches");
+
+        for (int rg = 0; rg < nrg; ++rg) {
+            // Mask pass: ts and mid only.
+            std::shared_ptr<arrow::Table> key;
+            check(reader->ReadRowGroup(rg, {ts_idx, mid_idx}, &key), "ReadRowGroup");
+            const int64_t n = key->num_rows();
+            if (n == 0) continue;
+            // Leaf indices come back in schema order; pick columns by name.
+            auto ts_arr  = single_chunk(key->GetColumnByName("ts"));
+            auto mid_arr = single_chunk(key->GetColumnByName("mid"));
+
+            drops.clear();
+            const uint64_t* ts_vals = nbbo::TsValues(ts_arr);
+            ts_cols.decode(ts_vals, static_cast<size_t>(n));
+            for (int64_t i = 0; i < n; ++i) {
+                // null handling: drop null ts or null mid
+                if (ts_arr->IsNull(i) || mid_arr->IsNull(i)) {
+                    drops.push_back(i);
+                    continue;
                 }
 
-                for (int64_t i = 0; i < n; ++i) {
-                    // null handling: drop null ts or null mid
-                    if (ts_arr->IsNull(i) || mid_arr->IsNull(i)) {
-                        keep_builder.UnsafeAppend(false);
-                        continue;
+                uint64_t ts = ts_vals[i];
+                nbbo::Px mid = nbbo::PxAt(mid_arr, i);
+
+                uint32_t day = ts_cols.day[i];
+                bool keep = true;
+                bool big_delta = false;
+                bool big_level = (mid > cfg.mid_max_px);
+
+                if (!have_last || day != last_day) {
+                    // New day or no baseline yet: only apply level filter, no Δmid.
+                    if (big_level) {
+                        keep = false;
+                        tot.removed_by_level++;
+                        per_day.at(day).removed++;
+                        // do NOT update baseline; we want the next good tick to become first-of-day
+                        have_last = false;
+                    } else {
+                        keep = true;
+                        per_day.at(day).kept++;
+                        last_day = day;
+                        last_mid = mid;
+                        last_ts  = ts;
+                        have_last = true;
                     }
-
-                    uint64_t ts = nbbo::ValueAt<uint64_t>(ts_arr, i);
-                    double mid  = nbbo::ValueAt<double>(mid_arr, i);
-
-                    uint32_t day = nbbo::day_from_ts(ts);
-                    bool keep = true;
-                    bool big_delta = false;
-                    bool big_level = (mid > MID_MAX);
-
-                    if (!have_last || day != last_day) {
-                        // New day or no baseline yet: only apply level filter, no Δmid.
-                        if (big_level) {
-                            keep = false;
-                            removed_by_level++;
-                            removed_per_day[day]++;
-                            // do NOT update baseline; we want the next good tick to become first-of-day
-                            have_last = false;
-                        } else {
-                            keep = true;
-                            kept_per_day[day]++;
-                            last_day = day;
-                            last_mid = mid;
-                            last_ts  = ts;
-                            have_last = true;
+                } else {
+                    // Same day, we can compute Δmid vs last kept mid.
+                    nbbo::Px delta = mid >= last_mid ? mid - last_mid : last_mid - mid;
+                    big_delta = (delta >= cfg.threshold_px);
+
+                    if (big_delta) {
+                        keep = false;
+                        tot.removed_by_delta++;
+                        per_day.at(day).removed++;
+                        if (delta_examples.size() < MAX_EXAMPLES) {
+                            SpikeExample ex;
+                            ex.day       = day;
+                            ex.ts_prev   = last_ts;
+                            ex.ts_curr   = ts;
+                            ex.mid_prev  = last_mid;
+                            ex.mid_curr  = mid;
+                            ex.delta     = delta;
+                            delta_examples.push_back(ex);
                         }
+                        // do NOT update baseline: last_mid/last_ts stay as last kept tick
+                    } else if (big_level) {
+                        keep = false;
+                        tot.removed_by_level++;
+                        per_day.at(day).removed++;
+                        // also do NOT update baseline
                     } else {
-                        // Same day, we can compute Δmid vs last kept mid.
-                        double delta = std::fabs(mid - last_mid);
-                        big_delta = (delta >= threshold);
-
-                        if (big_delta) {
-                            keep = false;
-                            removed_by_delta++;
-                            removed_per_day[day]++;
-                            if (delta_examples.size() < MAX_EXAMPLES) {
-                                SpikeExample ex;
-                                ex.day       = day;
-                                ex.ts_prev   = last_ts;
-                                ex.ts_curr   = ts;
-                                ex.mid_prev  = last_mid;
-                                ex.mid_curr  = mid;
-                                ex.delta     = delta;
-                                delta_examples.push_back(ex);
-                            }
-                            // do NOT update baseline: last_mid/last_ts stay as last kept tick
-                        } else if (big_level) {
-                            keep = false;
-                            removed_by_level++;
-                            removed_per_day[day]++;
-                            // also do NOT update baseline
-                        } else {
-                            keep = true;
-                            kept_per_day[day]++;
-                            last_mid = mid;
-                            last_ts  = ts;
-                            last_day = day;
-                        }
+                        keep = true;
+                        per_day.at(day).kept++;
+                        last_mid = mid;
+                        last_ts  = ts;
+                        last_day = day;
                     }
+                }
 
-                    keep_builder.UnsafeAppend(keep);
-                    total_rows_in++;
-                    if (!keep) total_removed++;
+                tot.rows_in++;
+                if (!keep) {
+                    drops.push_back(i);
+                    tot.removed++;
                 }
+            }
 
+            const int64_t kept = n - static_cast<int64_t>(drops.size());
+            tot.rows_out += static_cast<uint64_t>(kept);
+            if (kept == 0) continue;
+
+            // The other columns are read once, next to the ts/mid arrays
+            // already in memory, and are not touched row by row.
+            std::vector<std::shared_ptr<arrow::Array>> cols(schema->num_fields());
+            cols[ts_idx] = ts_arr;
+            cols[mid_idx] = mid_arr;
+            if (!other_cols.empty()) {
+                std::shared_ptr<arrow::Table> rest;
+                check(reader->ReadRowGroup(rg, other_cols, &rest), "ReadRowGroup");
+                for (int c : other_cols) cols[c] = single_chunk(rest->GetColumnByName(schema->field(c)->name()));
+            }
+            auto batch = arrow::RecordBatch::Make(schema, n, cols);
+
+            // Kept rows are the runs between drops. Spikes are rare, so the
+            // usual row group is written as is, or as zero-copy slices
+            // around a few drops; only dense drops pay for a gather.
+            if (static_cast<int64_t>(drops.size()) * kGatherDropRate <= n) {
+                int64_t a = 0;
+                for (size_t k = 0; k <= drops.size(); ++k) {
+                    const int64_t b = k < drops.size() ? drops[k] : n;
+                    write_runs(batch, a, b, ts_cols.day.data());
+                    a = b + 1;
+                }
+            } else {
+                arrow::BooleanBuilder keep_builder;
+                check(keep_builder.Reserve(n), "BooleanBuilder::Reserve");
+                for (int64_t i = 0, k = 0; i < n; ++i) {
+                    const bool drop = k < static_cast<int64_t>(drops.size()) && drops[k] == i;
+                    k += drop;
+                    keep_builder.UnsafeAppend(!drop);
+                }
                 std::shared_ptr<arrow::Array> keep_mask;
-                st = keep_builder.Finish(&keep_mask);
-                if (!st.ok()) { std::cerr << "mask finish failed: " << st.ToString() << "\n"; return 1; }
+                check(keep_builder.Finish(&keep_mask), "mask finish");
 
                 arrow::compute::FilterOptions fopts(arrow::compute::FilterOptions::DROP);
                 auto f_res = arrow::compute::Filter(arrow::Datum(batch), arrow::Datum(keep_mask), fopts);
-                if (!f_res.ok()) { std::cerr << "Filter failed: " << f_res.status().ToString() << "\n"; return 1; }
+                if (!f_res.ok()) throw std::runtime_error("Filter failed: " + f_res.status().ToString());
                 auto out_batch = f_res->record_batch();
-                if (!out_batch) {
-                    // if everything dropped, record_batch() can be null-ish; build an empty batch with same schema
-                    out_batch = arrow::RecordBatch::Make(batch->schema(), /*num_rows=*/0, batch->columns());
-                }
+                const int64_t m = out_batch->num_rows();
+                out_days.decode(nbbo::TsValues(out_batch->GetColumnByName("ts")), static_cast<size_t>(m));
+                write_runs(out_batch, 0, m, out_days.day.data());
+            }
 
-                total_rows_out += static_cast<uint64_t>(out_batch->num_rows());
+            if (cfg.progress_every > 0 &&
+                (tot.rows_in % cfg.progress_every) < static_cast<uint64_t>(kept)) {
+                std::lock_guard<std::mutex> lk(log_mu);
+                std::cout << "    [" << tag << "] processed rows: " << tot.rows_in
+                          << " kept: " << tot.rows_out
+                          << " removed: " << tot.removed << "\n";
+            }
+        }
+    }  // end clean_mid_spikes_process_batches
 
-                if (out_batch->num_rows() > 0) {
-                    auto wst = writer->WriteRecordBatch(*out_batch);
-                    if (!wst.ok()) { std::cerr << "WriteRecordBatch failed: " << wst.ToString() << "\n"; return 1; }
-                }
+    // Close writer/stream
+    {
+        NBBO_SCOPE_TIMER("clean_mid_spikes_close_writer");
+        row_groups.flush();
+        check(writer->Close(), "writer close");
+        check(outfile->Close(), "outfile close");
+    }
 
-                if (progress_every > 0 &&
-                    (total_rows_in % progress_every) < static_cast<uint64_t>(out_batch->num_rows())) {
-                    std::cout << "    processed rows: " << total_rows_in
-                              << " kept: " << total_rows_out
-                              << " removed: " << total_removed << "\n";
-                }
-            }
-        }  // end clean_mid_spikes_process_batches
+    // Print per-day removals
+    std::sort(per_day.days.begin(), per_day.days.end(),
+              [](const DayCounts::Day& a, const DayCounts::Day& b) { return a.day < b.day; });
+    rep << "  per-day removed counts:\n";
+    for (const auto& d : per_day.days) {
+        if (d.removed > 0) {
+            rep << "    " << nbbo::day_to_string(d.day)
+                << " removed=" << d.removed
+                << " kept=" << d.kept << "\n";
+        }
+    }
 
-        // Close writer/stream
-        {
-            NBBO_SCOPE_TIMER("clean_mid_spikes_close_writer");
-            auto cls = writer->Close();
-            if (!cls.ok()) { std::cerr << "writer close failed: " << cls.ToString() << "\n"; return 1; }
-            auto ofs = outfile->Close();
-            if (!ofs.ok()) { std::cerr << "outfile close failed: " << ofs.ToString() << "\n"; return 1; }
+    // Print some examples of big Δmid spikes
+    rep << "  sample big-Δmid pairs (|Δmid| >= " << cfg.threshold << "):\n";
+    if (delta_examples.empty()) {
+        rep << "    none\n";
+    } else {
+        for (const auto& ex : delta_examples) {
+            rep << "    day=" << nbbo::day_to_string(ex.day)
+                << " ts_prev=" << ex.ts_prev
+                << " ts_curr=" << ex.ts_curr
+                << " mid_prev=" << nbbo::px_to_double(ex.mid_prev)
+                << " mid_curr=" << nbbo::px_to_double(ex.mid_curr)
+                << " |Δmid|=" << nbbo::px_to_double(ex.delta)
+                << "\n";
         }
+    }
+    return tot;
+}
 
-        // Print per-day removals
-        std::vector<uint32_t> days;
-        days.reserve(kept_per_day.size() + removed_per_day.size());
-        for (auto& kv : kept_per_day)   days.push_back(kv.first);
-        for (auto& kv : removed_per_day) days.push_back(kv.first);
-        std::sort(days.begin(), days.end());
-        days.erase(std::unique(days.begin(), days.end()), days.end());
-
-        std::cout << "  per-day removed counts:\n";
-        for (auto d : days) {
-            uint64_t kept = kept_per_day.count(d) ? kept_per_day[d] : 0;
-            uint64_t removed = removed_per_day.count(d) ? removed_per_day[d] : 0;
-            if (removed > 0) {
-                std::cout << "    " << nbbo::day_to_string(d)
-                          << " removed=" << removed
-                          << " kept=" << kept << "\n";
-            }
+static void print_summary(std::ostream& os, const char* title, const CleanTotals& t) {
+    os << "=== " << title << " ===\n";
+    os << "  in_rows=" << t.rows_in
+       << " out_rows=" << t.rows_out
+       << " removed=" << t.removed
+       << " kept_ratio=" << (t.rows_in ? (double)t.rows_out / (double)t.rows_in : 1.0)
+       << "\n";
+    os << "  removed_by_delta=" << t.removed_by_delta
+       << " removed_by_level=" << t.removed_by_level
+       << "\n";
+}
+
+// Year from a SYM_YYYY.parquet name, or -1.
+static int year_of(const fs::path& p) {
+    const std::string stem = p.stem().string();
+    const size_t us = stem.rfind('_');
+    if (us == std::string::npos || stem.size() - us != 5) return -1;
+    int y = 0;
+    for (size_t i = us + 1; i < stem.size(); ++i) {
+        if (stem[i] < '0' || stem[i] > '9') return -1;
+        y = y * 10 + (stem[i] - '0');
+    }
+    return y;
+}
+
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+    const auto program_start = Clock::now();
+
+    std::string in_path, out_path, sym;
+    int year_lo = 0, year_hi = 0;
+    int workers = (int)std::max(1u, std::thread::hardware_concurrency());
+    CleanConfig cfg;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--in" && i + 1 < argc) in_path = argv[++i];
+        else if (a == "--out" && i + 1 < argc) out_path = argv[++i];
+        else if (a == "--thr" && i + 1 < argc) cfg.threshold = std::stod(argv[++i]);
+        else if (a == "--progress" && i + 1 < argc) cfg.progress_every = std::stoll(argv[++i]);
+        else if (a == "--sym" && i + 1 < argc) sym = argv[++i];
+        else if (a == "--workers" && i + 1 < argc) workers = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--years" && i + 1 < argc) {
+            const std::string v = argv[++i];
+            const size_t c = v.find(':');
+            try {
+                year_lo = std::stoi(v.substr(0, c));
+                year_hi = c == std::string::npos ? year_lo : std::stoi(v.substr(c + 1));
+            } catch (...) { std::fprintf(stderr, "--years: expected Y0:Y1\n"); usage_and_exit(argv[0]); }
+        }
+        else if (a == "--help" || a == "-h") usage_and_exit(argv[0]);
+        else {
+            bool ok = false;
+            try { ok = nbbo::parse_parquet_writer_arg(argc, argv, i, cfg.pq); }
+            catch (const std::exception& e) { std::fprintf(stderr, "%s\n", e.what()); usage_and_exit(argv[0]); }
+            if (!ok) { std::fprintf(stderr, "Unknown or incomplete arg: %s\n", a.c_str()); usage_and_exit(argv[0]); }
         }
+    }
+    if (in_path.empty() || out_path.empty()) usage_and_exit(argv[0]);
 
-        // Print some examples of big Δmid spikes
-        std::cout << "  sample big-Δmid pairs (|Δmid| >= " << threshold << "):\n";
-        if (delta_examples.empty()) {
-            std::cout << "    none\n";
-        } else {
-            for (const auto& ex : delta_examples) {
-                std::cout << "    day=" << nbbo::day_to_string(ex.day)
-                          << " ts_prev=" << ex.ts_prev
-                          << " ts_curr=" << ex.ts_curr
-                          << " mid_prev=" << ex.mid_prev
-                          << " mid_curr=" << ex.mid_curr
-                          << " |Δmid|=" << ex.delta
-                          << "\n";
-            }
+    // Dollar thresholds -> Px once; the per-row tests are integer compares.
+    // Legacy float inputs are converted to Px on read (nbbo::PxAt).
+    cfg.threshold_px = nbbo::px_from_double(cfg.threshold);
+    cfg.mid_max_px   = nbbo::px_from_double(cfg.mid_max);
+
+    // (input, output) pairs: the file itself, or the selected files of a
+    // directory under the same names in --out.
+    std::vector<std::pair<fs::path, fs::path>> jobs;
+    if (fs::is_directory(in_path)) {
+        for (const auto& e : fs::directory_iterator(in_path)) {
+            const fs::path& p = e.path();
+            if (!e.is_regular_file() || p.extension() != ".parquet") continue;
+            const int y = year_of(p);
+            if (!sym.empty() && (y < 0 || p.stem().string() != sym + "_" + std::to_string(y))) continue;
+            if (year_lo && (y < year_lo || y > year_hi)) continue;
+            jobs.emplace_back(p, fs::path(out_path) / p.filename());
         }
+        std::sort(jobs.begin(), jobs.end());
+        if (jobs.empty()) { std::fprintf(stderr, "no matching .parquet files in %s\n", in_path.c_str()); return 1; }
+    } else {
+        jobs.emplace_back(in_path, out_path);
+    }
+
+    // Main-timer scope for all the heavy lifting.
+    int rc = 0;
+    {
+        NBBO_SCOPE_TIMER("clean_mid_spikes_main");
 
-        std::cout << "=== summary ===\n";
-        std::cout << "  in_rows=" << total_rows_in
-                  << " out_rows=" << total_rows_out
-                  << " removed=" << total_removed
-                  << " kept_ratio=" << (total_rows_in ? (double)total_rows_out / (double)total_rows_in : 1.0)
-                  << "\n";
-        std::cout << "  removed_by_delta=" << removed_by_delta
-                  << " removed_by_level=" << removed_by_level
-                  << "\n";
+        // One task per file on a shared pool; each file's report is printed
+        // whole once the file is done.
+        std::mutex log_mu;
+        CleanTotals all;
+        {
+            nbbo::TaskPool pool(std::min<int>(workers, (int)jobs.size()));
+            nbbo::TaskGroup group(pool);
+            for (const auto& [in, out] : jobs) {
+                group.run([&, in = in, out = out] {
+                    std::ostringstream rep;
+                    try {
+                        const CleanTotals t = clean_file(in, out, cfg, rep, log_mu);
+                        print_summary(rep, "summary", t);
+                        std::lock_guard<std::mutex> lk(log_mu);
+                        std::cout << rep.str();
+                        all.rows_in += t.rows_in; all.rows_out += t.rows_out; all.removed += t.removed;
+                        all.removed_by_delta += t.removed_by_delta; all.removed_by_level += t.removed_by_level;
+                    } catch (const std::exception& e) {
+                        std::lock_guard<std::mutex> lk(log_mu);
+                        std::cerr << in.string() << ": " << e.what() << "\n";
+                        rc = 1;
+                    }
+                });
+            }
+            group.wait();
+        }
+        if (jobs.size() > 1) print_summary(std::cout, ("total (" + std::to_string(jobs.size()) + " files)").c_str(), all);
     }  // end clean_mid_spikes_main timing scope
 
     // Program wall-clock timing + report
@@ -335,5 +506,5 @@ int main(int argc, char** argv) {
         "data/research/profile/timing_log.txt";
     nbbo::WriteTimingReport(timing_path, argv[0], args);
 
-    return 0;
+    return rc;
 }
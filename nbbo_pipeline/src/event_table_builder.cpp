@@ -1,12 +1,21 @@
 #include "nbbo/event_table_builder.hpp"
 
+#include <parquet/metadata.h>
+#include <parquet/statistics.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <iostream>
-#include <limits>
+#include <sstream>
 #include <stdexcept>
 #include <vector>
-#include <chrono>
 
 #include "nbbo/arrow_utils.hpp"
 #include "nbbo/time_utils.hpp"
@@ -14,17 +23,21 @@
 
 namespace fs = std::filesystem;
 
-EventTableBuilder::EventTableBuilder(const BuildEventsConfig& cfg)
-    : cfg_(cfg), writer_(cfg.out_path) {}
+EventTableBuilder::EventTableBuilder(const BuildEventsConfig& cfg,
+                                     nbbo::TaskPool& pool, std::mutex& log_mu)
+    : cfg_(cfg),
+      pool_(pool),
+      log_mu_(log_mu),
+      writer_(cfg.out_path, cfg.parquet, cfg.writer, cfg.horizons, &pool),
+      threshold_next_px_(nbbo::px_from_double(cfg.threshold_next)) {}
 
 void EventTableBuilder::run() {
   // High-level coordinator for building features (events):
   //   1. Ensure output directory exists
-  //   2. Open parquet input (schema + reader)
-  //   3. Build a streaming RecordBatchReader
-  //   4. Stream and process ticks in batches
-  //   5. Drop final day's unfinished event
-  //   6. Close writer and print summary
+  //   2. Open parquet input (schema + row-group metadata)
+  //   3. Cut the row groups into runs that start on a new day
+  //   4. Build the runs on the pool and write their events in order
+  //   5. Close writer and print summary
 
   using Clock = std::chrono::steady_clock;
   const auto start = Clock::now();
@@ -33,25 +46,15 @@ void EventTableBuilder::run() {
 
   ensure_output_dir();
   open_input();
-  init_reader();
-  process_stream();
-  finish_day();
+  plan_segments();
+  process_segments();
   writer_.close();
   print_summary();
 
-  // Wall-clock timing for the entire run.
+  // Wall-clock timing for the entire file.
   const auto end = Clock::now();
   nbbo::TimingRegistry::Instance().Add("EventTableBuilder::wall_clock",
                                        end - start);
-
-  // Build args summary for the timing log.
-  std::vector<std::string> args;
-  args.emplace_back("in=" + cfg_.in_path);
-  args.emplace_back("out=" + cfg_.out_path);
-  args.emplace_back("threshold_next=" + std::to_string(cfg_.threshold_next));
-
-  const std::string timing_path = "data/research/profile/timing_log.txt";
-  nbbo::WriteTimingReport(timing_path, "EventTableBuilder::run", args);
 }
 
 void EventTableBuilder::ensure_output_dir() {
@@ -72,45 +75,102 @@ void EventTableBuilder::open_input() {
   if (!in_schema_) {
     throw std::runtime_error("input schema is null");
   }
+
+  // Select all columns to read the full table
+  all_cols_.resize(in_schema_->num_fields());
+  for (int i = 0; i < in_schema_->num_fields(); ++i) all_cols_[i] = i;
 }
 
-void EventTableBuilder::init_reader() {
-  NBBO_SCOPE_TIMER("EventTableBuilder::init_reader");
-
-  // Build a RecordBatchReader over all rows + columns via batch streaming
-  std::vector<int> all_row_groups;
-  {
-    auto* pq_reader = reader_->parquet_reader();
-    int nrg = pq_reader->metadata()->num_row_groups();
-    all_row_groups.reserve(nrg);
-    for (int i = 0; i < nrg; ++i) all_row_groups.push_back(i);
-
-    std::cout << "=== build_events ===\n";
-    std::cout << "  in = " << cfg_.in_path << "\n";
-    std::cout << "  out = " << cfg_.out_path << "\n";
-    std::cout << "  threshold_next = " << cfg_.threshold_next << " (dollars)\n";
-    std::cout << "  row_groups = " << nrg << "\n";
+std::pair<uint32_t, uint32_t> EventTableBuilder::row_group_days(
+    int rg, int ts_col) const {
+  // Rows are sorted by ts, so min / max are the first and last row.
+  auto md = reader_->parquet_reader()->metadata()->RowGroup(rg);
+  auto chunk = md->ColumnChunk(ts_col);
+  if (chunk->is_stats_set()) {
+    auto st = std::dynamic_pointer_cast<parquet::Int64Statistics>(
+        chunk->statistics());
+    if (st && st->HasMinMax()) {
+      return {nbbo::to_day_ms(static_cast<uint64_t>(st->min())).day(),
+              nbbo::to_day_ms(static_cast<uint64_t>(st->max())).day()};
+    }
   }
 
-  // Select all columns to read the full table
-  std::vector<int> all_cols(in_schema_->num_fields());
-  for (int i = 0; i < in_schema_->num_fields(); ++i) all_cols[i] = i;
+  std::shared_ptr<arrow::Table> t;
+  auto st = reader_->ReadRowGroup(rg, {ts_col}, &t);
+  if (!st.ok()) {
+    throw std::runtime_error("ReadRowGroup failed: " + st.ToString());
+  }
+  const auto& chunks = t->column(0)->chunks();
+  const auto& first = chunks.front();
+  const auto& last = chunks.back();
+  return {nbbo::to_day_ms(nbbo::TsValues(first)[0]).day(),
+          nbbo::to_day_ms(nbbo::TsValues(last)[last->length() - 1]).day()};
+}
+
+void EventTableBuilder::plan_segments() {
+  NBBO_SCOPE_TIMER("EventTableBuilder::plan_segments");
+
+  // A new segment starts at every row group whose first day differs from the
+  // previous row group's last day. With one row group per day (the writers'
+  // default) that is one segment per day; row groups cut by row count only
+  // split where a cut happens to fall on a day change.
+  auto md = reader_->parquet_reader()->metadata();
+  const int nrg = md->num_row_groups();
+  const int ts_col = md->schema()->ColumnIndex("ts");
+  if (ts_col < 0) {
+    throw std::runtime_error("Input file has no ts column");
+  }
 
-  auto rb_res = reader_->GetRecordBatchReader(all_row_groups, all_cols);
+  uint32_t prev_last = 0;
+  for (int rg = 0; rg < nrg; ++rg) {
+    if (md->RowGroup(rg)->num_rows() == 0) {
+      if (!segments_.empty()) segments_.back().rg_hi = rg + 1;
+      continue;
+    }
+    const auto [first, last] = row_group_days(rg, ts_col);
+    if (segments_.empty() || first != prev_last) {
+      segments_.push_back({rg, rg + 1});
+    } else {
+      segments_.back().rg_hi = rg + 1;
+    }
+    prev_last = last;
+  }
+
+  std::lock_guard<std::mutex> lk(log_mu_);
+  std::cout << "=== build_events ===\n";
+  std::cout << "  in = " << cfg_.in_path << "\n";
+  std::cout << "  out = " << cfg_.out_path << "\n";
+  std::cout << "  threshold_next = " << cfg_.threshold_next << " (dollars)\n";
+  if (!cfg_.horizons.empty()) {
+    std::cout << "  horizons =";
+    for (const auto& h : cfg_.horizons) std::cout << " " << h.name();
+    std::cout << "\n";
+  }
+  std::cout << "  row_groups = " << nrg << "\n";
+  std::cout << "  segments = " << segments_.size() << "\n";
+}
+
+DayEventBuilder::Counts EventTableBuilder::build_segment(
+    const Segment& seg, std::vector<nbbo::LabeledEvent>& out,
+    std::vector<nbbo::HorizonLabel>& out_h, bool stream) {
+  NBBO_SCOPE_TIMER("EventTableBuilder::build_segment");
+
+  // A reader per segment: FileReader is not meant for concurrent reads
+  std::shared_ptr<arrow::Schema> schema;
+  auto reader = nbbo::open_parquet_reader(cfg_.in_path, schema);
+  std::vector<int> rgs;
+  for (int rg = seg.rg_lo; rg < seg.rg_hi; ++rg) rgs.push_back(rg);
+  auto rb_res = reader->GetRecordBatchReader(rgs, all_cols_);
   if (!rb_res.ok()) {
     throw std::runtime_error("GetRecordBatchReader failed: " +
                              rb_res.status().ToString());
   }
-  rb_reader_ = std::move(rb_res).ValueOrDie();
-}
-
-void EventTableBuilder::process_stream() {
-  NBBO_SCOPE_TIMER("EventTableBuilder::process_stream");
+  auto rb_reader = std::move(rb_res).ValueOrDie();
 
-  // Main streaming loop to process in batches
+  DayEventBuilder days(threshold_next_px_, cfg_.horizons, out, out_h);
   while (true) {
     std::shared_ptr<arrow::RecordBatch> batch;
-    auto st = rb_reader_->ReadNext(&batch);
+    auto st = rb_reader->ReadNext(&batch);
     if (!st.ok()) {
       throw std::runtime_error("ReadNext failed: " + st.ToString());
     }
@@ -120,148 +180,337 @@ void EventTableBuilder::process_stream() {
 
     if (batch->num_rows() == 0) continue;
 
-    process_batch(batch);
+    days.process_batch(batch);
+    if (stream) write_events(out, out_h, days.take_counts());
+  }
+  days.finish_day();
+  if (stream) {
+    write_events(out, out_h, days.take_counts());
+    return {};
   }
+  return days.take_counts();
 }
 
-void EventTableBuilder::process_batch(
-    const std::shared_ptr<arrow::RecordBatch>& batch) {
-  NBBO_SCOPE_TIMER("EventTableBuilder::process_batch");
+void EventTableBuilder::process_segments() {
+  NBBO_SCOPE_TIMER("EventTableBuilder::process_segments");
+
+  // Nothing to run concurrently: build straight into the writer
+  if (segments_.size() <= 1) {
+    std::vector<nbbo::LabeledEvent> events;
+    std::vector<nbbo::HorizonLabel> labels;
+    for (const auto& seg : segments_) build_segment(seg, events, labels, true);
+    return;
+  }
 
-  // Processes a batch iteratively per row to generate features (events)
+  // Segments are built as pool tasks, at most 2 per worker ahead of the one
+  // being written; this thread builds the next one itself if no worker has
+  // started it. Slots live until every task is done: a task that finds its
+  // segment already claimed still looks at the slot.
+  struct Slot {
+    std::vector<nbbo::LabeledEvent> events;
+    std::vector<nbbo::HorizonLabel> labels;
+    DayEventBuilder::Counts counts;
+    std::atomic<bool> claimed{false};
+    bool ready = false;
+    std::exception_ptr err;
+  };
+  std::vector<std::unique_ptr<Slot>> slots(segments_.size());
+  const size_t max_inflight = 2 * static_cast<size_t>(pool_.size());
+  std::mutex mu;
+  std::condition_variable cv;
+
+  auto build = [&](size_t c) {
+    Slot& sl = *slots[c];
+    if (sl.claimed.exchange(true)) return;
+    try {
+      sl.counts = build_segment(segments_[c], sl.events, sl.labels, false);
+    } catch (...) {
+      sl.err = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      sl.ready = true;
+    }
+    cv.notify_all();
+  };
+
+  nbbo::TaskGroup tasks(pool_);
+  size_t submitted = 0;
+  auto submit_upto = [&](size_t n) {
+    for (n = std::min(n, segments_.size()); submitted < n; ++submitted) {
+      slots[submitted] = std::make_unique<Slot>();
+      tasks.run([&build, c = submitted] { build(c); });
+    }
+  };
+  submit_upto(max_inflight);
+  for (size_t c = 0; c < segments_.size(); ++c) {
+    build(c);
+    {
+      std::unique_lock<std::mutex> lk(mu);
+      cv.wait(lk, [&] { return slots[c]->ready; });
+    }
+    Slot& sl = *slots[c];
+    if (sl.err) std::rethrow_exception(sl.err);
+    write_events(sl.events, sl.labels, sl.counts);
+    std::vector<nbbo::LabeledEvent>().swap(sl.events);
+    std::vector<nbbo::HorizonLabel>().swap(sl.labels);
+    submit_upto(c + 1 + max_inflight);
+  }
+  tasks.wait();
+}
 
-  // Field validation. If column is missing, throws runtime error
-  auto ts_arr = batch->GetColumnByName("ts");
-  auto mid_arr = batch->GetColumnByName("mid");
-  auto lr_arr = batch->GetColumnByName("log_return");
-  auto bid_sz_arr = batch->GetColumnByName("bid_size");
-  auto ask_sz_arr = batch->GetColumnByName("ask_size");
-  auto spread_arr = batch->GetColumnByName("spread");
-  auto bid_arr = batch->GetColumnByName("bid");
-  auto ask_arr = batch->GetColumnByName("ask");
+void EventTableBuilder::write_events(std::vector<nbbo::LabeledEvent>& events,
+                                     std::vector<nbbo::HorizonLabel>& labels,
+                                     const DayEventBuilder::Counts& c) {
+  static constexpr uint64_t PROGRESS_EVERY = 10'000'000;
 
-  if (!ts_arr || !mid_arr || !lr_arr || !bid_sz_arr || !ask_sz_arr ||
-      !spread_arr || !bid_arr || !ask_arr) {
-    throw std::runtime_error("Input batch missing required columns");
+  const size_t nh = cfg_.horizons.size();
+  for (size_t i = 0; i < events.size(); ++i) {
+    writer_.append(events[i], nh ? &labels[i * nh] : nullptr);
   }
+  events.clear();
+  labels.clear();
 
-  // Process each row sequentially in a batch
-  const int64_t n = batch->num_rows();
-  for (int64_t i = 0; i < n; ++i) {
-    process_row(i, ts_arr, mid_arr, lr_arr, bid_sz_arr, ask_sz_arr, spread_arr,
-                bid_arr, ask_arr);
+  // Count ticks for progress reporting
+  const uint64_t before = counts_.ticks_total;
+  counts_.add(c);
+  if (before / PROGRESS_EVERY != counts_.ticks_total / PROGRESS_EVERY) {
+    std::lock_guard<std::mutex> lk(log_mu_);
+    std::cout << "  processed ticks="
+              << counts_.ticks_total / PROGRESS_EVERY * PROGRESS_EVERY
+              << " events_written=" << counts_.events_written << "\n";
   }
 }
 
-void EventTableBuilder::process_row(
-    int64_t i,
-    const std::shared_ptr<arrow::Array>& ts_arr,
-    const std::shared_ptr<arrow::Array>& mid_arr,
-    const std::shared_ptr<arrow::Array>& lr_arr,
-    const std::shared_ptr<arrow::Array>& bid_sz_arr,
-    const std::shared_ptr<arrow::Array>& ask_sz_arr,
-    const std::shared_ptr<arrow::Array>& spread_arr,
-    const std::shared_ptr<arrow::Array>& bid_arr,
-    const std::shared_ptr<arrow::Array>& ask_arr) {
-  // Count ticks for progress reporting
-  ++ticks_total_;
-  static constexpr int64_t PROGRESS_EVERY = 10'000'000;
-  if (PROGRESS_EVERY > 0 && (ticks_total_ % PROGRESS_EVERY) == 0) {
-    std::cout << "  processed ticks=" << ticks_total_
-              << " events_written=" << events_written_ << "\n";
+void EventTableBuilder::print_summary() const {
+  // One block, so that files finishing together do not interleave
+  std::ostringstream os;
+  os << "=== summary ===\n";
+  os << "  in = " << cfg_.in_path << "\n";
+  os << "  ticks_total = " << counts_.ticks_total << "\n";
+  os << "  events_detected = " << counts_.events_detected << "\n";
+  os << "  events_written = " << counts_.events_written << "\n";
+  os << "  events_dropped_bigmove = " << counts_.events_dropped_bigmove << "\n";
+  os << "  events_dropped_boundary = " << counts_.events_dropped_boundary
+     << "\n";
+
+  std::lock_guard<std::mutex> lk(log_mu_);
+  std::cout << os.str();
+}
+
+namespace {
+
+inline bool bit_at(const uint8_t* bitmap, int64_t i) {
+  return (bitmap[i >> 3] >> (i & 7)) & 1;
+}
+
+// A size column that is not int32 (legacy files), converted to double.
+const double* size_values(const std::shared_ptr<arrow::Array>& arr,
+                          std::vector<double>& scratch) {
+  scratch.resize(static_cast<size_t>(arr->length()));
+  for (int64_t i = 0; i < arr->length(); ++i) {
+    scratch[i] = nbbo::ValueAt<double>(arr, i);
   }
+  return scratch.data();
+}
 
-  // null filtering. Everything except log_return must be non-null
-  if (ts_arr->IsNull(i) || mid_arr->IsNull(i) || bid_sz_arr->IsNull(i) ||
-      ask_sz_arr->IsNull(i) || spread_arr->IsNull(i) || bid_arr->IsNull(i) ||
-      ask_arr->IsNull(i)) {
-    return;
+}  // namespace
+
+template <typename LrT, typename SzT>
+void DayEventBuilder::process_rows(const RowSpans<LrT, SzT>& s, int64_t n) {
+  // 64 rows per validity word; an all-valid word runs without checks
+  for (int64_t w = 0; w < n; w += 64) {
+    const int64_t e = std::min<int64_t>(n, w + 64);
+    const uint64_t bits = s.valid ? s.valid[w >> 6] : ~uint64_t{0};
+    if (bits == ~uint64_t{0}) {
+      for (int64_t i = w; i < e; ++i) process_tick(s, i);
+    } else {
+      for (int64_t i = w; i < e; ++i) {
+        if ((bits >> (i - w)) & 1) process_tick(s, i);
+      }
+    }
   }
+  counts_.ticks_total += static_cast<uint64_t>(n);
+}
+
+template <typename LrT, typename SzT>
+void DayEventBuilder::process_tick(const RowSpans<LrT, SzT>& s, int64_t i) {
+  const nbbo::Px bid = s.bid[i];
+  const nbbo::Px ask = s.ask[i];
 
-  // Raw extract from Arrow arrays
-  uint64_t ts = nbbo::ValueAt<uint64_t>(ts_arr, i);
-  double mid = nbbo::ValueAt<double>(mid_arr, i);
-  double bid = nbbo::ValueAt<double>(bid_arr, i);
-  double ask = nbbo::ValueAt<double>(ask_arr, i);
-  double bid_sz = nbbo::ValueAt<double>(bid_sz_arr, i);
-  double ask_sz = nbbo::ValueAt<double>(ask_sz_arr, i);
-  double spread = nbbo::ValueAt<double>(spread_arr, i);
-
-  // log_return can be null. Treat null as "no mid change"
-  double lr = std::numeric_limits<double>::quiet_NaN();
-  if (!lr_arr->IsNull(i)) lr = nbbo::ValueAt<double>(lr_arr, i);
-
-  // When the calendar day changes, the previous event must be dropped
-  uint32_t day = nbbo::day_from_ts(ts);
-  int ms = static_cast<int>(nbbo::ms_since_midnight_chrono(ts).count());
+  // When the calendar day changes, the previous event must be dropped.
+  // Day and ms come from the batch decode in process_batch.
+  const uint32_t day = ts_cols_.day[i];
+  const int ms = ts_cols_.ms[i];
   if (!have_day_ || day != curr_day_) {
-    start_new_day(day, ts, bid, ask);
+    start_new_day(day, ms, bid, ask);
   }
 
-  // Calculate price imbalance and diff (ms) between bid and ask
+  // Update bid/ask quote ages (ms since each price last changed)
   update_quote_ages(ms, bid, ask);
-  double imbalance = compute_imbalance(bid_sz, ask_sz);
-  double age_diff_ms = age_bid_ms_ - age_ask_ms_;
 
-  // Only log_return != 0 marks a mid-price change event
+  // Only log_return != 0 marks a mid-price change event; null counts as
+  // "no mid change"
+  if (s.lr_valid && !bit_at(s.lr_valid, s.lr_offset + i)) return;
+  const double lr = static_cast<double>(s.lr[i]);
   if (!std::isfinite(lr) || lr == 0.0) return;
 
-  ++events_detected_;
+  ++counts_.events_detected;
 
   // Creates an event struct representing current mid-change
   nbbo::LabeledEvent event{};
-  event.ts = ts;
+  event.ts = s.ts[i];
   event.day = day;
-  event.mid = mid;
-  event.spread = spread;
-  event.imbalance = imbalance;
-  event.age_diff_ms = age_diff_ms;
+  event.mid = s.mid[i];
+  event.spread = s.spread[i];
+  event.imbalance = compute_imbalance(static_cast<double>(s.bid_sz[i]),
+                                      static_cast<double>(s.ask_sz[i]));
+  event.age_diff_ms = age_bid_ms_ - age_ask_ms_;
   event.last_move = last_move_sign_;
 
   // Label previous event using the current one as "next mid change"
   label_and_emit_prev(event, ms);
 
+  // Extra horizons that end with this change; events with all of theirs
+  // resolved leave the ring
+  if (!horizons_.empty()) {
+    resolve_horizons(event, next_event_id_, ms);
+    pop_resolved();
+  }
+
   // Update last move sign for next event
   last_move_sign_ = (lr > 0.0 ? 1.0 : -1.0);
 
   // Store current event for labeling later
   prev_event_ = event;
+  prev_event_ms_ = ms;
+  prev_event_id_ = next_event_id_++;
   have_prev_event_ = true;
 }
 
-void EventTableBuilder::start_new_day(uint32_t day,
-                                      uint64_t ts,
-                                      double bid,
-                                      double ask) {
+void DayEventBuilder::process_batch(
+    const std::shared_ptr<arrow::RecordBatch>& batch) {
+  NBBO_SCOPE_TIMER("DayEventBuilder::process_batch");
+
+  // Resolves column types once, then runs the per-tick logic over raw spans
+
+  // Field validation. If column is missing, throws runtime error
+  auto ts_arr = batch->GetColumnByName("ts");
+  auto mid_arr = batch->GetColumnByName("mid");
+  auto lr_arr = batch->GetColumnByName("log_return");
+  auto bid_sz_arr = batch->GetColumnByName("bid_size");
+  auto ask_sz_arr = batch->GetColumnByName("ask_size");
+  auto spread_arr = batch->GetColumnByName("spread");
+  auto bid_arr = batch->GetColumnByName("bid");
+  auto ask_arr = batch->GetColumnByName("ask");
+
+  if (!ts_arr || !mid_arr || !lr_arr || !bid_sz_arr || !ask_sz_arr ||
+      !spread_arr || !bid_arr || !ask_arr) {
+    throw std::runtime_error("Input batch missing required columns");
+  }
+
+  const int64_t n = batch->num_rows();
+  ts_cols_.decode(nbbo::TsValues(ts_arr), static_cast<size_t>(n));
+
+  // Rows with a null outside log_return are skipped. Their validity bitmaps
+  // are ANDed into one word per 64 rows, and only if some column has nulls.
+  const std::shared_ptr<arrow::Array>* required[] = {
+      &ts_arr, &mid_arr, &bid_sz_arr, &ask_sz_arr, &spread_arr, &bid_arr, &ask_arr};
+  const uint64_t* valid = nullptr;
+  for (const auto* a : required) {
+    if ((*a)->null_count() == 0) continue;
+    if (!valid) {
+      valid_words_.assign(static_cast<size_t>((n + 63) / 64), ~uint64_t{0});
+      valid = valid_words_.data();
+    }
+    const uint8_t* bm = (*a)->null_bitmap_data();
+    const int64_t off = (*a)->offset();
+    if (off % 8 == 0) {
+      const uint8_t* bytes = bm + off / 8;
+      const int64_t nbytes = (n + 7) / 8;
+      for (int64_t w = 0; w * 8 < nbytes; ++w) {
+        uint64_t x = 0;
+        std::memcpy(&x, bytes + w * 8, static_cast<size_t>(std::min<int64_t>(8, nbytes - w * 8)));
+        valid_words_[w] &= x;
+      }
+    } else {
+      for (int64_t i = 0; i < n; ++i) {
+        if (!bit_at(bm, off + i)) valid_words_[i >> 6] &= ~(uint64_t{1} << (i & 63));
+      }
+    }
+  }
+
+  // Prices as Px (int32 columns are used in place)
+  const nbbo::Px* mid = nbbo::PxValues(mid_arr, px_scratch_[0]);
+  const nbbo::Px* spread = nbbo::PxValues(spread_arr, px_scratch_[1]);
+  const nbbo::Px* bid = nbbo::PxValues(bid_arr, px_scratch_[2]);
+  const nbbo::Px* ask = nbbo::PxValues(ask_arr, px_scratch_[3]);
+  const uint64_t* ts = nbbo::TsValues(ts_arr);
+  const uint8_t* lr_valid = lr_arr->null_count() ? lr_arr->null_bitmap_data() : nullptr;
+
+  auto run = [&]<typename LrT, typename SzT>(const LrT* lr, const SzT* bid_sz, const SzT* ask_sz) {
+    const RowSpans<LrT, SzT> s{ts, mid, spread, bid, ask, bid_sz, ask_sz,
+                               lr, lr_valid, lr_arr->offset(), valid};
+    process_rows(s, n);
+  };
+  auto with_sizes = [&]<typename LrT>(const LrT* lr) {
+    if (bid_sz_arr->type_id() == arrow::Type::INT32 &&
+        ask_sz_arr->type_id() == arrow::Type::INT32) {
+      run(lr, static_cast<const arrow::Int32Array&>(*bid_sz_arr).raw_values(),
+          static_cast<const arrow::Int32Array&>(*ask_sz_arr).raw_values());
+    } else {
+      run(lr, size_values(bid_sz_arr, size_scratch_[0]),
+          size_values(ask_sz_arr, size_scratch_[1]));
+    }
+  };
+  switch (lr_arr->type_id()) {
+    case arrow::Type::FLOAT:
+      with_sizes(static_cast<const arrow::FloatArray&>(*lr_arr).raw_values());
+      break;
+    case arrow::Type::DOUBLE:
+      with_sizes(static_cast<const arrow::DoubleArray&>(*lr_arr).raw_values());
+      break;
+    default:
+      throw std::runtime_error("Unsupported log_return type: " +
+                               lr_arr->type()->ToString());
+  }
+}
+
+void DayEventBuilder::start_new_day(uint32_t day,
+                                      int ms,
+                                      nbbo::Px bid,
+                                      nbbo::Px ask) {
   // Initialize state for a new trading day
   curr_day_ = day;
   have_day_ = true;
 
   // Reset quote age based on first tick of the day
-  int ms = static_cast<int>(nbbo::ms_since_midnight_chrono(ts).count());
   last_bid_price_ = bid;
   last_ask_price_ = ask;
   bid_origin_ms_ = ms;
   ask_origin_ms_ = ms;
   last_move_sign_ = 0.0;
 
-  // Leftover events from prior day do not have a "next" event
+  // Events of the prior day still waiting for horizons are written as they
+  // are; its last event does not have a "next" event
+  flush_pending();
   if (have_prev_event_) {
-    ++events_dropped_boundary_;
+    ++counts_.events_dropped_boundary;
     have_prev_event_ = false;
   }
 }
 
-void EventTableBuilder::finish_day() {
+void DayEventBuilder::finish_day() {
   // If the final day has a pending event,
   // it is dropped because it has no next same-day mid-change
+  flush_pending();
   if (have_prev_event_) {
-    ++events_dropped_boundary_;
+    ++counts_.events_dropped_boundary;
     have_prev_event_ = false;
   }
 }
 
-void EventTableBuilder::update_quote_ages(int ms, double bid, double ask) {
+void DayEventBuilder::update_quote_ages(int ms, nbbo::Px bid, nbbo::Px ask) {
   // If price changes, update age. Else, age increases.
 
   if (bid != last_bid_price_) {
@@ -276,45 +525,105 @@ void EventTableBuilder::update_quote_ages(int ms, double bid, double ask) {
   age_ask_ms_ = ms - ask_origin_ms_;
 }
 
-double EventTableBuilder::compute_imbalance(double bid_sz, double ask_sz) {
+double DayEventBuilder::compute_imbalance(double bid_sz, double ask_sz) {
   // volume imbalance: (bid - ask) / (bid + ask)
   double denom = bid_sz + ask_sz;
   if (denom == 0.0) return 0.0;
   return (bid_sz - ask_sz) / denom;
 }
 
-void EventTableBuilder::label_and_emit_prev(const nbbo::LabeledEvent& event,
+void DayEventBuilder::label_and_emit_prev(const nbbo::LabeledEvent& event,
                                             int ms_curr) {
   // Label previous event only if a prev event exists
   // OR it's on same day as current event
   if (!have_prev_event_ || prev_event_.day != event.day) return;
 
-  // Price movement between events
-  double dmid = event.mid - prev_event_.mid;
+  // Price movement between events (exact, in Px)
+  nbbo::Px dmid = event.mid - prev_event_.mid;
 
   // mid jumps beyond threshold are considered outliers and dropped
-  if (std::fabs(dmid) <= cfg_.threshold_next) {
+  if (std::abs(dmid) <= threshold_next_px_) {
     prev_event_.mid_next = event.mid;
-    prev_event_.y = (dmid > 0.0 ? 1.0 : (dmid < 0.0 ? -1.0 : 0.0));
+    prev_event_.y = (dmid > 0 ? 1.0 : (dmid < 0 ? -1.0 : 0.0));
 
     // Waiting time until next event
-    int ms_prev = static_cast<int>(
-        nbbo::ms_since_midnight_chrono(prev_event_.ts).count());
-    prev_event_.tau_ms = static_cast<double>(ms_curr - ms_prev);
+    prev_event_.tau_ms = static_cast<double>(ms_curr - prev_event_ms_);
 
-    writer_.append(prev_event_);
-    ++events_written_;
+    if (horizons_.empty()) {
+      emit(prev_event_, nullptr);
+    } else {
+      push_pending(prev_event_, prev_event_id_, prev_event_ms_);
+    }
   } else {
-    ++events_dropped_bigmove_;
+    ++counts_.events_dropped_bigmove;
   }
 }
 
-void EventTableBuilder::print_summary() const {
-  std::cout << "=== summary ===\n";
-  std::cout << "  ticks_total = " << ticks_total_ << "\n";
-  std::cout << "  events_detected = " << events_detected_ << "\n";
-  std::cout << "  events_written = " << events_written_ << "\n";
-  std::cout << "  events_dropped_bigmove = " << events_dropped_bigmove_ << "\n";
-  std::cout << "  events_dropped_boundary = " << events_dropped_boundary_
-            << "\n";
+void DayEventBuilder::emit(const nbbo::LabeledEvent& ev,
+                           const nbbo::HorizonLabel* h) {
+  out_.push_back(ev);
+  if (h) out_h_.insert(out_h_.end(), h, h + horizons_.size());
+  ++counts_.events_written;
+}
+
+void DayEventBuilder::push_pending(const nbbo::LabeledEvent& ev, uint64_t id,
+                                   int ms) {
+  const size_t nh = horizons_.size();
+  if (tail_ - head_ == ring_.size()) {
+    // Full: double the ring, each position keeps its entry
+    std::vector<Pending> ring(std::max<size_t>(64, 2 * ring_.size()));
+    std::vector<nbbo::HorizonLabel> ring_h(ring.size() * nh);
+    for (uint64_t pos = head_; pos < tail_; ++pos) {
+      const size_t j = pos & (ring.size() - 1);
+      ring[j] = pending_at(pos);
+      std::copy_n(labels_at(pos), nh, &ring_h[j * nh]);
+    }
+    ring_.swap(ring);
+    ring_h_.swap(ring_h);
+  }
+  pending_at(tail_) = Pending{ev, id, ms, nh};
+  std::fill_n(labels_at(tail_), nh, nbbo::HorizonLabel{0, 0, 0, false});
+  ++tail_;
+}
+
+void DayEventBuilder::resolve_horizons(const nbbo::LabeledEvent& ev,
+                                       uint64_t id, int ms) {
+  // Pending events resolve in ring order for every horizon, so each keeps a
+  // cursor to its first open event
+  auto set = [](nbbo::HorizonLabel& l, const Pending& p, nbbo::Px mid, int t) {
+    const nbbo::Px dmid = mid - p.ev.mid;
+    l.mid_next = mid;
+    l.y = static_cast<int8_t>(dmid > 0 ? 1 : (dmid < 0 ? -1 : 0));
+    l.tau_ms = t - p.ms;
+    l.valid = true;
+  };
+  for (size_t k = 0; k < horizons_.size(); ++k) {
+    const nbbo::EventHorizon& hz = horizons_[k];
+    uint64_t& c = cursor_[k];
+    c = std::max(c, head_);
+    for (; c < tail_; ++c) {
+      Pending& p = pending_at(c);
+      if (hz.kind == nbbo::EventHorizon::Kind::kChanges) {
+        // this is the n-th change after p
+        if (p.id + static_cast<uint64_t>(hz.n) > id) break;
+        set(labels_at(c)[k], p, ev.mid, ms);
+      } else {
+        // the first change past p.ms + n: the mid then is the previous one's
+        if (p.ms + hz.n >= ms) break;
+        set(labels_at(c)[k], p, prev_event_.mid, prev_event_ms_);
+      }
+      --p.open;
+    }
+  }
+}
+
+void DayEventBuilder::pop_resolved() {
+  while (head_ < tail_ && pending_at(head_).open == 0) {
+    emit(pending_at(head_).ev, labels_at(head_));
+    ++head_;
+  }
+}
+
+void DayEventBuilder::flush_pending() {
+  for (; head_ < tail_; ++head_) emit(pending_at(head_).ev, labels_at(head_));
 }
@@ -21,6 +21,7 @@
 
 #include "nbbo/arrow_utils.hpp"
 #include "nbbo/histogram_bins.hpp"
+#include "nbbo/schema.hpp"
 #include "nbbo/timing.hpp"
 
 using nlohmann::json;
@@ -101,6 +102,8 @@ void HistogramBuilder::accumulate_year(int year) {
   if (!schema) {
     throw std::runtime_error("HistogramBuilder: input schema is null");
   }
+  // Both events layouts are read by column name; newer ones are rejected.
+  nbbo::events_schema_version(*schema);
 
   // Row groups: all
   auto* pq_reader = reader->parquet_reader();
@@ -159,7 +162,7 @@ void HistogramBuilder::accumulate_batch(
 
     TickState x{
         nbbo::ValueAt<double>(imb_arr, i),  // imbalance
-        nbbo::ValueAt<double>(spr_arr, i),  // spread
+        nbbo::PxAt(spr_arr, i),             // spread (Px)
         nbbo::ValueAt<double>(age_arr, i),  // age_diff_ms
         nbbo::ValueAt<double>(last_arr, i)  // last_move
     };
@@ -79,16 +79,14 @@ int HistogramModel::imb_bin(double I) const {
   return N_IMB - 1;
 }
 
-int HistogramModel::spr_bin(double spread) const {
-  // spread in dollars; bin by ticks of 0.01
-  constexpr double delta = 0.01;
-
-  if (spread <= 0.0 || !std::isfinite(spread)) {
-    // Treat nonpositive / NaN as 1-tick
+int HistogramModel::spr_bin(nbbo::Px spread) const {
+  // spread in Px; bin by 1-cent ticks (nearest cent for sub-penny spreads)
+  if (spread <= 0) {
+    // Treat nonpositive as 1-tick
     return 0;
   }
 
-  int k = static_cast<int>(std::llround(spread / delta));
+  int k = (spread + nbbo::kPxPerCent / 2) / nbbo::kPxPerCent;
 
   auto idxs = vw::iota(0, N_SPR);
 
@@ -133,7 +131,7 @@ int HistogramModel::last_bin(double L) const {
 }
 
 int HistogramModel::cell_index(double I,
-                               double s,
+                               nbbo::Px s,
                                double age_diff_ms,
                                double L) const {
   int b_imb = imb_bin(I);
@@ -3,12 +3,41 @@
 //
 // Features:
 // - Separate caches: cache/ms_event (no ffill) and cache/ms_clock (ffill).
-// - Cache-only mode: runs even if --in is empty/missing (no T7), from cache.
+// - Cache-only mode: runs even if --in is empty/missing (no T7), from cache
+//   msbins whose settings fingerprint matches the current flags.
 // - Event→Clock fallback: if --clock and ms_clock is empty but ms_event exists,
 //   synthesize ms_clock by per-day ffill for gaps <= --max-ffill-gap-ms.
-// - Winsor: parallel exact tail selection (tiny heaps). Fast and bias-light for 1e-5 tails.
-// - Parquet output: partitioned by year into out/<event|event_winsor|clock|clock_winsor>/SYM_YYYY.parquet.
+// - Virtual clock grid: ms_clock stores only rows with a new quote; the 1 ms
+//   forward-fill rows between them are implied by their timestamps and the
+//   fill cap. clock/ expands them on write; --clock-virtual keeps the compact
+//   rows and adds valid_until_ms (last covered ms of the day) instead.
+// - NBBO: per-venue book (latest quote per --ex venue), consolidated with time
+//   priority; venues silent for more than --stale-ms drop out (0 = never).
+// - Winsor: exact radix select over log-return key counts. Stage A saves the
+//   counts next to each msbin (<msbin>.tail), so a warm cache needs no scan.
+// - Stage A keeps a zran-style gzip seek index per input (cache/gzidx). One yearly
+//   file is split into chunks that inflate+parse on separate workers; NBBO/ffill
+//   state is carried across chunks by an ordered consumer. --days uses the same
+//   index to ingest a date range without inflating the rest of the file.
+// - msbin v2 (nbbo/msbin.hpp): header with row count, ts range and a Stage A
+//   settings fingerprint, plus a per-day row table that Stage B splits work on.
+//   --cache-layout soa stores one column per field; readers mmap either layout.
+//   --cache-layout packed stores day-aligned delta/varint/run-length blocks
+//   (about 4x smaller); blocks decode on demand.
+// - Incremental Stage A: cache/<mode>/manifest.tsv maps each CSV (size, mtime,
+//   content hash) to its msbin; only stale or newly added inputs are rebuilt.
+// - --no-cache: Stage A rows stream straight into the Parquet writers through
+//   bounded queues (no msbins). Winsor then takes --winsor-cutoffs or the
+//   cutoffs a cached run saved in out/<mode>/winsor_cutoffs.tsv.
+// - --symbols SPY,QQQ,...: one pipeline per symbol, all stages of all of them
+//   scheduled as tasks on one work-stealing pool of --workers threads
+//   (nbbo/task_pool.hpp). Outputs stay per symbol. Outside the pool: Arrow's
+//   CPU pool for column encoding (pq.use_threads) and the --no-cache
+//   producer thread, which blocks on its row queue. A file's chunk fan-out
+//   is its share of the pool among all files being ingested at the time.
+// - Parquet output: partitioned by year into out/<event|clock|clock_virtual>[_winsor]/SYM_YYYY.parquet.
 //   Cross-year msbins (e.g. 202401_11 has 2023+2024) are split by each row’s timestamp year.
+//   Each year is written by its own task on the worker pool.
 //
 // Build: cmake -S . -B build -G Ninja && cmake --build build -j
 
@@ -18,10 +47,14 @@
 #include <zlib.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <charconv>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <cerrno>
 #include <cmath>
@@ -33,16 +66,28 @@
 #include <map>
 #include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <vector>
 #include <cctype>
-#include <queue>
 #include <stdexcept>
+#include <exception>
 #include "nbbo/arrow_utils.hpp"
+#include "nbbo/cache_manifest.hpp"
+#include "nbbo/csv_scan.hpp"
+#include "nbbo/glitch_stats.hpp"
+#include "nbbo/gz_index.hpp"
+#include "nbbo/msbin.hpp"
+#include "nbbo/parquet_writer_config.hpp"
+#include "nbbo/price.hpp"
+#include "nbbo/tail_stats.hpp"
 #include "nbbo/time_utils.hpp"
 #include "nbbo/schema.hpp"
+#include "nbbo/spsc_queue.hpp"
+#include "nbbo/task_pool.hpp"
+#include "nbbo/ts_decode.hpp"
 
 using std::string; using std::string_view;
 namespace fs = std::filesystem;
@@ -55,10 +100,15 @@ struct Settings {
     bool clock_grid   = false;     // enable with --clock
     bool ffill        = false;     // only used when clock_grid
     int  max_ffill_gap_ms = 250;   // cap for clock-grid fills
+    bool clock_virtual = false;    // --clock-virtual: Parquet keeps fill runs as valid_until_ms
 
     bool winsorize    = false;
     bool winsor_clip  = false;     // else drop
     double q_lo = 1e-5, q_hi = 1.0 - 1e-5;
+    bool fixed_cutoffs = false;    // --winsor-cutoffs: use these instead of Stage B
+    double cut_lo = 0, cut_hi = 0;
+
+    bool no_cache = false;         // --no-cache: stream CSV.gz -> Parquet, no msbins
 
     int rth_start_h=9, rth_start_m=30, rth_end_h=16, rth_end_m=0;
     std::set<char> venues = {'P','T','Q','Z','Y','J','K'};
@@ -68,7 +118,14 @@ struct Settings {
     uint64_t log_every_out = 1'000'000;
 
     std::string sym_root = "SPY";
+    std::vector<std::string> symbols;         // --symbols: one Pipeline each on a shared pool
     int year_lo = 0, year_hi = 0;
+    uint32_t day_lo = 0, day_hi = 0;          // --days: restrict Stage A to YYYYMMDD range
+
+    uint64_t gz_index_span = nbbo::GzIndex::kDefaultSpan;
+    uint64_t chunk_bytes   = 64ULL << 20;     // uncompressed bytes per intra-file chunk
+    nbbo::MsBinLayout cache_layout = nbbo::MsBinLayout::kRows;  // --cache-layout aos|soa|packed
+    nbbo::ParquetWriterConfig parquet;        // --parquet-*, --row-group-rows, --no-day-row-groups
 
     int workers = (int)std::max(1u, std::thread::hardware_concurrency());
 };
@@ -76,11 +133,14 @@ struct Settings {
 static void usage(){
     std::cerr <<
     "nbbo_pipeline --in DIR --cache DIR --out OUT_PATH --report FILE.txt\n"
-    "  [--clock] [--event] [--ffill] [--no-ffill] [--max-ffill-gap-ms N]\n"
-    "  [--winsor] [--winsor-clip|--winsor-drop] [--winsor-quantiles a,b]\n"
+    "  [--clock] [--event] [--ffill] [--no-ffill] [--max-ffill-gap-ms N] [--clock-virtual]\n"
+    "  [--winsor] [--winsor-clip|--winsor-drop] [--winsor-quantiles a,b] [--winsor-cutoffs lo,hi]\n"
+    "  [--no-cache]\n"
     "  [--rth HH:MM:SS-HH:MM:SS] [--ex VENUES] [--stale-ms N]\n"
     "  [--log-every-in N] [--log-every-out N]\n"
-    "  [--sym-root SYM] [--years YYYY:YYYY] [--workers N]\n"
+    "  [--sym-root SYM | --symbols SYM,SYM,...] [--years YYYY:YYYY] [--workers N]\n"
+    "  [--days YYYYMMDD:YYYYMMDD] [--chunk-mb N] [--cache-layout aos|soa|packed]\n"
+    << nbbo::kParquetWriterUsage <<
     "Note: OUT_PATH may be a directory or a .parquet path; for partitioned output we use the directory.\n";
 }
 
@@ -91,41 +151,46 @@ static bool parse_time_hms(string_view s, int& h,int& m,int& sec){
 }
 
 /************** Types ***************/
+using nbbo::Px;
+
+// Quotes and book rows carry (day, ms of day) as nbbo::DayMs; the decimal
+// yyyymmddHHMMSSmmm ts is only produced for rows that are written.
 struct Quote {
-    uint64_t ts;     // yyyymmddHHMMSSmmm
-    float bid, ask;
+    nbbo::DayMs t;
+    Px bid, ask;     // 1/10000 dollar
     int32_t bidSize, askSize;
     char ex;
 };
 struct Row {
-    uint64_t ts;
-    float mid, logret, bidSize, askSize, spread, bid, ask;
+    uint64_t ts;     // yyyymmddHHMMSSmmm
+    nbbo::DayMs t;
+    Px bid, ask;
+    int32_t bidSize, askSize;
+    float logret;
 };
 
 /************** Glitches *************/
-struct GlitchCounts {
-    std::map<string,uint64_t> total;
-    std::map<string,std::map<int,uint64_t>> by_hour;
-    void bump(const string& cat,int hour){ ++total[cat]; ++by_hour[cat][hour]; }
-    void merge(const GlitchCounts& o){
-        for(auto& [k,v]: o.total) total[k]+=v;
-        for(auto& [k,hm]: o.by_hour) for(auto& [h,c]: hm) by_hour[k][h]+=c;
-    }
-    void write_report(const fs::path& p){
-        std::ofstream r(p);
-        r<<"NBBO pipeline glitch report\n\nTotals:\n";
-        for(auto& [k,v]: total) r<<std::setw(22)<<std::left<<k<<" : "<<v<<"\n";
-        r<<"\nBy hour (RTH):\n";
-        for(auto& [k,hmap]: by_hour){
-            r<<"\n["<<k<<"]\n";
-            for(int h=9; h<=15; ++h){
-                uint64_t c = hmap.count(h)?hmap.at(h):0;
-                r<<"  "<<h<<":00 - "<<c<<"\n";
-            }
-        }
-    }
+// Flat (day, kind, venue, minute) counters over the RTH window; one per
+// thread or file, merged after the work is done (nbbo/glitch_stats.hpp).
+struct GlitchCounts : nbbo::GlitchStats {
+    explicit GlitchCounts(const Settings& S)
+    : nbbo::GlitchStats(string(S.venues.begin(), S.venues.end()),
+                        S.rth_start_h*60+S.rth_start_m, S.rth_end_h*60+S.rth_end_m) {}
 };
 
+// <report>.glitches.csv next to the text report.
+// --report FILE with several symbols: FILE's stem + _SYM, one report each.
+static fs::path symbol_report_path(const fs::path& report, const std::string& sym){
+    return report.parent_path() / (report.stem().string() + "_" + sym + report.extension().string());
+}
+static fs::path glitch_table_path(const fs::path& report){
+    fs::path p = report; p.replace_extension(".glitches.csv"); return p;
+}
+
+// Progress lines come from pool tasks: each is formatted whole and handed to
+// stderr in one fwrite, so lines from different files/chunks never interleave.
+static void log_line(const std::string& s){ std::fwrite(s.data(), 1, s.size(), stderr); }
+
 /************** Helpers **************/
 static inline bool in_rth(int h,int m,int s,const Settings& S){
     if(h < S.rth_start_h || h > S.rth_end_h-1) return false;
@@ -136,70 +201,428 @@ static inline bool in_rth(int h,int m,int s,const Settings& S){
 static inline bool is_good_ex(char ex,const Settings& S){ return S.venues.count(ex)>0; }
 
 /************** Fast gz line reader *****/
+// Block reader: inflate into a large buffer, lines handed out as views
+// (valid until the next call). Reads the compressed bytes itself (rather
+// than through gzread) so they are hashed on the way in: content_hash() is
+// hash_file() of the input once getline() has returned false. Multi-member
+// files are read like gzread reads them; bytes after the last member that
+// are not another member are ignored.
 struct GzLine {
-    gzFile f{nullptr};
-    std::string buf;
-    explicit GzLine(const fs::path& p){
-        f = gzopen(p.string().c_str(), "rb");
-        if (f) gzbuffer(f, 1<<20);
-        buf.resize(1<<16);
-    }
-    ~GzLine(){ if(f) gzclose(f); }
+    std::FILE* f{nullptr};
+    z_stream strm{};
+    std::vector<unsigned char> in;
+    std::vector<char> buf;
+    nbbo::ContentHasher hasher;
+    size_t head=0, tail=0; bool eof=false;
+    bool between=true;   // at the start of a member (or of the file)
+    bool members=false;  // a member has ended
+    explicit GzLine(const fs::path& p, size_t block = 4u<<20) : in(1u<<20) {
+        f = std::fopen(p.string().c_str(), "rb");
+        if(f && inflateInit2(&strm, 47)!=Z_OK){ std::fclose(f); f=nullptr; }  // 47: gzip header
+        buf.resize(block);
+    }
+    ~GzLine(){ if(f){ inflateEnd(&strm); std::fclose(f); } }
+    GzLine(const GzLine&) = delete;
+    GzLine& operator=(const GzLine&) = delete;
     bool good() const { return f!=nullptr; }
-    bool getline(std::string& out){
-        out.clear(); if(!f) return false;
+    uint64_t content_hash() const { return hasher.value(); }
+    bool getline(string_view& out){
+        if(!f) return false;
         for(;;){
-            char* r = gzgets(f, buf.data(), (int)buf.size());
-            if(!r) return !out.empty();
-            size_t n = std::strlen(r);
-            if(n && r[n-1]=='\n'){ out.append(r,n-1); return true; }
-            out.append(r,n);
+            const char* p = buf.data()+head; const char* e = buf.data()+tail;
+            const char* nl = nbbo::find_byte(p, e, '\n');
+            if(nl!=e){ out=string_view(p, nl-p); head += (nl-p)+1; return true; }
+            if(eof){
+                if(p==e) return false;
+                out=string_view(p, e-p); head=tail; return true;
+            }
+            if(head>0){ std::memmove(buf.data(), p, e-p); tail-=head; head=0; }
+            if(tail==buf.size()) buf.resize(buf.size()*2);
+            size_t n = inflate_into(buf.data()+tail, std::min<size_t>(buf.size()-tail, 1u<<30));
+            if(n==0) eof=true;
+            tail += n;
         }
     }
+private:
+    // Up to cap inflated bytes; 0 at the end of the input.
+    size_t inflate_into(char* dst, size_t cap){
+        strm.next_out = reinterpret_cast<Bytef*>(dst);
+        strm.avail_out = static_cast<uInt>(cap);
+        while(strm.avail_out>0){
+            if(strm.avail_in==0 && !refill()){
+                if(!between) throw std::runtime_error("gzip truncated");
+                break;
+            }
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            if(ret==Z_STREAM_END){
+                between = members = true;
+                inflateReset(&strm);
+            } else if(ret==Z_DATA_ERROR && between && members){
+                drain();  // trailing bytes: still part of the content hash
+                break;
+            } else if(ret!=Z_OK && ret!=Z_BUF_ERROR){
+                throw std::runtime_error("gzread failed");
+            } else {
+                between = false;
+            }
+        }
+        return cap - strm.avail_out;
+    }
+    bool refill(){
+        size_t n = std::fread(in.data(), 1, in.size(), f);
+        if(std::ferror(f)) throw std::runtime_error("gzip read failed");
+        hasher.update(in.data(), n);
+        strm.next_in = in.data(); strm.avail_in = static_cast<uInt>(n);
+        return n>0;
+    }
+    void drain(){
+        strm.avail_in = 0;
+        while(refill()) strm.avail_in = 0;
+    }
 };
 
-/************** NBBO per-ms bucket ******/
-struct NBBOBucket {
-    uint64_t ms=0;
-    float bestBid=0.f, bestAsk=std::numeric_limits<float>::infinity();
+/************** Quote line parsing ******/
+// Only DATE..QU_COND are used; the 9th view keeps the untouched remainder.
+struct Fields { string_view f[9]; int n=0; void split(string_view l){
+    n = nbbo::split_csv(l, f, 9);
+}};
+
+static bool parse_int32(string_view s, int32_t& out){
+    const char* b = s.data(); const char* e = b + s.size();
+    auto r = std::from_chars(b, e, out);
+    return r.ec == std::errc() && r.ptr == e;
+}
+static bool parse_u64(string_view s, uint64_t& out){
+    const char* b = s.data(); const char* e = b + s.size();
+    auto r = std::from_chars(b, e, out);
+    return r.ec == std::errc() && r.ptr == e;
+}
+
+// One CSV line -> Quote. Returns false for filtered (condition/venue/RTH/date)
+// and malformed lines; the latter are counted in G. The condition and venue
+// bytes are checked before any number is parsed.
+static bool parse_quote_line(string_view line, Fields& fld, const Settings& S, GlitchCounts& G, Quote& q){
+    fld.split(line);
+    if(fld.n<9) return false;
+
+    string_view date=fld.f[0], time=fld.f[1], exs=fld.f[2];
+    string_view sbid=fld.f[3], sbs=fld.f[4], sask=fld.f[5], sas=fld.f[6], qc=fld.f[7];
+
+    if(qc.size()!=1 || qc[0]!='R') return false;
+    if(exs.empty() || !is_good_ex(exs[0],S)) return false;
+
+    uint64_t d64=0; if(!parse_u64(date,d64)) return false;
+    if(S.day_lo && (d64<S.day_lo || d64>S.day_hi)) return false;
+
+    int h=0,m=0,s=0,msec=0; if(!nbbo::parse_hms_ms(time,h,m,s,msec)) return false;
+    if(!in_rth(h,m,s,S)) return false;
+    const int msod = ((h*60+m)*60+s)*1000+msec;
+
+    Px bid, ask; int32_t bs, asz;
+    if(!nbbo::parse_px(sbid,bid) || !nbbo::parse_px(sask,ask) ||
+       !parse_int32(sbs,bs) || !parse_int32(sas,asz)){
+        G.bump(nbbo::Glitch::kParseFail, exs[0], (uint32_t)d64, msod); return false;
+    }
+    if(bid<=0 || ask<=0 || bs<=0 || asz<=0){ G.bump(nbbo::Glitch::kNonposField, exs[0], (uint32_t)d64, msod); return false; }
+
+    q = Quote{nbbo::DayMs::of((uint32_t)d64, msod),bid,ask,bs,asz,exs[0]};
+    return true;
+}
+
+/************** Consolidated NBBO book ***/
+// Latest quote per venue in a flat table (slot_of maps the EX byte to a slot).
+// The best bid/ask venue is maintained incrementally: a quote that beats the
+// current best takes over with a couple of selects and no branch; a full
+// rescan of the (few) slots only happens when the best venue itself backs
+// off, or when its quote is older than --stale-ms at emit time. Ties go to
+// the earlier quote (time priority). The book is cleared at each new date.
+struct VenueQuote {
+    Px bid=0, ask=0;
     int32_t bidSz=0, askSz=0;
-    bool any=false;
-    void reset(uint64_t t){ ms=t; bestBid=0.f; bestAsk=std::numeric_limits<float>::infinity(); bidSz=askSz=0; any=false; }
-    void upd(const Quote& q, GlitchCounts& G, int h){
-        if(q.bid<=0 || q.ask<=0){ G.bump("nonpos_price",h); return; }
-        if(q.ask <= q.bid){ G.bump("locked_crossed",h); return; }
-        if(q.bid > bestBid){ bestBid=q.bid; bidSz=q.bidSize; any=true; }
-        if(q.ask < bestAsk){ bestAsk=q.ask; askSz=q.askSize; any=true; }
-    }
-    bool out(Row& r, float prev_mid, bool set_lr, float& new_mid){
+    int msod=0;          // ms since midnight of the last update
+    uint32_t seq=0;      // arrival order, for time priority at equal prices
+};
+
+struct NBBOBook {
+    std::array<int8_t,256> slot_of;
+    std::vector<VenueQuote> v;
+    uint64_t live=0;     // bit s: slot s holds an unexpired quote
+    int stale_ms=0;      // 0: quotes never expire
+
+    nbbo::DayMs ms;      // current millisecond bucket
+    uint32_t day=0;
+    int cur_msod=0;
+    nbbo::TsClock clock; // ts of emitted rows, per day
+    uint32_t seq=0;
+    bool any=false;      // a quote arrived in this ms
+
+    int bb=-1, ba=-1;    // best venue slots
+    Px bb_px=0, ba_px=std::numeric_limits<Px>::max();
+    bool rescan_bid=false, rescan_ask=false;
+
+    explicit NBBOBook(const Settings& S) : stale_ms(S.stale_ms) {
+        slot_of.fill(-1);
+        for(char c : S.venues){
+            if(v.size()==64) throw std::runtime_error("--ex: at most 64 venues");
+            slot_of[(uint8_t)c] = (int8_t)v.size(); v.emplace_back();
+        }
+    }
+
+    void clear(){
+        live=0; seq=0;
+        bb=ba=-1; bb_px=0; ba_px=std::numeric_limits<Px>::max();
+        rescan_bid=rescan_ask=false;
+    }
+
+    void reset(nbbo::DayMs t){
+        ms=t; any=false;
+        if(!t) return;
+        if(t.day()!=day){ day=t.day(); clock=nbbo::TsClock(day); clear(); }
+        cur_msod=t.ms();
+    }
+
+    void upd(const Quote& q, GlitchCounts& G){
+        if(q.bid<=0 || q.ask<=0){ G.bump(nbbo::Glitch::kNonposPrice, q.ex, day, cur_msod); return; }
+        if(q.ask <= q.bid){ G.bump(nbbo::Glitch::kLockedCrossed, q.ex, day, cur_msod); return; }
+        const int s = slot_of[(uint8_t)q.ex];
+        if(s<0) return;
+        v[s] = VenueQuote{q.bid, q.ask, q.bidSize, q.askSize, cur_msod, ++seq};
+        live |= 1ULL<<s; any=true;
+
+        const bool up_b = q.bid > bb_px, up_a = q.ask < ba_px;
+        rescan_bid |= (s==bb) & !up_b;     // best bid venue backed off or re-quoted
+        rescan_ask |= (s==ba) & !up_a;
+        bb = up_b ? s : bb;  bb_px = up_b ? q.bid : bb_px;
+        ba = up_a ? s : ba;  ba_px = up_a ? q.ask : ba_px;
+    }
+
+    bool stale(const VenueQuote& e) const {
+        return stale_ms>0 && cur_msod - e.msod > stale_ms;
+    }
+
+    void rescan(){
+        int nb=-1, na=-1; Px pb=0, pa=std::numeric_limits<Px>::max();
+        uint32_t tb=0, ta=0;
+        for(uint64_t m=live; m; m&=m-1){
+            const int s=std::countr_zero(m);
+            const VenueQuote& e=v[s];
+            if(stale(e)){ live &= ~(1ULL<<s); continue; }
+            if(rescan_bid && (e.bid>pb || (e.bid==pb && e.seq<tb))){ nb=s; pb=e.bid; tb=e.seq; }
+            if(rescan_ask && (e.ask<pa || (e.ask==pa && e.seq<ta))){ na=s; pa=e.ask; ta=e.seq; }
+        }
+        if(rescan_bid){ bb=nb; bb_px=pb; }
+        if(rescan_ask){ ba=na; ba_px=pa; }
+        rescan_bid=rescan_ask=false;
+    }
+
+    // Mids are carried as bid+ask (2x mid, exact in Px) for the log return.
+    bool out(Row& r, int64_t prev_mid2, bool set_lr, int64_t& new_mid2, GlitchCounts& G){
         if(!any) return false;
-        r.ts=ms; r.bid=bestBid; r.ask=bestAsk;
-        r.bidSize=(float)bidSz; r.askSize=(float)askSz;
-        r.spread=bestAsk-bestBid; r.mid=0.5f*(bestBid+bestAsk);
-        if(set_lr && prev_mid>0.f && r.mid>0.f) r.logret = std::log(r.mid/prev_mid);
+        rescan_bid |= bb>=0 && stale(v[bb]);
+        rescan_ask |= ba>=0 && stale(v[ba]);
+        if(rescan_bid | rescan_ask) rescan();
+        if(bb<0 || ba<0) return false;
+        if(ba_px <= bb_px){ G.bump(nbbo::Glitch::kNbboLockedCrossed, nbbo::GlitchStats::kConsolidated, day, cur_msod); return false; }
+
+        r.ts=clock.at(cur_msod); r.t=ms; r.bid=bb_px; r.ask=ba_px;
+        r.bidSize=v[bb].bidSz; r.askSize=v[ba].askSz;
+        int64_t mid2=(int64_t)bb_px+ba_px;
+        if(set_lr && prev_mid2>0 && mid2>0) r.logret = (float)std::log((double)mid2/(double)prev_mid2);
         else r.logret = std::numeric_limits<float>::quiet_NaN();
-        new_mid=r.mid; return true;
+        new_mid2=mid2; return true;
     }
 };
 
 /************** msbin I/O **************/
-#pragma pack(push,1)
-struct MsBinRow {
-    uint64_t ts;
-    float mid, logret, bidSize, askSize, spread, bid, ask;
+// Format (header, rows, day table) lives in nbbo/msbin.hpp.
+using nbbo::MsBinRow;
+
+// Everything in Settings that changes the bytes Stage A writes. Stored in the
+// msbin header so a cache built under other flags can be told apart.
+static uint64_t stage_a_fingerprint(const Settings& S){
+    std::string k = "v" + std::to_string(nbbo::kMsBinVersion);
+    k += S.clock_grid ? " clock" : " event";
+    if(S.clock_grid && S.ffill) k += " ffill=" + std::to_string(S.max_ffill_gap_ms) + " virtual";
+    k += " rth=" + std::to_string(S.rth_start_h*60+S.rth_start_m) + "-" + std::to_string(S.rth_end_h*60+S.rth_end_m);
+    k += " ex="; for(char c : S.venues) k += c;
+    k += " stale=" + std::to_string(S.stale_ms);
+    if(S.day_lo) k += " days=" + std::to_string(S.day_lo) + ":" + std::to_string(S.day_hi);
+    return nbbo::fnv1a64(k);
+}
+
+// Forward-filled clock grids are always stored virtually (fill rows implied).
+static uint32_t msbin_flags(bool clock, bool ffill, nbbo::MsBinLayout layout){
+    return (clock ? nbbo::kMsBinClockGrid : 0u)
+         | (clock && ffill ? nbbo::kMsBinFfill | nbbo::kMsBinVirtualFill : 0u)
+         | nbbo::msbin_layout_flags(layout);
+}
+static uint32_t fill_cap_ms(const Settings& S){
+    return S.clock_grid && S.ffill ? (uint32_t)std::max(0, S.max_ffill_gap_ms) : 0u;
+}
+
+/************** --no-cache row stream ***/
+// Stage A rows of all inputs, in file order, as column blocks for the Stage C
+// thread. Each row carries its implied fill count (clock+ffill; the same
+// msbin_fill_after a virtual msbin implies), so a block is only handed over
+// once the row after its last one is known, or at the end. Blocks cycle
+// through a fixed pool over two bounded SPSC queues: the parser stalls when
+// all of them are in flight, which bounds memory to kBlocks * kBlockRows rows.
+struct RowBlock {
+    std::vector<uint64_t> ts; std::vector<Px> bid, ask; std::vector<int32_t> bsz, asz;
+    std::vector<float> lr; std::vector<uint32_t> fill;
+    size_t n=0;
+    bool last=false;        // end of the stream
+    explicit RowBlock(size_t cap) : ts(cap), bid(cap), ask(cap), bsz(cap), asz(cap), lr(cap), fill(cap) {}
+    nbbo::MsBinColumns columns(size_t off, size_t m) const {
+        return {m, ts.data()+off, bid.data()+off, ask.data()+off, bsz.data()+off, asz.data()+off, lr.data()+off};
+    }
+};
+
+struct RowStream {
+    static constexpr size_t kBlockRows = 1 << 16, kBlocks = 16;
+    std::vector<std::unique_ptr<RowBlock>> pool;
+    nbbo::SpscQueue<RowBlock*> full{kBlocks}, free{kBlocks};
+    RowBlock* cur=nullptr;
+    uint32_t fill_cap;
+    bool link=false;        // next row continues the current file
+    nbbo::DayMs prev_t;     // time of the last row appended
+
+    explicit RowStream(uint32_t cap) : fill_cap(cap) {
+        for(size_t i=0;i<kBlocks;++i){ pool.push_back(std::make_unique<RowBlock>(kBlockRows)); free.push(pool.back().get()); }
+    }
+    RowBlock* take(){
+        RowBlock* b;
+        if(!free.pop(b)) throw std::runtime_error("row stream aborted");
+        b->n=0; b->last=false; return b;
+    }
+    void append(const MsBinRow& r, nbbo::DayMs t){
+        if(!cur) cur=take();
+        if(cur->n){
+            const size_t p = cur->n-1;
+            if(link && fill_cap) cur->fill[p] = nbbo::msbin_fill_after(prev_t, t, fill_cap);
+            if(cur->n==kBlockRows){
+                if(!full.push(cur)) throw std::runtime_error("row stream aborted");
+                cur=take();
+            }
+        }
+        const size_t i = cur->n++;
+        cur->ts[i]=r.ts; cur->bid[i]=r.bid; cur->ask[i]=r.ask; cur->bsz[i]=r.bidSize; cur->asz[i]=r.askSize;
+        cur->lr[i]=r.logret; cur->fill[i]=0;
+        prev_t=t; link=true;
+    }
+    // Files are separate grids, as their msbins would be: no fill across.
+    void end_file(){ link=false; }
+    void close(){
+        if(!cur) cur=take();
+        cur->last=true;
+        full.push(cur); cur=nullptr;
+    }
+    void abort(){ full.close(); free.close(); }
+};
+
+/************** NBBO -> msbin emitter ***/
+// Per-file NBBO/ffill state downstream of quote parsing. Quotes must arrive in
+// file order; the chunked path hands whole chunks over in order, so the state
+// carried across chunk boundaries is exactly the serial one. Rows go to the
+// file's msbin, or with --no-cache to the shared row stream.
+struct MsBinEmitter {
+    const Settings& S;
+    std::atomic<uint64_t>& p_out;
+    string tag;
+    std::unique_ptr<nbbo::MsBinWriter> bin;
+    RowStream* stream=nullptr;
+    fs::path tail_path;
+    nbbo::TailStats tail;   // saved next to the msbin for Stage B
+
+    NBBOBook bucket;
+    int64_t prev_mid2=0; uint32_t prev_date=0; bool have_prev=false;
+    bool have_prev_row=false;
+    nbbo::DayMs last_emit;
+    uint64_t out_local=0;
+    uint32_t fill_cap=0;
+
+    MsBinEmitter(const Settings& s, std::atomic<uint64_t>& po, const fs::path& csv, const fs::path& msbin)
+    : S(s), p_out(po), tag(csv.filename().string()),
+      bin(std::make_unique<nbbo::MsBinWriter>(msbin, stage_a_fingerprint(s), msbin_flags(s.clock_grid, s.ffill, s.cache_layout), fill_cap_ms(s))),
+      tail_path(nbbo::tail_sidecar_path(msbin)), bucket(s), fill_cap(fill_cap_ms(s)) {
+        fs::remove(tail_path);
+        bucket.reset({});
+    }
+    MsBinEmitter(const Settings& s, std::atomic<uint64_t>& po, const fs::path& csv, RowStream& st)
+    : S(s), p_out(po), tag(csv.filename().string()), stream(&st), bucket(s) {
+        bucket.reset({});
+    }
+
+    void put(const Row& r){
+        const MsBinRow m{ r.ts,r.bid,r.ask,r.bidSize,r.askSize,r.logret };
+        if(stream){ stream->append(m, r.t); return; }
+        bin->append(m);
+        tail.add(r.logret);
+    }
+
+    void write(const Row& r){
+        put(r);
+        if((++out_local % S.log_every_out)==0){
+            auto tot = p_out.fetch_add(S.log_every_out, std::memory_order_relaxed) + S.log_every_out;
+            log_line("[stageA] " + tag + " out=" + std::to_string(tot) + "\n");
+        }
+    }
+
+    void on_quote(const Quote& q, GlitchCounts& G){
+        if(!bucket.ms) bucket.reset(q.t);
+        if(q.t != bucket.ms){
+            Row r; int64_t new_mid2=0;
+            bool ok=bucket.out(r, have_prev?prev_mid2:0, true, new_mid2, G);
+            if(ok){
+                if(!have_prev || r.t.day()!=prev_date) r.logret = std::numeric_limits<float>::quiet_NaN();
+
+                // Virtual grid: the fill rows since the last quote follow from
+                // the two timestamps; only their zero returns are counted.
+                if(fill_cap && have_prev_row) tail.add(0.0f, nbbo::msbin_fill_after(last_emit, r.t, fill_cap));
+
+                write(r);
+                prev_mid2=new_mid2; prev_date=r.t.day(); have_prev=true;
+                last_emit=r.t; have_prev_row=true;
+            }
+            bucket.reset(q.t);
+        }
+        bucket.upd(q,G);
+    }
+
+    void finish(GlitchCounts& G){
+        if(bucket.ms){
+            Row r; int64_t new_mid2=0;
+            bool ok=bucket.out(r, have_prev?prev_mid2:0, true, new_mid2, G);
+            if(ok){
+                if(!have_prev || r.t.day()!=prev_date) r.logret = std::numeric_limits<float>::quiet_NaN();
+                if(fill_cap && have_prev_row) tail.add(0.0f, nbbo::msbin_fill_after(last_emit, r.t, fill_cap));
+                put(r);
+            }
+        }
+        if(stream){ stream->end_file(); return; }
+        bin->close();
+        tail.save(tail_path, bin->header());
+    }
 };
-#pragma pack(pop)
 
 /************** Pipeline ***************/
 struct Pipeline {
     Settings S;
+    nbbo::TaskPool& pool;   // shared by every symbol's stages
+    std::atomic<int>& ingesting;  // CSVs in Stage A ingest now, all symbols
     std::mutex gl_mu;
-    GlitchCounts gl_total;
+    GlitchCounts gl_total{S};
 
     std::atomic<uint64_t> p_in{0}, p_out{0};
 
+    // --days subsets get their own cache so they never shadow full-file msbins.
+    fs::path cache_subdir_for(bool clock) const {
+        fs::path p = S.cache_dir / (clock ? "ms_clock" : "ms_event");
+        if(S.day_lo) p /= "days_" + std::to_string(S.day_lo) + "_" + std::to_string(S.day_hi);
+        return p;
+    }
     fs::path cache_subdir() const {
-        return S.cache_dir / (S.clock_grid ? "ms_clock" : "ms_event");
+        return cache_subdir_for(S.clock_grid);
     }
 
     static bool starts_with(const std::string& s, const std::string& p){
@@ -231,139 +654,179 @@ struct Pipeline {
         return cache_subdir() / (base + ".msbin");
     }
 
-    // Stage A: CSV.gz -> .msbin (event or clock depending on flags)
-    void process_file_to_msbin(const fs::path& csv, const fs::path& msbin){
-        GlitchCounts G;
-        fs::create_directories(msbin.parent_path());
-        std::ofstream bin(msbin, std::ios::binary);
-        if(!bin) throw std::runtime_error("open msbin for write failed: " + msbin.string());
+    // Counts one file in `ingesting` while it lives.
+    struct IngestGuard {
+        std::atomic<int>& n;
+        explicit IngestGuard(std::atomic<int>& c) : n(c) { ++n; }
+        ~IngestGuard(){ --n; }
+    };
+
+    // Chunk tasks a file may keep busy: its share of the pool among every
+    // file being ingested right now (all symbols), at most cap.
+    int chunk_share(int cap) const {
+        return std::max(1, std::min(cap, pool.size() / std::max(1, ingesting.load())));
+    }
+
+    // Stage A: CSV.gz -> .msbin (event or clock depending on flags).
+    // A file whose share of the pool is more than one worker (or --days) goes
+    // through the gzip seek index, with up to max_chunk_workers chunk tasks.
+    // Returns the content hash of csv (hash_file), taken from the reads the
+    // ingest or the index build did anyway.
+    uint64_t process_file_to_msbin(const fs::path& csv, const fs::path& msbin, int max_chunk_workers){
+        IngestGuard busy(ingesting);
+        GlitchCounts G(S);
+        MsBinEmitter em(S, p_out, csv, msbin);
+
+        nbbo::GzIndex idx;
+        const int chunk_workers = chunk_share(max_chunk_workers);
+        bool indexed = (chunk_workers>1 || S.day_lo) && load_or_build_index(csv, idx);
+        uint64_t hash;
+        if(indexed){ ingest_chunks_parallel(csv, idx, max_chunk_workers, em, G); hash = idx.content_hash(); }
+        else         hash = ingest_serial(csv, em, G);
+
+        em.finish(G);
+        std::lock_guard<std::mutex> lk(gl_mu);
+        gl_total.merge(G);
+        return hash;
+    }
+
+    void log_in(const fs::path& csv, uint64_t n){
+        auto tot = p_in.fetch_add(n, std::memory_order_relaxed) + n;
+        if(tot / S.log_every_in != (tot - n) / S.log_every_in)
+            log_line("[stageA] " + csv.filename().string() + " in=" + std::to_string(tot) + "\n");
+    }
 
+    // Returns the content hash of csv.
+    uint64_t ingest_serial(const fs::path& csv, MsBinEmitter& em, GlitchCounts& G){
         GzLine gz(csv);
         if(!gz.good()) throw std::runtime_error("open gzip failed: " + csv.string());
-        string line; gz.getline(line); // header
-
-        NBBOBucket bucket; bucket.reset(0);
-        float prev_mid=0.f; uint32_t prev_date=0; bool have_prev=false;
-        Row prev_row{}; bool have_prev_row=false;
-        uint64_t last_emit=0;
-
-        struct Fields { string f[14]; int n=0; void split(const string& l){
-            n=0; int start=0; int L=(int)l.size();
-            for(int i=0;i<L;++i){ if(l[i]==','){ f[n++]=string(l.data()+start,i-start); start=i+1; if(n==13) break; } }
-            f[n++]=string(l.data()+start, L-start);
-        }} fld;
-
-        uint64_t in_local=0, out_local=0;
-
-        auto parse_float = [](std::string_view s, float& out){
-            char buf[64]; if (s.size() >= sizeof(buf)) return false;
-            std::memcpy(buf, s.data(), s.size()); buf[s.size()] = '\0';
-            char* end = nullptr; errno = 0;
-            float v = std::strtof(buf, &end);
-            if (errno != 0 || end != buf + s.size()) return false;
-            out = v; return true;
-        };
-        auto parse_int32 = [](std::string_view s, int32_t& out){
-            const char* b = s.data(); const char* e = b + s.size();
-            auto r = std::from_chars(b, e, out);
-            return r.ec == std::errc() && r.ptr == e;
-        };
-        auto parse_u64 = [](std::string_view s, uint64_t& out){
-            const char* b = s.data(); const char* e = b + s.size();
-            auto r = std::from_chars(b, e, out);
-            return r.ec == std::errc() && r.ptr == e;
-        };
+        string_view line; gz.getline(line); // header
 
+        Fields fld; Quote q;
+        uint64_t in_local=0;
         while(gz.getline(line)){
-            ++in_local;
-            if((in_local % S.log_every_in)==0){
-                auto tot = p_in.fetch_add(S.log_every_in, std::memory_order_relaxed) + S.log_every_in;
-                std::cerr << "[stageA] " << csv.filename().string() << " in=" << tot << "\n";
-            }
-
-            fld.split(line);
-            if(fld.n<9) continue;
-
-            string_view date=fld.f[0], time=fld.f[1], exs=fld.f[2];
-            string_view sbid=fld.f[3], sbs=fld.f[4], sask=fld.f[5], sas=fld.f[6], qc=fld.f[7];
+            if((++in_local % S.log_every_in)==0) log_in(csv, S.log_every_in);
+            if(parse_quote_line(line, fld, S, G, q)) em.on_quote(q, G);
+        }
+        return gz.content_hash();
+    }
 
-            if(qc.size()!=1 || qc[0]!='R') continue;
-            if(exs.empty() || !is_good_ex(exs[0],S)) continue;
+    fs::path gz_index_path_for_csv(const fs::path& csv) const {
+        auto name = csv.filename().string();
+        return S.cache_dir / "gzidx" / (name.substr(0, name.find(".csv.gz")) + ".gzidx");
+    }
 
-            int h=0,m=0,s=0; if(!parse_time_hms(string(time.substr(0,8)),h,m,s)) continue;
-            if(!in_rth(h,m,s,S)) continue;
+    // Load the seek index for csv, building it (one inflate pass) if missing or stale.
+    bool load_or_build_index(const fs::path& csv, nbbo::GzIndex& idx){
+        auto ip = gz_index_path_for_csv(csv);
+        if(nbbo::GzIndex::load(ip, csv, idx)) return true;
+        try{
+            auto t0 = std::chrono::steady_clock::now();
+            log_line("[gzidx] building " + ip.filename().string() + "\n");
+            idx = nbbo::GzIndex::build(csv, S.gz_index_span);
+            idx.save(ip);
+            std::ostringstream os;
+            os << "[gzidx] " << ip.filename().string() << " points=" << idx.points().size()
+               << " bytes_out=" << idx.total_out() << " elapsed="
+               << std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count() << "s\n";
+            log_line(os.str());
+            return true;
+        } catch(const std::exception& e){
+            log_line("[gzidx] " + csv.filename().string() + ": " + e.what() + " -> serial ingest\n");
+            return false;
+        }
+    }
 
-            float bid, ask; int32_t bs, asz;
-            if(!parse_float(sbid,bid) || !parse_float(sask,ask) ||
-               !parse_int32(sbs,bs) || !parse_int32(sas,asz)){
-                G.bump("parse_fail",h); continue;
+    // Split one file into runs of access points (~chunk_bytes each), one pool
+    // task per chunk to inflate+parse it into a quote vector; this thread feeds
+    // them to the emitter strictly in order. Tasks are submitted at most
+    // 2*chunk_share(W) chunks ahead of the emitter, which bounds memory; the
+    // share is taken again at every step, so the window narrows while other
+    // files (of any symbol) start and widens as they finish. A chunk no task has
+    // started by the time the emitter needs it is parsed right here. If the
+    // emitter throws (bad chunk, write error), the chunks not started yet are
+    // claimed so their tasks return at once, and the task group waits out the
+    // running ones before the slots they use go away.
+    void ingest_chunks_parallel(const fs::path& csv, const nbbo::GzIndex& idx, int W,
+                                MsBinEmitter& em, GlitchCounts& G){
+        const auto& pts = idx.points();
+        auto [p_lo, p_hi] = S.day_lo ? idx.point_range_for_days(S.day_lo, S.day_hi)
+                                     : std::pair<size_t,size_t>{0, pts.size()};
+        std::vector<std::pair<size_t,size_t>> chunks;
+        for(size_t i=p_lo; i<p_hi;){
+            size_t j=i+1;
+            while(j<p_hi && pts[j].out - pts[i].out < S.chunk_bytes) ++j;
+            chunks.emplace_back(i,j); i=j;
+        }
+        log_line("[stageA] " + csv.filename().string() + " chunks=" + std::to_string(chunks.size())
+                 + " workers=" + std::to_string(chunk_share(W)) + "\n");
+
+        // Slots live until every task is done: a task that finds its chunk
+        // already claimed still looks at the slot.
+        struct Slot {
+            std::vector<Quote> quotes; std::unique_ptr<GlitchCounts> G;
+            std::atomic<bool> claimed{false}; bool ready=false; std::exception_ptr err;
+            explicit Slot(const Settings& s) : G(std::make_unique<GlitchCounts>(s)) {}
+        };
+        std::vector<std::unique_ptr<Slot>> slots(chunks.size());
+        auto window = [&]{ return 2*(size_t)chunk_share(W); };
+        std::mutex mu; std::condition_variable cv;
+
+        auto parse = [&](size_t c){
+            Slot& sl = *slots[c];
+            if(sl.claimed.exchange(true)) return;
+            try{
+                auto [a,b] = chunks[c];
+                Fields fld; Quote q;
+                sl.quotes.reserve((idx.end_of(b) - pts[a].out) / 64);
+                nbbo::GzRangeLines lines(csv, pts[a], idx.end_of(b));
+                string_view line; bool header = pts[a].out==0;
+                uint64_t in_local=0;
+                while(lines.next(line)){
+                    if(header){ header=false; continue; }
+                    ++in_local;
+                    if(parse_quote_line(line, fld, S, *sl.G, q)) sl.quotes.push_back(q);
+                }
+                log_in(csv, in_local);
+            } catch(...){
+                sl.err = std::current_exception();
             }
-            if(bid<=0 || ask<=0 || bs<=0 || asz<=0){ G.bump("nonpos_field",h); continue; }
-
-            int msec=0;
-            if(time.size()>=12){
-                int32_t tms=0; parse_int32(time.substr(9,3), tms); msec=tms;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                sl.ready = true;
             }
-            uint64_t d64=0; if(!parse_u64(date,d64)) continue;
-            uint64_t ts = d64*1000000000ULL + (uint64_t)h*10000000ULL + (uint64_t)m*100000ULL + (uint64_t)s*1000ULL + (uint64_t)msec;
-
-            if(bucket.ms==0) bucket.reset(ts);
-
-            if(ts != bucket.ms){
-                Row r; float new_mid=0.f;
-                bool ok=bucket.out(r, have_prev?prev_mid:0.f, true, new_mid);
-                if(ok){
-                    if(!have_prev || nbbo::ymd(r.ts)!=prev_date) r.logret = std::numeric_limits<float>::quiet_NaN();
-
-                    if(S.clock_grid && S.ffill && have_prev_row){
-                        if(nbbo::same_day(last_emit,r.ts)){
-                            int gap = nbbo::ms_since_midnight(r.ts) - nbbo::ms_since_midnight(last_emit) - 1;
-                            if(gap>0 && gap<=S.max_ffill_gap_ms){
-                                uint64_t t=last_emit;
-                                for(int g=0; g<gap; ++g){
-                                    t=nbbo::inc_ms(t);
-                                    Row f=prev_row; f.ts=t; f.logret=0.0f;
-                                    MsBinRow br{ f.ts,f.mid,f.logret,f.bidSize,f.askSize,f.spread,f.bid,f.ask };
-                                    bin.write((char*)&br, sizeof(br));
-                                    if((++out_local % S.log_every_out)==0){
-                                        auto tot = p_out.fetch_add(S.log_every_out, std::memory_order_relaxed) + S.log_every_out;
-                                        std::cerr << "[stageA] " << csv.filename().string() << " out=" << tot << "\n";
-                                    }
-                                    last_emit=t;
-                                }
-                            } else if(gap>S.max_ffill_gap_ms) {
-                                have_prev=false;
-                            }
-                        } else have_prev=false;
-                    }
+            cv.notify_all();
+        };
 
-                    MsBinRow br{ r.ts,r.mid,r.logret,r.bidSize,r.askSize,r.spread,r.bid,r.ask };
-                    bin.write((char*)&br, sizeof(br));
-                    if((++out_local % S.log_every_out)==0){
-                        auto tot = p_out.fetch_add(S.log_every_out, std::memory_order_relaxed) + S.log_every_out;
-                        std::cerr << "[stageA] " << csv.filename().string() << " out=" << tot << "\n";
-                    }
-                    prev_mid=new_mid; prev_date=nbbo::ymd(r.ts); have_prev=true;
-                    last_emit=r.ts; prev_row=r; have_prev_row=true;
-                }
-                bucket.reset(ts);
+        nbbo::TaskGroup tasks(pool);
+        size_t submitted=0;
+        auto submit_upto = [&](size_t n){
+            for(n=std::min(n, chunks.size()); submitted<n; ++submitted){
+                slots[submitted] = std::make_unique<Slot>(S);
+                tasks.run([&parse, c=submitted]{ parse(c); });
             }
-            Quote q{ts,bid,ask,bs,asz,exs[0]};
-            bucket.upd(q,G,h);
-        }
-        if(bucket.ms){
-            Row r; float new_mid=0.f;
-            bool ok=bucket.out(r, have_prev?prev_mid:0.f, true, new_mid);
-            if(ok){
-                if(!have_prev || nbbo::ymd(r.ts)!=prev_date) r.logret = std::numeric_limits<float>::quiet_NaN();
-                MsBinRow br{ r.ts,r.mid,r.logret,r.bidSize,r.askSize,r.spread,r.bid,r.ask };
-                bin.write((char*)&br, sizeof(br));
+        };
+        submit_upto(window());
+        try{
+            for(size_t c=0; c<chunks.size(); ++c){
+                parse(c);
+                {
+                    std::unique_lock<std::mutex> lk(mu);
+                    cv.wait(lk, [&]{ return slots[c]->ready; });
+                }
+                Slot& sl = *slots[c];
+                if(sl.err) std::rethrow_exception(sl.err);
+                G.merge(*sl.G);
+                for(const auto& q : sl.quotes) em.on_quote(q, G);
+                sl.G.reset(); std::vector<Quote>().swap(sl.quotes);
+                submit_upto(c + 1 + window());
             }
+        } catch(...){
+            for(size_t c=0; c<submitted; ++c) slots[c]->claimed = true;
+            try{ tasks.wait(); } catch(...){}
+            throw;
         }
-
-        bin.close();
-        std::lock_guard<std::mutex> lk(gl_mu);
-        gl_total.merge(G);
+        tasks.wait();
     }
 
     // List CSVs (optional). Empty result is acceptable now.
@@ -390,23 +853,95 @@ struct Pipeline {
         return v;
     }
 
-    // From CSV list: map to expected msbins in the appropriate cache subdir.
-    bool msbins_from_csv_list(const std::vector<fs::path>& csv_files, std::vector<fs::path>& out){
+    // Stage A fingerprint of the event or clock cache under the current flags.
+    uint64_t fingerprint_for(bool clock) const {
+        Settings C = S; C.clock_grid=clock; C.event_grid=!clock; C.ffill = clock && S.ffill;
+        return stage_a_fingerprint(C);
+    }
+
+    // msbin for `csv` in `sub` is current: input unchanged per the manifest,
+    // and both the manifest entry and the msbin header carry fingerprint fp.
+    bool msbin_current(const fs::path& csv, const fs::path& msb, uint64_t fp,
+                       nbbo::CacheManifest& man, nbbo::InputStamp& stamp){
+        const auto name = csv.filename().string();
+        stamp = nbbo::stat_input(csv);
+        if(!man.input_unchanged(name, csv, stamp)) return false;
+        const auto* e = man.find(name);
+        nbbo::MsBinHeader h;
+        return e->fingerprint==fp && e->msbin==msb.filename().string()
+            && nbbo::MsBinReader::probe(msb, &h) && h.fingerprint==fp;
+    }
+
+    // The layout is not part of the fingerprint, so a current msbin in the
+    // other layout is transposed in place rather than rebuilt.
+    void relayout_if_needed(const fs::path& msb){
+        nbbo::MsBinHeader h;
+        if(!nbbo::MsBinReader::probe(msb, &h)) return;
+        if(nbbo::msbin_layout_of(h.flags) == S.cache_layout) return;
+        std::cerr << "[cache] " << msb.filename().string() << " -> " << nbbo::msbin_layout_name(S.cache_layout) << " layout\n";
+        fs::path tmp = msb.string() + ".relayout";
+        nbbo::msbin_transcode(msb, tmp, S.cache_layout);
+        fs::rename(tmp, msb);
+    }
+
+    // From CSV list: reuse every msbin that is still current, rebuild the rest
+    // (new inputs, changed inputs, or built under other Stage A settings).
+    // With --clock --ffill, a stale clock msbin whose event msbin is current is
+    // synthesized from it instead of re-reading the CSV.
+    void msbins_from_csv_list(const std::vector<fs::path>& csv_files, std::vector<fs::path>& out){
         out.clear();
-        if(csv_files.empty()) return false;
         auto sub = cache_subdir();
-        if(!fs::exists(sub)) return false;
+        auto man = nbbo::CacheManifest::load(sub);
+        const uint64_t fp = fingerprint_for(S.clock_grid);
+
+        std::vector<fs::path> todo;
         for(const auto& csv : csv_files){
             auto msb = msbin_path_for_csv(csv);
-            if(!fs::exists(msb)) return false;
+            nbbo::InputStamp st;
+            if(!msbin_current(csv, msb, fp, man, st)) todo.push_back(csv);
+            else relayout_if_needed(msb);
             out.push_back(msb);
         }
         sort_chronologically(S, out);
-        return !out.empty();
+
+        if(todo.empty()){
+            std::cerr << "▶ [stageA] skipped: all " << csv_files.size() << " msbins current in " << sub << "\n";
+            if(man.dirty()) man.save();
+            return;
+        }
+        std::cerr << "▶ [stageA] build: " << todo.size() << "/" << csv_files.size()
+                  << " msbins stale or missing in " << sub << " (reusing " << (csv_files.size()-todo.size()) << ")\n";
+
+        if(S.clock_grid && S.ffill){
+            auto ev_sub = cache_subdir_for(false);
+            auto ev_man = nbbo::CacheManifest::load(ev_sub);
+            const uint64_t ev_fp = fingerprint_for(false);
+            std::vector<fs::path> from_event, rest;
+            std::vector<std::pair<fs::path, nbbo::InputStamp>> converted;
+            for(const auto& csv : todo){
+                auto ev_msb = ev_sub / msbin_path_for_csv(csv).filename();
+                nbbo::InputStamp st;
+                if(msbin_current(csv, ev_msb, ev_fp, ev_man, st)){ from_event.push_back(ev_msb); converted.emplace_back(csv, st); }
+                else rest.push_back(csv);
+            }
+            if(!from_event.empty()){
+                std::cerr << "▶ [ffill-from-event] synthesizing " << from_event.size()
+                          << " ms_clock files from current ms_event msbins with gap<=" << S.max_ffill_gap_ms << "ms\n";
+                std::vector<fs::path> produced;
+                event_to_clock_ffill_parallel(from_event, produced);
+                for(const auto& [csv, st] : converted)
+                    man.put(csv.filename().string(), {st, fp, msbin_path_for_csv(csv).filename().string()});
+                man.save();
+            }
+            todo.swap(rest);
+        }
+
+        parallel_csv_to_msbin(todo, man);
     }
 
     // Generic scan of a specific subdir for msbins matching sym_root/years.
-    bool msbins_from_subdir(const fs::path& subdir, std::vector<fs::path>& out){
+    // Only msbins built under fingerprint fp are returned.
+    bool msbins_from_subdir(const fs::path& subdir, uint64_t fp, std::vector<fs::path>& out){
         out.clear();
         std::error_code ec;
         if(!fs::exists(subdir, ec) || !fs::is_directory(subdir, ec)) return false;
@@ -420,6 +955,15 @@ struct Pipeline {
             if(yr<0) continue;
             if(S.year_lo && yr<S.year_lo) continue;
             if(S.year_hi && yr>S.year_hi) continue;
+            nbbo::MsBinHeader h;
+            if(!nbbo::MsBinReader::probe(p, &h)){
+                std::cerr << "[cache] skip " << nm << " (not a complete v2 msbin)\n";
+                continue;
+            }
+            if(h.fingerprint != fp){
+                std::cerr << "[cache] skip " << nm << " (built with other Stage A settings)\n";
+                continue;
+            }
             out.push_back(p);
         }
         sort_chronologically(S, out);
@@ -428,11 +972,21 @@ struct Pipeline {
 
     // Cache-only: scan cache subdir for msbins (depending on mode).
     bool msbins_from_cache_only(std::vector<fs::path>& out){
-        return msbins_from_subdir(cache_subdir(), out);
+        return msbins_from_subdir(cache_subdir(), fingerprint_for(S.clock_grid), out);
     }
 
     // Build Stage A in parallel into the correct cache subdir (event or clock)
-    void parallel_csv_to_msbin(const std::vector<fs::path>& files){
+    // Whole files as pool tasks; workers not taken by files go to intra-file
+    // chunk tasks, split over all files in ingest at the time, whichever
+    // symbol they belong to (e.g. 1 file x 16 workers -> one file ingested
+    // 32 chunks ahead; 4 symbols x 1 file -> 8 chunks ahead each).
+    // Each finished msbin is recorded in `man` right away, so an interrupted
+    // run keeps the files it completed.
+    void parallel_csv_to_msbin(const std::vector<fs::path>& files, nbbo::CacheManifest& man){
+        const uint64_t fp = fingerprint_for(S.clock_grid);
+        std::mutex man_mu;
+        int W = std::max(1, S.workers);
+        int file_threads = std::max(1, std::min<int>((int)files.size(), W));
         std::atomic<size_t> idx{0};
         auto worker = [&](){
             while(true){
@@ -441,179 +995,279 @@ struct Pipeline {
                 const auto& csv = files[i];
                 auto out = msbin_path_for_csv(csv);
                 fs::create_directories(out.parent_path());
-                std::cerr << "[stageA] " << (i+1) << "/" << files.size()
-                          << " -> " << out.filename().string() << "\n";
-                process_file_to_msbin(csv, out);
+                log_line("[stageA] " + std::to_string(i+1) + "/" + std::to_string(files.size())
+                         + " -> " + out.filename().string() + "\n");
+                nbbo::InputStamp st = nbbo::stat_input(csv);
+                st.hash = process_file_to_msbin(csv, out, W);
+                std::lock_guard<std::mutex> lk(man_mu);
+                man.put(csv.filename().string(), {st, fp, out.filename().string()});
+                man.save();
             }
         };
-        std::vector<std::thread> pool;
-        int W = std::max(1, S.workers);
-        for(int i=0;i<W;++i) pool.emplace_back(worker);
-        for(auto& t: pool) t.join();
+        nbbo::TaskGroup tasks(pool);
+        for(int i=0;i<file_threads;++i) tasks.run(worker);
+        tasks.wait();
     }
 
     /******** Event→Clock ffill fallback (from ms_event to ms_clock) ********/
+    // The virtual clock grid stores the event rows as they are; the fills
+    // only show up as zero returns in the tail sidecar. Work is split per
+    // (file, day) so a few large yearly files still use every worker: each
+    // day is read into its own buffer and counted on its own, then appended
+    // with one write once all earlier days of its file are in.
     void event_to_clock_ffill_parallel(const std::vector<fs::path>& ms_event_bins,
                                        std::vector<fs::path>& ms_clock_bins_out) {
         ms_clock_bins_out.clear();
-        fs::path outdir = S.cache_dir / "ms_clock";
+        fs::path outdir = cache_subdir_for(true);
         fs::create_directories(outdir);
 
-        std::atomic<size_t> idx{0};
-
-        auto convert_one = [&](const fs::path& in_path){
-            std::ifstream in(in_path, std::ios::binary);
-            if(!in) throw std::runtime_error("cannot open ms_event for read: " + in_path.string());
-            fs::path out_path = outdir / in_path.filename();
-            std::ofstream out(out_path, std::ios::binary);
-            if(!out) throw std::runtime_error("cannot open ms_clock for write: " + out_path.string());
-
-            MsBinRow prev{}; bool have_prev=false;
-            uint64_t last_emit_ts=0;
-            MsBinRow r{};
-            uint64_t wrote=0, read=0;
-
-            while(in.read((char*)&r, sizeof(r))){
-                ++read;
-                if(have_prev){
-                    if(nbbo::same_day(last_emit_ts, r.ts)){
-                        int gap = nbbo::ms_since_midnight(r.ts) - nbbo::ms_since_midnight(last_emit_ts) - 1;
-                        if(gap>0 && gap<=S.max_ffill_gap_ms){
-                            uint64_t t = last_emit_ts;
-                            for(int g=0; g<gap; ++g){
-                                t = nbbo::inc_ms(t);
-                                MsBinRow f = prev;
-                                f.ts = t;
-                                f.logret = 0.0f;
-                                out.write((char*)&f, sizeof(f));
-                                if((++wrote % 10'000'000ULL)==0){
-                                    std::cerr << "[ffill-from-event] " << in_path.filename().string()
-                                              << " wrote=" << wrote << "\n";
-                                }
-                            }
-                        }
-                    }
-                }
-                out.write((char*)&r, sizeof(r));
-                if((++wrote % 10'000'000ULL)==0){
-                    std::cerr << "[ffill-from-event] " << in_path.filename().string()
-                              << " wrote=" << wrote << "\n";
-                }
-
-                prev = r; have_prev = true; last_emit_ts = r.ts;
-            }
-            out.close();
-            std::cerr << "[ffill-from-event] done " << in_path.filename().string()
-                      << " (+read=" << read << ", wrote=" << wrote << ") -> " << out_path.filename().string() << "\n";
-            return out_path;
+        Settings C = S; C.clock_grid=true; C.event_grid=false; C.ffill=true;
+        const uint64_t fp = stage_a_fingerprint(C);
+        const uint32_t cap = fill_cap_ms(C);
+
+        struct DayOut { std::vector<MsBinRow> rows; nbbo::TailStats tail; uint64_t fills=0; };
+        struct FileConv {
+            fs::path out_path, tail_path;
+            std::unique_ptr<nbbo::MsBinWriter> out;
+            nbbo::TailStats tail;
+            uint64_t fills=0;
+            size_t days=0, next_day=0;
+            std::map<size_t, DayOut> ready;   // finished out of order
+            std::mutex mu;
         };
+        struct DayTask { size_t file, day; uint64_t first, last; };
+
+        std::vector<FileConv> files(ms_event_bins.size());
+        std::vector<DayTask> tasks;
+        auto finish_file = [&](size_t f){
+            FileConv& fc = files[f];
+            fc.tail.add(0.0f, fc.fills);
+            fc.out->close();
+            fc.tail.save(fc.tail_path, fc.out->header());
+            std::ostringstream os;
+            os << "[ffill-from-event] done " << ms_event_bins[f].filename().string()
+               << " (rows=" << fc.out->rows() << ", days=" << fc.days << ", implied fills=" << fc.fills
+               << ") -> " << fc.out_path.filename().string() << "\n";
+            log_line(os.str());
+            fc.out.reset();
+        };
+        for(size_t f=0; f<ms_event_bins.size(); ++f){
+            FileConv& fc = files[f];
+            fc.out_path = outdir / ms_event_bins[f].filename();
+            fc.tail_path = nbbo::tail_sidecar_path(fc.out_path);
+            fs::remove(fc.tail_path);
+            fc.out = std::make_unique<nbbo::MsBinWriter>(fc.out_path, fp, msbin_flags(true, true, S.cache_layout), cap);
+            nbbo::MsBinReader in(ms_event_bins[f]);
+            fc.days = in.days().size();
+            for(size_t d=0; d<fc.days; ++d){
+                const auto& e = in.days()[d];
+                tasks.push_back({f, d, e.first_row, e.first_row + e.row_count});
+            }
+            if(fc.days==0) finish_file(f);
+        }
 
-        int W = std::max(1, S.workers);
-        std::mutex mu_append;
-        std::vector<fs::path> produced(ms_event_bins.size());
-
+        std::atomic<size_t> next{0};
+        std::exception_ptr err; std::mutex err_mu;
         auto worker = [&](){
+            size_t open_file = SIZE_MAX;
+            std::unique_ptr<nbbo::MsBinReader> in;
             while(true){
-                size_t i = idx.fetch_add(1);
-                if(i>=ms_event_bins.size()) break;
-                const auto& in_path = ms_event_bins[i];
-                auto out_path = convert_one(in_path);
-                std::lock_guard<std::mutex> lk(mu_append);
-                produced[i] = out_path;
+                size_t i = next.fetch_add(1);
+                if(i>=tasks.size()) break;
+                const DayTask& t = tasks[i];
+                try{
+                    if(t.file != open_file){
+                        in = std::make_unique<nbbo::MsBinReader>(ms_event_bins[t.file]);
+                        open_file = t.file;
+                    }
+                    DayOut d;
+                    d.rows.resize((size_t)(t.last - t.first));
+                    in->read(t.first, d.rows.size(), d.rows.data());
+                    nbbo::DayMs prev;
+                    for(size_t k=0;k<d.rows.size();++k){
+                        const nbbo::DayMs cur = nbbo::to_day_ms(d.rows[k].ts);
+                        if(k) d.fills += nbbo::msbin_fill_after(prev, cur, cap);
+                        prev = cur;
+                        d.tail.add(d.rows[k].logret);
+                    }
+
+                    FileConv& fc = files[t.file];
+                    std::lock_guard<std::mutex> lk(fc.mu);
+                    fc.ready.emplace(t.day, std::move(d));
+                    for(auto it = fc.ready.find(fc.next_day); it != fc.ready.end(); it = fc.ready.find(fc.next_day)){
+                        fc.out->append(it->second.rows.data(), it->second.rows.size());
+                        fc.tail.merge(it->second.tail);
+                        fc.fills += it->second.fills;
+                        fc.ready.erase(it);
+                        ++fc.next_day;
+                    }
+                    if(fc.next_day==fc.days && fc.out) finish_file(t.file);
+                } catch(...){
+                    std::lock_guard<std::mutex> lk(err_mu);
+                    if(!err) err = std::current_exception();
+                }
             }
         };
 
-        std::vector<std::thread> pool;
-        for(int t=0;t<W;++t) pool.emplace_back(worker);
-        for(auto& t: pool) t.join();
+        const int W = std::max(1, std::min<int>(S.workers, (int)std::max<size_t>(1, tasks.size())));
+        nbbo::TaskGroup group(pool);
+        for(int t=0;t<W;++t) group.run(worker);
+        group.wait();
+        if(err) std::rethrow_exception(err);
 
-        for(const auto& p : produced) if(!p.empty()) ms_clock_bins_out.push_back(p);
+        for(const auto& fc : files) ms_clock_bins_out.push_back(fc.out_path);
         sort_chronologically(S, ms_clock_bins_out);
     }
 
-    /******** Fast tail-quantile winsor (exact for extreme tails) ********/
+    /******** Winsor cutoffs: exact radix select over Stage A tail sidecars ********/
+    // Ranks are floor(q*N) over the N finite log returns, as before. Files
+    // with a current .tail sidecar cost no read. The rest are scanned once per
+    // (file, day) to rebuild their sidecar; only files whose sidecar folded to
+    // coarse bins are scanned a second time, for the low 16 key bits of the two
+    // target bins. Per-task and per-thread counts are summed after join.
     void tail_quantiles_parallel(const std::vector<fs::path>& msbins, double& cut_lo, double& cut_hi){
-        using MaxHeap = std::priority_queue<float>; // keep smallest L values (max-heap)
-        using MinHeap = std::priority_queue<float, std::vector<float>, std::greater<float>>; // keep largest L values
-        const size_t L = 200'000; // adjust if you like; still tiny
-
-        std::atomic<size_t> idx{0};
-        std::atomic<unsigned long long> N_finite{0};
-
-        MaxHeap global_lows;  MinHeap global_highs;
-        std::mutex mu;
-
-        auto push_low = [&](MaxHeap& hp, float v){
-            if(hp.size()<L) hp.push(v);
-            else if(v < hp.top()){ hp.pop(); hp.push(v); }
-        };
-        auto push_high = [&](MinHeap& hp, float v){
-            if(hp.size()<L) hp.push(v);
-            else if(v > hp.top()){ hp.pop(); hp.push(v); }
+        constexpr size_t B = nbbo::kTailBins;
+        constexpr size_t kTailBlock = 1 << 16;
+        const int W = std::max(1, S.workers);
+
+        std::vector<nbbo::TailStats> stats(msbins.size());
+        std::vector<nbbo::MsBinHeader> hdr(msbins.size());
+        std::vector<size_t> missing;
+        for(size_t f=0; f<msbins.size(); ++f){
+            hdr[f] = nbbo::MsBinReader(msbins[f]).header();
+            if(!nbbo::TailStats::load(nbbo::tail_sidecar_path(msbins[f]), hdr[f], stats[f])) missing.push_back(f);
+        }
+        std::cerr << "[pass-TAIL] sidecars " << (msbins.size()-missing.size()) << "/" << msbins.size() << "\n";
+
+        // One task per (file, day) from the msbin day tables, so a single
+        // yearly file still spreads across all workers. fn(worker, task, lr, n, zeros)
+        // sees the day's log returns one block at a time: columnar files hand the
+        // column straight from the mapping, row files gather it, packed files
+        // decode the day's blocks on the worker. On virtual clock files `zeros`
+        // counts the fill rows implied up to the block's last row.
+        struct DayTask { size_t file; uint64_t first, last; };
+        auto day_tasks = [&](const std::vector<size_t>& files){
+            std::vector<DayTask> tasks;
+            for(size_t f : files){
+                nbbo::MsBinReader r(msbins[f]);
+                for(const auto& d : r.days()) tasks.push_back({f, d.first_row, d.first_row + d.row_count});
+            }
+            return tasks;
         };
-
-        auto worker = [&](){
-            MaxHeap loc_low; MinHeap loc_high;
-            unsigned long long locN=0ULL;
-
-            while(true){
-                size_t i = idx.fetch_add(1);
-                if(i>=msbins.size()) break;
-                const auto& p = msbins[i];
-                std::ifstream in(p, std::ios::binary);
-                if(!in) throw std::runtime_error("cannot open msbin: "+p.string());
-                MsBinRow r; uint64_t processed=0;
-                while(in.read((char*)&r, sizeof(r))){
-                    if(std::isfinite(r.logret)){
-                        ++locN;
-                        push_low(loc_low,  r.logret);
-                        push_high(loc_high, r.logret);
+        auto scan_days = [&](const char* pass, const std::vector<DayTask>& tasks, auto&& fn){
+            std::atomic<size_t> next{0}, done{0};
+            auto worker = [&](int w){
+                size_t open_file = SIZE_MAX;
+                std::unique_ptr<nbbo::MsBinReader> rd;
+                std::vector<float> gather(kTailBlock);
+                std::vector<MsBinRow> rowbuf(kTailBlock);
+                while(true){
+                    size_t i = next.fetch_add(1);
+                    if(i>=tasks.size()) break;
+                    const DayTask& t = tasks[i];
+                    if(t.file != open_file){
+                        rd = std::make_unique<nbbo::MsBinReader>(msbins[t.file]);
+                        open_file = t.file;
                     }
-                    if((++processed % 20'000'000ULL)==0){
-                        std::cerr << "[pass-TAIL] " << p.filename().string() << " rows=" << processed << "\n";
+                    const uint32_t cap = rd->virtual_fill()? rd->fill_cap_ms() : 0u;
+                    nbbo::DayMs prev_t;
+                    for(uint64_t at=t.first; at<t.last; ){
+                        size_t n = (size_t)std::min<uint64_t>(kTailBlock, t.last-at);
+                        const float* lr;
+                        uint64_t zeros = 0;
+                        auto fills = [&](uint64_t ts){
+                            const nbbo::DayMs cur = nbbo::to_day_ms(ts);
+                            if(prev_t) zeros += nbbo::msbin_fill_after(prev_t, cur, cap);
+                            prev_t = cur;
+                        };
+                        if(rd->columnar()){
+                            const nbbo::MsBinColumns c = rd->columns(at, n);
+                            lr = c.logret;
+                            if(cap) for(size_t k=0;k<n;++k) fills(c.ts[k]);
+                        } else {
+                            const MsBinRow* rows = rd->row_data_or(at, n, rowbuf);
+                            for(size_t k=0;k<n;++k) gather[k] = rows[k].logret;
+                            if(cap) for(size_t k=0;k<n;++k) fills(rows[k].ts);
+                            lr = gather.data();
+                        }
+                        fn(w, i, lr, n, zeros);
+                        at += n;
                     }
+                    size_t d = done.fetch_add(1) + 1;
+                    if(d % 250 == 0 || d == tasks.size())
+                        std::cerr << "[pass-TAIL] " << pass << " days " << d << "/" << tasks.size() << "\n";
                 }
-                {
-                    std::lock_guard<std::mutex> lk(mu);
-                    N_finite += locN;
-                    while(!loc_low.empty()){ push_low(global_lows, loc_low.top()); loc_low.pop(); }
-                    while(!loc_high.empty()){ push_high(global_highs, loc_high.top()); loc_high.pop(); }
-                }
-                std::cerr << "[pass-TAIL] done " << (i+1) << "/" << msbins.size()
-                          << " " << p.filename().string() << " (+ finite=" << locN << ")\n";
-            }
+            };
+            nbbo::TaskGroup group(pool);
+            for(int t=0;t<W;++t) group.run([&worker, t]{ worker(t); });
+            group.wait();
         };
 
-        int W = std::max(1, S.workers);
-        std::vector<std::thread> pool; pool.reserve(W);
-        for(int t=0;t<W;++t) pool.emplace_back(worker);
-        for(auto& t: pool) t.join();
+        // Pass 1: rebuild missing sidecars (old caches, files from other tools).
+        if(!missing.empty()){
+            auto tasks = day_tasks(missing);
+            std::vector<nbbo::TailStats> per_task(tasks.size());
+            scan_days("scan", tasks, [&](int, size_t i, const float* lr, size_t n, uint64_t zeros){
+                for(size_t k=0;k<n;++k) per_task[i].add(lr[k]);
+                per_task[i].add(0.0f, zeros);
+            });
+            for(size_t i=0;i<tasks.size();++i) stats[tasks[i].file].merge(per_task[i]);
+            for(size_t f : missing){
+                try{ stats[f].save(nbbo::tail_sidecar_path(msbins[f]), hdr[f]); }
+                catch(const std::exception& e){ std::cerr << "[pass-TAIL] " << e.what() << "\n"; }
+            }
+        }
 
-        const unsigned long long N = N_finite.load();
+        unsigned long long N = 0;
+        std::vector<uint64_t> coarse(B, 0);
+        for(const auto& st : stats){ N += st.count(); st.add_coarse_to(coarse.data()); }
         if(N==0){ cut_lo = cut_hi = std::numeric_limits<double>::quiet_NaN(); return; }
 
-        std::vector<float> lows; lows.reserve(global_lows.size());
-        while(!global_lows.empty()){ lows.push_back(global_lows.top()); global_lows.pop(); }
-        std::sort(lows.begin(), lows.end());
-
-        std::vector<float> highs; highs.reserve(global_highs.size());
-        while(!global_highs.empty()){ highs.push_back(global_highs.top()); global_highs.pop(); }
-        std::sort(highs.begin(), highs.end());
-
         const unsigned long long r_lo = (unsigned long long) std::floor(S.q_lo * (double)N);
         const unsigned long long r_hi = (unsigned long long) std::floor(S.q_hi * (double)N);
+        uint64_t rank[2] = { std::min<uint64_t>(r_lo, N-1), std::min<uint64_t>(r_hi, N-1) };
+        uint32_t prefix[2];
+        for(int j=0;j<2;++j) prefix[j] = nbbo::tail_locate(coarse.data(), rank[j]);
+
+        // Low 16 bits inside the two target bins: exact sidecars answer
+        // directly, coarse ones need pass 2 over their files.
+        std::vector<uint64_t> fine(2*B, 0);
+        std::vector<size_t> coarse_files;
+        for(size_t f=0; f<stats.size(); ++f){
+            if(!stats[f].exact()){ coarse_files.push_back(f); continue; }
+            for(int j=0;j<2;++j) stats[f].add_fine_to(prefix[j], fine.data() + j*B);
+        }
+        if(!coarse_files.empty()){
+            auto tasks = day_tasks(coarse_files);
+            std::vector<std::vector<uint64_t>> per_worker(W, std::vector<uint64_t>(2*B, 0));
+            const uint32_t zero_key = nbbo::tail_key(0.0f);
+            scan_days("refine", tasks, [&](int w, size_t, const float* lr, size_t n, uint64_t zeros){
+                uint64_t* h = per_worker[w].data();
+                for(int j=0;j<2;++j){
+                    if((zero_key >> nbbo::kTailFineBits) == prefix[j]) h[j*B + (zero_key & (B-1))] += zeros;
+                }
+                for(size_t k=0;k<n;++k){
+                    if(!(std::fabs(lr[k]) <= std::numeric_limits<float>::max())) continue;
+                    const uint32_t key = nbbo::tail_key(lr[k]);
+                    const uint32_t p = key >> nbbo::kTailFineBits;
+                    if(p == prefix[0]) ++h[key & (B-1)];
+                    if(p == prefix[1]) ++h[B + (key & (B-1))];
+                }
+            });
+            for(const auto& h : per_worker) for(size_t b=0;b<2*B;++b) fine[b] += h[b];
+        }
 
-        size_t idx_lo = (r_lo < lows.size()) ? (size_t)r_lo : (lows.empty()?0:lows.size()-1);
-
-        unsigned long long base = (highs.size() < (size_t)N) ? (N - (unsigned long long)highs.size()) : 0ULL;
-        size_t idx_hi = (r_hi <= base) ? 0 : (size_t)std::min<unsigned long long>(r_hi - base, highs.size()-1);
-
-        cut_lo = (double) (lows.empty()? std::numeric_limits<float>::quiet_NaN() : lows[idx_lo]);
-        cut_hi = (double) (highs.empty()? std::numeric_limits<float>::quiet_NaN() : highs[idx_hi]);
+        double cut[2];
+        for(int j=0;j<2;++j){
+            const uint32_t low = nbbo::tail_locate(fine.data() + j*B, rank[j]);
+            cut[j] = (double) nbbo::tail_value((prefix[j] << nbbo::kTailFineBits) | low);
+        }
+        cut_lo = cut[0]; cut_hi = cut[1];
 
-        std::cerr << "[pass-TAIL] N=" << N
+        std::cerr << "[pass-TAIL] " << S.sym_root << " N=" << N
                   << " q_lo=" << S.q_lo << " -> rank " << r_lo << " cutoff " << cut_lo
-                  << " | q_hi=" << S.q_hi << " -> rank " << r_hi << " cutoff " << cut_hi << "\n";
+                  << " | q_hi=" << S.q_hi << " -> rank " << r_hi << " cutoff " << cut_hi
+                  << " (scanned " << missing.size() << "+" << coarse_files.size() << " files)\n";
     }
 
     /******** Parquet writer: partitioned by year into out/<mode>/SYM_YYYY.parquet ********/
@@ -621,26 +1275,34 @@ struct Pipeline {
         int year;
         std::shared_ptr<arrow::io::OutputStream> out;
         std::unique_ptr<parquet::arrow::FileWriter> writer;
+        nbbo::RowGroupWriter rg;
 
         arrow::UInt64Builder tsb;
-        arrow::FloatBuilder  midb, lrb, bsb, asb, sprb, bidb, askb;
+        arrow::Int32Builder  midb;
+        arrow::FloatBuilder  lrb;
+        arrow::Int32Builder  bsb, asb, sprb, bidb, askb;
+        arrow::Int32Builder  vub;            // valid_until_ms (virtual clock schema only)
 
         int64_t  nrows_batch = 0;
+        uint32_t batch_day   = 0;
+        bool     by_day      = false;
+        bool     valid_until = false;
         uint64_t total_rows  = 0;
 
         YearWriter(const YearWriter&)            = delete;
         YearWriter& operator=(const YearWriter&) = delete;
-        YearWriter(YearWriter&&)                 = default;
-        YearWriter& operator=(YearWriter&&)      = default;
 
         explicit YearWriter(
             int yr,
             std::shared_ptr<arrow::io::OutputStream> o,
-            std::unique_ptr<parquet::arrow::FileWriter> w
+            std::unique_ptr<parquet::arrow::FileWriter> w,
+            const std::shared_ptr<arrow::Schema>& schema,
+            int64_t batch, bool day_groups, bool valid_until_col
         )
         : year(yr),
           out(std::move(o)),
           writer(std::move(w)),
+          rg(writer.get(), schema, batch, day_groups),
           tsb(arrow::default_memory_pool()),
           midb(arrow::default_memory_pool()),
           lrb(arrow::default_memory_pool()),
@@ -648,33 +1310,72 @@ struct Pipeline {
           asb(arrow::default_memory_pool()),
           sprb(arrow::default_memory_pool()),
           bidb(arrow::default_memory_pool()),
-          askb(arrow::default_memory_pool())
+          askb(arrow::default_memory_pool()),
+          vub(arrow::default_memory_pool()),
+          by_day(day_groups),
+          valid_until(valid_until_col)
         {}
 
+        // Each flushed batch becomes (part of) one row group; see RowGroupWriter.
         void flush_batch(const std::shared_ptr<arrow::Schema>& schema){
             if(nrows_batch==0) return;
-            auto batch = arrow::RecordBatch::Make(schema, nrows_batch, {
+            std::vector<std::shared_ptr<arrow::Array>> cols = {
                 tsb.Finish().ValueOrDie(), midb.Finish().ValueOrDie(),
                 lrb.Finish().ValueOrDie(), bsb.Finish().ValueOrDie(),
                 asb.Finish().ValueOrDie(), sprb.Finish().ValueOrDie(),
                 bidb.Finish().ValueOrDie(), askb.Finish().ValueOrDie()
-            });
-            nbbo::ARROW_OK(writer->WriteRecordBatch(*batch));
+            };
+            if(valid_until) cols.push_back(vub.Finish().ValueOrDie());
+            auto batch = arrow::RecordBatch::Make(schema, nrows_batch, std::move(cols));
+            rg.write(batch, batch_day);
             total_rows += (uint64_t)nrows_batch;
             nrows_batch = 0;
 
             // Reuse builders
-            tsb.Reset(); midb.Reset(); lrb.Reset(); bsb.Reset(); asb.Reset(); sprb.Reset(); bidb.Reset(); askb.Reset();
+            tsb.Reset(); midb.Reset(); lrb.Reset(); bsb.Reset(); asb.Reset(); sprb.Reset(); bidb.Reset(); askb.Reset(); vub.Reset();
 
             if((total_rows % 2'000'000ULL)==0){
                 std::cerr << "[pass-Parquet] year=" << year << " wrote rows=" << total_rows << "\n";
             }
         }
+        // Bulk append of c.n rows of trading day `day` (lr/lr_ok: log return
+        // and its validity; vu: valid_until_ms, virtual clock schema only).
+        // Batches are cut at exactly `batch` rows, and at day changes when
+        // row groups follow days.
+        std::vector<int32_t> mid_buf, spr_buf;
+        void append(const nbbo::MsBinColumns& c, const float* lr, const uint8_t* lr_ok, const int32_t* vu,
+                    uint32_t day, int64_t batch, const std::shared_ptr<arrow::Schema>& schema){
+            if(by_day && day!=batch_day) flush_batch(schema);
+            batch_day = day;
+            size_t k=0;
+            while(k<c.n){
+                size_t m = (size_t)std::min<int64_t>((int64_t)(c.n-k), batch-nrows_batch);
+                mid_buf.resize(m); spr_buf.resize(m);
+                for(size_t j=0;j<m;++j){
+                    mid_buf[j] = nbbo::px_mid(c.bid[k+j], c.ask[k+j]);
+                    spr_buf[j] = c.ask[k+j] - c.bid[k+j];
+                }
+                nbbo::ARROW_OK(tsb.AppendValues(c.ts+k, (int64_t)m));
+                nbbo::ARROW_OK(midb.AppendValues(mid_buf.data(), (int64_t)m));
+                nbbo::ARROW_OK(lrb.AppendValues(lr+k, (int64_t)m, lr_ok+k));
+                nbbo::ARROW_OK(bsb.AppendValues(c.bidSize+k, (int64_t)m));
+                nbbo::ARROW_OK(asb.AppendValues(c.askSize+k, (int64_t)m));
+                nbbo::ARROW_OK(sprb.AppendValues(spr_buf.data(), (int64_t)m));
+                nbbo::ARROW_OK(bidb.AppendValues(c.bid+k, (int64_t)m));
+                nbbo::ARROW_OK(askb.AppendValues(c.ask+k, (int64_t)m));
+                if(valid_until) nbbo::ARROW_OK(vub.AppendValues(vu+k, (int64_t)m));
+                nrows_batch += (int64_t)m; k += m;
+                if(nrows_batch>=batch) flush_batch(schema);
+            }
+        }
+
         void close(const std::shared_ptr<arrow::Schema>& schema){
             flush_batch(schema);
+            rg.flush();
             nbbo::ARROW_OK(writer->Close());
             nbbo::ARROW_OK(out->Close());
-            std::cerr << "[pass-Parquet] year=" << year << " total=" << total_rows << " (closed)\n";
+            std::cerr << "[pass-Parquet] year=" << year << " total=" << total_rows
+                      << " row_groups=" << rg.row_groups() << " (closed)\n";
         }
     };
 
@@ -685,156 +1386,392 @@ struct Pipeline {
         return p;
     }
     std::string out_mode_dirname() const {
+        if(S.clock_grid && S.clock_virtual) return S.winsorize? "clock_virtual_winsor" : "clock_virtual";
         if(S.clock_grid) return S.winsorize? "clock_winsor" : "clock";
         return S.winsorize? "event_winsor" : "event";
     }
 
-    void msbins_to_parquet_per_year(const std::vector<fs::path>& msbins, double cut_lo, double cut_hi){
-        constexpr int64_t BATCH=2'000'000;
-
-        auto schema = nbbo::nbbo_schema();
+    std::shared_ptr<arrow::Schema> out_schema() const {
+        return S.clock_grid && S.clock_virtual ? nbbo::nbbo_virtual_clock_schema() : nbbo::nbbo_schema();
+    }
 
-        fs::path base = out_root_dir() / out_mode_dirname();
-        fs::create_directories(base);
+    std::unique_ptr<YearWriter> open_year(int yr, const std::shared_ptr<arrow::Schema>& schema,
+                                          const nbbo::ParquetWriterConfig& pq, int64_t BATCH) const {
+        fs::path path = out_root_dir() / out_mode_dirname() / (S.sym_root + "_" + std::to_string(yr) + ".parquet");
+        auto out_stream = arrow::io::FileOutputStream::Open(path.string()).ValueOrDie();
+        auto fw = nbbo::open_parquet_writer(out_stream, schema, pq, BATCH);
+        std::cerr << "[pass-Parquet] open year=" << yr << " -> " << path.filename().string() << "\n";
+        return std::make_unique<YearWriter>(yr, std::move(out_stream), std::move(fw), schema, BATCH,
+                                            pq.row_groups_by_day, S.clock_grid && S.clock_virtual);
+    }
 
-        auto open_year = [&](int yr) -> std::unique_ptr<YearWriter> {
-            fs::path path = base / (S.sym_root + "_" + std::to_string(yr) + ".parquet");
-            auto out_stream = arrow::io::FileOutputStream::Open(path.string()).ValueOrDie();
-            auto fw = parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(), out_stream).ValueOrDie();
-            std::cerr << "[pass-Parquet] open year=" << yr << " -> " << path.filename().string() << "\n";
-            return std::make_unique<YearWriter>(yr, std::move(out_stream), std::move(fw));
-        };
+    // Per-block scratch: log return after winsor + validity, valid_until_ms,
+    // and the compacted columns when --winsor-drop removes rows (keep: 0 drop,
+    // 1 row, 2 its fill run only).
+    struct BlockScratch {
+        std::vector<float> lr; std::vector<uint8_t> lr_ok, keep; std::vector<int32_t> vu;
+        std::vector<uint64_t> ts_k; std::vector<Px> bid_k, ask_k; std::vector<int32_t> bs_k, as_k;
+        nbbo::DecodedTs t;
+    };
+    std::atomic<uint64_t> parquet_rows{0};
+
+    // Winsorizes one block of trading day `day` and appends it to yw. fill:
+    // the rows' fill run lengths, virtual clock output only (else null).
+    void write_block(YearWriter& yw, nbbo::MsBinColumns c, const uint32_t* fill, uint32_t day,
+                     double cut_lo, double cut_hi, BlockScratch& b,
+                     const std::shared_ptr<arrow::Schema>& schema, int64_t BATCH){
+        const bool virt = fill != nullptr;
+        // Fill rows carry log return 0; --winsor-drop removes them too if 0
+        // falls outside the cutoffs.
+        const bool keep_fills = !(S.winsorize && !S.winsor_clip && (0.0 < cut_lo || 0.0 > cut_hi));
+        const size_t n = c.n;
+        b.lr.resize(n); b.lr_ok.resize(n); b.keep.assign(n, 1);
+        if(virt){
+            b.vu.resize(n); b.t.decode(c.ts, n);
+            for(size_t k=0;k<n;++k)
+                b.vu[k] = b.t.ms[k] + (keep_fills? (int32_t)fill[k] : 0);
+        }
+        bool dropped=false;
+        for(size_t k=0;k<n;++k){
+            float v = c.logret[k];
+            const bool fin = std::isfinite(v);
+            // Winsor policy
+            if(S.winsorize && fin){
+                if(S.winsor_clip){
+                    if(v < cut_lo) v = (float)cut_lo;
+                    else if(v > cut_hi) v = (float)cut_hi;
+                } else if(v < cut_lo || v > cut_hi){
+                    b.keep[k] = (virt && keep_fills && fill[k])? 2 : 0;
+                    dropped=true;
+                }
+            }
+            b.lr[k] = fin? v : 0.0f; b.lr_ok[k] = fin;
+        }
+        if(dropped){
+            b.ts_k.clear(); b.bid_k.clear(); b.ask_k.clear(); b.bs_k.clear(); b.as_k.clear();
+            size_t m=0;
+            for(size_t k=0;k<n;++k){
+                if(!b.keep[k]) continue;
+                const bool fill_only = b.keep[k]==2;
+                b.ts_k.push_back(fill_only? nbbo::inc_ms(c.ts[k]) : c.ts[k]);
+                b.bid_k.push_back(c.bid[k]); b.ask_k.push_back(c.ask[k]);
+                b.bs_k.push_back(c.bidSize[k]); b.as_k.push_back(c.askSize[k]);
+                b.lr[m] = fill_only? 0.0f : b.lr[k]; b.lr_ok[m] = fill_only? 1 : b.lr_ok[k];
+                if(virt) b.vu[m] = b.vu[k];
+                ++m;
+            }
+            c = nbbo::MsBinColumns{m, b.ts_k.data(), b.bid_k.data(), b.ask_k.data(), b.bs_k.data(), b.as_k.data(), nullptr};
+        }
+        yw.append(c, b.lr.data(), b.lr_ok.data(), b.vu.data(), day, BATCH, schema);
 
-        std::map<int, std::unique_ptr<YearWriter>> writers;
+        const uint64_t before = parquet_rows.fetch_add(c.n, std::memory_order_relaxed);
+        if((before + c.n) / 5'000'000ULL != before / 5'000'000ULL){
+            std::cerr << "[pass-Parquet] total_written=" << (before + c.n) << "\n";
+        }
+    }
 
-        auto get_writer = [&](int yr) -> YearWriter& {
-            auto it = writers.find(yr);
-            if(it == writers.end()){
-                auto ptr = open_year(yr);
-                auto [pos, _] = writers.emplace(yr, std::move(ptr));
-                return *pos->second;
-            }
-            return *it->second;
-        };
+    // One task per output year on up to --workers threads; each task streams
+    // its (file, day) segments in chronological order into its own writer, so
+    // every SYM_YYYY.parquet has the same rows and row groups as a serial run.
+    // With fewer years than workers, Arrow also encodes the columns of each row
+    // group in parallel.
+    //
+    // Virtual clock msbins are expanded to the dense 1 ms grid for clock/, or
+    // written as stored with valid_until_ms for clock_virtual/. There a row
+    // dropped by --winsor-drop whose quote was forward-filled keeps its fill
+    // run as a row at ts + 1 ms with log return 0, as the dense grid would.
+    void msbins_to_parquet_per_year(const std::vector<fs::path>& msbins, double cut_lo, double cut_hi){
+        const int64_t BATCH = S.parquet.row_group_rows_or(2'000'000);
 
-        uint64_t global_rows=0;
+        const bool virt = S.clock_grid && S.clock_virtual;
+        auto schema = out_schema();
+        fs::create_directories(out_root_dir() / out_mode_dirname());
 
+        // A day never straddles a year, so each day goes to one writer.
+        struct Segment { size_t file; uint32_t day; uint64_t first, last; };
+        std::map<int, std::vector<Segment>> by_year;
         for(size_t i=0;i<msbins.size();++i){
-            const auto& p = msbins[i];
-            std::ifstream in(p, std::ios::binary);
-            if(!in) throw std::runtime_error("cannot open msbin: " + p.string());
-            MsBinRow r; uint64_t loc=0;
-
+            nbbo::MsBinReader in(msbins[i]);
             std::cerr << "[pass-Parquet] " << (i+1) << "/" << msbins.size()
-                      << " " << p.filename().string() << " -> partitioned years\n";
-
-            while(in.read((char*)&r, sizeof(r))){
-                // Winsor policy
-                if(S.winsorize && std::isfinite(r.logret)){
-                    if(S.winsor_clip){
-                        float lr = r.logret;
-                        if(lr < cut_lo) r.logret = (float)cut_lo;
-                        else if(lr > cut_hi) r.logret = (float)cut_hi;
-                    } else {
-                        if(r.logret < cut_lo || r.logret > cut_hi) { ++loc; continue; } // drop
-                    }
-                }
+                      << " " << msbins[i].filename().string() << " rows=" << in.rows()
+                      << " days=" << in.days().size() << " " << nbbo::msbin_layout_name(in.layout())
+                      << " -> partitioned years\n";
+            for(const auto& d : in.days())
+                by_year[(int)(d.day / 10000)].push_back({i, d.day, d.first_row, d.first_row + d.row_count});
+        }
+        std::vector<std::pair<int, std::vector<Segment>>> years(by_year.begin(), by_year.end());
+
+        const int W = std::max(1, std::min<int>(S.workers, (int)years.size()));
+        nbbo::ParquetWriterConfig pq = S.parquet;
+        pq.use_threads = W < S.workers;
 
-                int yr = nbbo::year_from_ts(r.ts);
-                YearWriter& yw = get_writer(yr);
+        std::atomic<size_t> next{0};
+        std::exception_ptr err; std::mutex err_mu;
 
-                nbbo::ARROW_OK(yw.tsb.Append(r.ts));
-                nbbo::ARROW_OK(yw.midb.Append(r.mid));
-                if(std::isfinite(r.logret)) nbbo::ARROW_OK(yw.lrb.Append(r.logret)); else nbbo::ARROW_OK(yw.lrb.AppendNull());
-                nbbo::ARROW_OK(yw.bsb.Append(r.bidSize));
-                nbbo::ARROW_OK(yw.asb.Append(r.askSize));
-                nbbo::ARROW_OK(yw.sprb.Append(r.spread));
-                nbbo::ARROW_OK(yw.bidb.Append(r.bid));
-                nbbo::ARROW_OK(yw.askb.Append(r.ask));
+        auto write_year = [&](int yr, const std::vector<Segment>& segs){
+            auto yw = open_year(yr, schema, pq, BATCH);
+            size_t open_file = SIZE_MAX;
+            std::unique_ptr<nbbo::MsBinReader> in;
+            BlockScratch scratch;
 
-                if(++yw.nrows_batch>=BATCH){
-                    yw.flush_batch(schema);
+            for(const auto& sg : segs){
+                if(sg.file != open_file){
+                    in = std::make_unique<nbbo::MsBinReader>(msbins[sg.file]);
+                    open_file = sg.file;
                 }
+                std::unique_ptr<nbbo::MsBinColumnCursor> plain;
+                std::unique_ptr<nbbo::MsBinDenseCursor> dense;
+                std::unique_ptr<nbbo::MsBinFillCursor> sparse;
+                constexpr size_t kRows = 1 << 16;
+                if(virt) sparse = std::make_unique<nbbo::MsBinFillCursor>(*in, sg.first, sg.last, kRows, &pool);
+                else if(in->virtual_fill()) dense = std::make_unique<nbbo::MsBinDenseCursor>(*in, sg.first, sg.last, kRows, &pool);
+                else plain = std::make_unique<nbbo::MsBinColumnCursor>(*in, sg.first, sg.last, kRows, &pool);
+                auto next_block = [&](nbbo::MsBinColumns& c, const uint32_t*& fill) -> size_t {
+                    fill = nullptr;
+                    if(sparse) return sparse->next(c, fill);
+                    return dense? dense->next(c) : plain->next(c);
+                };
+
+                nbbo::MsBinColumns c;
+                const uint32_t* fill;
+                while(next_block(c, fill))
+                    write_block(*yw, c, fill, sg.day, cut_lo, cut_hi, scratch, schema, BATCH);
+            }
+            yw->close(schema);
+        };
 
-                if(((++global_rows) % 5'000'000ULL)==0){
-                    std::cerr << "[pass-Parquet] total_written=" << global_rows << "\n";
+        auto worker = [&](){
+            while(true){
+                size_t i = next.fetch_add(1);
+                if(i>=years.size()) break;
+                try{ write_year(years[i].first, years[i].second); }
+                catch(...){
+                    std::lock_guard<std::mutex> lk(err_mu);
+                    if(!err) err = std::current_exception();
                 }
-                ++loc;
             }
+        };
+        nbbo::TaskGroup tasks(pool);
+        for(int t=0;t<W;++t) tasks.run(worker);
+        tasks.wait();
+        if(err) std::rethrow_exception(err);
+
+        std::cerr << "[pass-Parquet] partitioned write complete. files=" << years.size()
+                  << " threads=" << W << " out_dir=" << (out_root_dir()/out_mode_dirname()) << "\n";
+    }
+
+    // Stage B result for the current Stage A settings, kept next to the output
+    // so a --no-cache run (which has no tail sidecars to scan) can winsorize.
+    fs::path cutoffs_path() const {
+        return out_root_dir() / out_mode_dirname() / (S.sym_root + "_winsor_cutoffs.tsv");
+    }
+    void save_cutoffs(double cut_lo, double cut_hi) const {
+        fs::create_directories(cutoffs_path().parent_path());
+        std::ofstream o(cutoffs_path());
+        o << "# stage_a_fingerprint\tq_lo\tq_hi\tcut_lo\tcut_hi\n" << std::setprecision(17)
+          << std::hex << stage_a_fingerprint(S) << std::dec << "\t"
+          << S.q_lo << "\t" << S.q_hi << "\t" << cut_lo << "\t" << cut_hi << "\n";
+        if(!o) throw std::runtime_error("cannot write " + cutoffs_path().string());
+    }
+    bool load_cutoffs(double& cut_lo, double& cut_hi) const {
+        std::ifstream f(cutoffs_path());
+        string line;
+        while(std::getline(f, line)){
+            if(line.empty() || line[0]=='#') continue;
+            std::istringstream is(line);
+            uint64_t fp=0; double qa=0, qb=0, lo=0, hi=0;
+            if(!(is >> std::hex >> fp >> std::dec >> qa >> qb >> lo >> hi)) return false;
+            if(fp!=stage_a_fingerprint(S) || qa!=S.q_lo || qb!=S.q_hi) return false;
+            cut_lo=lo; cut_hi=hi;
+            return true;
         }
+        return false;
+    }
 
-        for(auto& [yr, ptr] : writers){
-            ptr->close(schema);
+    // --no-cache: Stage A straight into Stage C, no msbins. A producer thread
+    // parses the CSVs in order into the row stream (chunk-parallel per file
+    // when --cache can hold the gzip index); this thread winsorizes each block
+    // as it arrives and appends it to its year's writer, which encodes a row
+    // group's columns on Arrow's pool. Output matches the cached path's.
+    void csv_to_parquet_streaming(const std::vector<fs::path>& csv_files, double cut_lo, double cut_hi){
+        const int64_t BATCH = S.parquet.row_group_rows_or(2'000'000);
+        const bool virt  = S.clock_grid && S.clock_virtual;
+        const bool dense = S.clock_grid && S.ffill && !virt;
+        auto schema = out_schema();
+        fs::create_directories(out_root_dir() / out_mode_dirname());
+        nbbo::ParquetWriterConfig pq = S.parquet;
+        pq.use_threads = true;
+
+        RowStream rs(fill_cap_ms(S));
+        std::exception_ptr err;
+        std::thread producer([&]{
+            try{
+                for(size_t i=0;i<csv_files.size();++i){
+                    const auto& csv = csv_files[i];
+                    std::cerr << "[stageA] " << (i+1) << "/" << csv_files.size() << " "
+                              << csv.filename().string() << " -> stream\n";
+                    IngestGuard busy(ingesting);
+                    GlitchCounts G(S);
+                    MsBinEmitter em(S, p_out, csv, rs);
+                    nbbo::GzIndex idx;
+                    bool indexed = !S.cache_dir.empty() && (chunk_share(S.workers)>1 || S.day_lo) && load_or_build_index(csv, idx);
+                    if(indexed) ingest_chunks_parallel(csv, idx, S.workers, em, G);
+                    else        ingest_serial(csv, em, G);
+                    em.finish(G);
+                    std::lock_guard<std::mutex> lk(gl_mu);
+                    gl_total.merge(G);
+                }
+                rs.close();
+            } catch(...){
+                err = std::current_exception();
+                rs.abort();
+            }
+        });
+
+        // Years arrive in order; each is closed once the next one starts.
+        std::map<int, std::unique_ptr<YearWriter>> years;
+        size_t files=0;
+        BlockScratch scratch;
+        nbbo::MsBinDenseExpander expand(RowStream::kBlockRows);
+        try{
+            RowBlock* b;
+            while(rs.full.pop(b)){
+                for(size_t i=0;i<b->n;){
+                    const uint32_t day = nbbo::ymd(b->ts[i]);
+                    size_t j=i+1;
+                    while(j<b->n && nbbo::ymd(b->ts[j])==day) ++j;
+                    const int yr = (int)(day / 10000);
+                    auto& yw = years[yr];
+                    if(!yw){
+                        if(years.rbegin()->first != yr)
+                            throw std::runtime_error("--no-cache: rows of " + std::to_string(yr) + " after a later year");
+                        for(auto it=years.begin(); it->first!=yr; it=years.erase(it))
+                            if(it->second) it->second->close(schema);
+                        yw = open_year(yr, schema, pq, BATCH); ++files;
+                    }
+                    const auto c = b->columns(i, j-i);
+                    const uint32_t* fill = b->fill.data() + i;
+                    if(dense){
+                        nbbo::MsBinColumns d;
+                        expand.reset(c, fill);
+                        while(expand.next(d)) write_block(*yw, d, nullptr, day, cut_lo, cut_hi, scratch, schema, BATCH);
+                    } else {
+                        write_block(*yw, c, virt? fill : nullptr, day, cut_lo, cut_hi, scratch, schema, BATCH);
+                    }
+                    i=j;
+                }
+                const bool last = b->last;
+                rs.free.push(b);
+                if(last) break;
+            }
+            producer.join();
+            if(err) std::rethrow_exception(err);
+            for(auto& [yr, yw] : years) yw->close(schema);
+        } catch(...){
+            rs.abort();
+            if(producer.joinable()) producer.join();
+            throw;
         }
-        std::cerr << "[pass-Parquet] partitioned write complete. files=" << writers.size()
-                  << " out_dir=" << (out_root_dir()/out_mode_dirname()) << "\n";
+
+        std::cerr << "[pass-Parquet] streaming write complete. files=" << files
+                  << " rows=" << parquet_rows.load() << " out_dir=" << (out_root_dir()/out_mode_dirname()) << "\n";
+    }
+
+    // Cutoffs for --no-cache: given on the command line, or the ones a cached
+    // run under the same Stage A settings and quantiles saved.
+    void streaming_cutoffs(double& cut_lo, double& cut_hi) const {
+        if(!S.winsorize) return;
+        if(S.fixed_cutoffs){ cut_lo=S.cut_lo; cut_hi=S.cut_hi; return; }
+        if(!load_cutoffs(cut_lo, cut_hi))
+            throw std::runtime_error("--no-cache with --winsor needs --winsor-cutoffs lo,hi or a matching "
+                                     + cutoffs_path().string() + " from a cached run");
+        std::cerr << "[pass-TAIL] using stored cutoffs " << cut_lo << " " << cut_hi
+                  << " from " << cutoffs_path().filename().string() << "\n";
     }
 
     void run(){
-        if(S.cache_dir.empty()) throw std::runtime_error("--cache DIR required");
-        fs::create_directories(S.cache_dir / "ms_event");
-        fs::create_directories(S.cache_dir / "ms_clock");
+        if(S.cache_dir.empty() && !S.no_cache) throw std::runtime_error("--cache DIR required");
 
-        std::cerr << "[cfg] grid=" << (S.event_grid? "event" : (S.clock_grid? "clock" : "unknown"))
+        std::cerr << "[cfg] grid=" << (S.event_grid? "event" : (S.clock_grid? (S.clock_virtual? "clock-virtual" : "clock") : "unknown"))
                   << " ffill=" << (S.ffill? "on":"off")
                   << " winsor=" << (S.winsorize? (S.winsor_clip? "clip":"drop") : "off")
-                  << " q=(" << S.q_lo << "," << S.q_hi << ") venues=";
+                  << " q=(" << S.q_lo << "," << S.q_hi << ")"
+                  << (S.fixed_cutoffs? " cutoffs=(" + std::to_string(S.cut_lo) + "," + std::to_string(S.cut_hi) + ")" : string())
+                  << " cache=" << (S.no_cache? "off" : "on") << " venues=";
         for(char c: S.venues) std::cerr<<c;
         std::cerr << " rth=" << std::setfill('0') << std::setw(2) << S.rth_start_h << ":" << std::setw(2) << S.rth_start_m
                   << "-"     << std::setw(2) << S.rth_end_h   << ":" << std::setw(2) << S.rth_end_m
                   << " max_ffill_gap_ms=" << S.max_ffill_gap_ms
                   << " workers=" << S.workers
+                  << " chunk_mb=" << (S.chunk_bytes>>20)
+                  << " cache_layout=" << nbbo::msbin_layout_name(S.cache_layout)
+                  << " parquet=(" << S.parquet.describe() << ")"
+                  << " days=" << (S.day_lo? std::to_string(S.day_lo)+":"+std::to_string(S.day_hi) : string("all"))
                   << " sym_root=" << S.sym_root
                   << " years=" << (S.year_lo? std::to_string(S.year_lo):"-") << ":" << (S.year_hi? std::to_string(S.year_hi):"-")
                   << "\n";
 
         auto csv_files = list_csv();  // may be empty
 
-        // Decide msbins
-        std::vector<fs::path> msbins;
-        bool have_cache = msbins_from_csv_list(csv_files, msbins);
-        if(!have_cache) have_cache = msbins_from_cache_only(msbins);
-
-        // Fallback: synthesize ms_clock from ms_event if needed
-        if(!have_cache && S.clock_grid){
-            std::vector<fs::path> ms_event_bins;
-            bool have_event_cache = msbins_from_subdir(S.cache_dir / "ms_event", ms_event_bins);
-            if(have_event_cache){
-                std::cerr << "▶ [ffill-from-event] ms_clock cache missing; synthesizing from ms_event ("
-                          << ms_event_bins.size() << " files) with gap<=" << S.max_ffill_gap_ms << "ms...\n";
-                std::vector<fs::path> produced_clock;
-                event_to_clock_ffill_parallel(ms_event_bins, produced_clock);
-                if(!produced_clock.empty()){
-                    msbins = produced_clock;
-                    have_cache = true;
-                    std::cerr << "▶ [ffill-from-event] done. Created " << produced_clock.size()
-                              << " files in " << (S.cache_dir / "ms_clock") << "\n";
-                }
-            }
+        if(S.no_cache){
+            if(csv_files.empty()) throw std::runtime_error("--no-cache needs CSVs in --in");
+            double cut_lo=-INFINITY, cut_hi=INFINITY;
+            streaming_cutoffs(cut_lo, cut_hi);
+            auto t0 = std::chrono::steady_clock::now();
+            std::cerr << "▶ [stream] " << csv_files.size() << " CSVs -> " << (out_root_dir()/out_mode_dirname()) << "\n";
+            csv_to_parquet_streaming(csv_files, cut_lo, cut_hi);
+            std::cerr << "[stageA+C+D] elapsed="
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count() << "s\n";
+            finish_report();
+            return;
         }
 
+        fs::create_directories(cache_subdir_for(false));
+        fs::create_directories(cache_subdir_for(true));
+
+        // Decide msbins: with CSVs, reuse current msbins and rebuild stale ones;
+        // without, run from whatever cache matches the current settings.
+        std::vector<fs::path> msbins;
         auto t0 = std::chrono::steady_clock::now();
-        if(have_cache){
-            std::cerr << "▶ [stageA] skipped: found msbin cache (" << msbins.size()
-                      << " files) in " << cache_subdir() << "\n";
+        if(!csv_files.empty()){
+            msbins_from_csv_list(csv_files, msbins);
         } else {
-            if(csv_files.empty()){
-                throw std::runtime_error("No CSVs found in --in and no msbins in " + cache_subdir().string());
+            bool have_cache = msbins_from_cache_only(msbins);
+
+            // Fallback: synthesize ms_clock from ms_event if needed
+            if(!have_cache && S.clock_grid){
+                std::vector<fs::path> ms_event_bins;
+                bool have_event_cache = msbins_from_subdir(cache_subdir_for(false), fingerprint_for(false), ms_event_bins);
+                if(have_event_cache){
+                    std::cerr << "▶ [ffill-from-event] ms_clock cache missing; synthesizing from ms_event ("
+                              << ms_event_bins.size() << " files) with gap<=" << S.max_ffill_gap_ms << "ms...\n";
+                    std::vector<fs::path> produced_clock;
+                    event_to_clock_ffill_parallel(ms_event_bins, produced_clock);
+                    if(!produced_clock.empty()){
+                        msbins = produced_clock;
+                        have_cache = true;
+                        std::cerr << "▶ [ffill-from-event] done. Created " << produced_clock.size()
+                                  << " files in " << cache_subdir_for(true) << "\n";
+                    }
+                }
             }
-            std::cerr << "▶ [stageA] build: generating msbins into " << cache_subdir() << "\n";
-            parallel_csv_to_msbin(csv_files);
-            if(!msbins_from_csv_list(csv_files, msbins) && !msbins_from_cache_only(msbins)){
-                throw std::runtime_error("Stage A built nothing usable in " + cache_subdir().string());
+            if(!have_cache){
+                throw std::runtime_error("No CSVs found in --in and no msbins for these settings in " + cache_subdir().string());
             }
+            std::cerr << "▶ [stageA] skipped: found msbin cache (" << msbins.size()
+                      << " files) in " << cache_subdir() << "\n";
         }
         auto t1 = std::chrono::steady_clock::now();
         std::cerr << "[stageA] elapsed=" << std::chrono::duration<double>(t1-t0).count() << "s\n";
 
         // Stage B: fast tail-quantiles
         double cut_lo=-INFINITY, cut_hi=INFINITY;
-        if(S.winsorize){
+        if(S.winsorize && S.fixed_cutoffs){
+            cut_lo=S.cut_lo; cut_hi=S.cut_hi;
+        } else if(S.winsorize){
             std::cerr << "▶ [pass-TAIL] computing extreme quantiles in parallel (" << S.workers << " threads)...\n";
             tail_quantiles_parallel(msbins, cut_lo, cut_hi);
+            save_cutoffs(cut_lo, cut_hi);
         }
 
         // Stage C/D: partitioned write
@@ -844,10 +1781,16 @@ struct Pipeline {
         auto t3 = std::chrono::steady_clock::now();
 
         std::cerr << "[stageB+C+D] elapsed=" << std::chrono::duration<double>(t3-t2).count() << "s\n";
+        finish_report();
+    }
 
-        if(!S.report_path.empty()) gl_total.write_report(S.report_path);
-        std::cerr<<"✅ Completed. Output dir: "<<(out_root_dir()/out_mode_dirname())<<"\n";
-        if(!S.report_path.empty()) std::cerr<<"Report: "<<S.report_path<<"\n";
+    void finish_report(){
+        if(!S.report_path.empty()){
+            gl_total.write_report(S.report_path);
+            gl_total.write_csv(glitch_table_path(S.report_path));
+        }
+        std::cerr<<"✅ Completed " << S.sym_root << ". Output dir: "<<(out_root_dir()/out_mode_dirname())<<"\n";
+        if(!S.report_path.empty()) std::cerr<<"Report: "<<S.report_path<<" (+ "<<glitch_table_path(S.report_path).filename().string()<<")\n";
     }
 };
 
@@ -862,28 +1805,67 @@ int main(int argc,char** argv){
         else if(a=="--out"){ need(1); S.out_parquet=argv[++i]; }
         else if(a=="--report"){ need(1); S.report_path=argv[++i]; }
         else if(a=="--clock"){ S.clock_grid=true; S.event_grid=false; }
-        else if(a=="--event"){ S.event_grid=true; S.clock_grid=false; S.ffill=false; }
+        else if(a=="--event"){ S.event_grid=true; S.clock_grid=false; S.ffill=false; S.clock_virtual=false; }
         else if(a=="--ffill"){ S.ffill=true; S.clock_grid=true; }
         else if(a=="--no-ffill"){ S.ffill=false; }
+        else if(a=="--clock-virtual"){ S.clock_virtual=true; S.ffill=true; S.clock_grid=true; S.event_grid=false; }
         else if(a=="--max-ffill-gap-ms"){ need(1); S.max_ffill_gap_ms=std::stoi(argv[++i]); }
         else if(a=="--winsor"){ S.winsorize=true; }
         else if(a=="--winsor-clip"){ S.winsor_clip=true; S.winsorize=true; }
         else if(a=="--winsor-drop"){ S.winsor_clip=false; S.winsorize=true; }
         else if(a=="--winsor-quantiles"){ need(1); string q=argv[++i]; auto c=q.find(','); S.q_lo=std::stod(q.substr(0,c)); S.q_hi=std::stod(q.substr(c+1)); }
+        else if(a=="--winsor-cutoffs"){ need(1); string q=argv[++i]; auto c=q.find(','); S.cut_lo=std::stod(q.substr(0,c)); S.cut_hi=std::stod(q.substr(c+1)); S.fixed_cutoffs=true; }
+        else if(a=="--no-cache"){ S.no_cache=true; }
         else if(a=="--rth"){ need(1); string w=argv[++i]; auto d=w.find('-'); string s=w.substr(0,d), e=w.substr(d+1); int hs,ms,ss, he,me,se; parse_time_hms(s,hs,ms,ss); parse_time_hms(e,he,me,se); S.rth_start_h=hs; S.rth_start_m=ms; S.rth_end_h=he; S.rth_end_m=me; }
         else if(a=="--ex"){ need(1); S.venues.clear(); for(char c: string(argv[++i])) S.venues.insert(c); }
         else if(a=="--stale-ms"){ need(1); S.stale_ms=std::stoi(argv[++i]); }
         else if(a=="--log-every-in"){ need(1); S.log_every_in=std::stoull(argv[++i]); }
         else if(a=="--log-every-out"){ need(1); S.log_every_out=std::stoull(argv[++i]); }
-        else if(a=="--sym-root"){ need(1); S.sym_root=argv[++i]; }
+        else if(a=="--sym-root"){ need(1); S.sym_root=argv[++i]; S.symbols.clear(); }
+        else if(a=="--symbols"){ need(1); S.symbols.clear(); std::istringstream ss(argv[++i]); for(string t; std::getline(ss, t, ',');) if(!t.empty()) S.symbols.push_back(t); }
         else if(a=="--years"){ need(1); string y=argv[++i]; auto c=y.find(':'); S.year_lo=std::stoi(y.substr(0,c)); S.year_hi=std::stoi(y.substr(c+1)); }
         else if(a=="--workers"){ need(1); S.workers=std::stoi(argv[++i]); }
-        else { std::cerr<<"Unknown arg: "<<a<<"\n"; usage(); return 1; }
+        else if(a=="--days"){ need(1); string d=argv[++i]; auto c=d.find(':'); S.day_lo=(uint32_t)std::stoul(d.substr(0,c)); S.day_hi=(c==string::npos)? S.day_lo : (uint32_t)std::stoul(d.substr(c+1)); }
+        else if(a=="--cache-layout"){ need(1); string l=argv[++i];
+            if(l=="aos") S.cache_layout=nbbo::MsBinLayout::kRows;
+            else if(l=="soa") S.cache_layout=nbbo::MsBinLayout::kColumns;
+            else if(l=="packed") S.cache_layout=nbbo::MsBinLayout::kPacked;
+            else { usage(); return 1; } }
+        else if(a=="--chunk-mb"){ need(1); S.chunk_bytes=std::max<uint64_t>(1, std::stoull(argv[++i])) << 20; }
+        else {
+            bool ok=false;
+            try{ ok=nbbo::parse_parquet_writer_arg(argc, argv, i, S.parquet); }
+            catch(const std::exception& e){ std::cerr<<e.what()<<"\n"; usage(); return 1; }
+            if(!ok){ std::cerr<<"Unknown arg: "<<a<<"\n"; usage(); return 1; }
+        }
+    }
+    if(S.symbols.empty()) S.symbols.push_back(S.sym_root);
+    nbbo::TaskPool pool(S.workers);
+    std::atomic<int> ingesting{0};
+    if(S.symbols.size()==1){
+        S.sym_root=S.symbols[0];
+        try{
+            Pipeline P{S, pool, ingesting}; P.run();
+        } catch(const std::exception& e){
+            std::cerr<<"FATAL: "<<e.what()<<"\n"; return 2;
+        }
+        return 0;
     }
-    try{
-        Pipeline P{S}; P.run();
-    } catch(const std::exception& e){
-        std::cerr<<"FATAL: "<<e.what()<<"\n"; return 2;
+    // One driver thread per symbol. Drivers only submit stage tasks to the
+    // shared pool and wait on them, so --workers caps the busy threads.
+    std::vector<std::thread> drivers;
+    std::atomic<int> failed{0};
+    for(const auto& sym : S.symbols){
+        Settings T=S; T.sym_root=sym;
+        if(!T.report_path.empty()) T.report_path = symbol_report_path(S.report_path, sym);
+        drivers.emplace_back([T, &pool, &ingesting, &failed]{
+            try{
+                Pipeline P{T, pool, ingesting}; P.run();
+            } catch(const std::exception& e){
+                std::cerr<<"FATAL ["<<T.sym_root<<"]: "<<e.what()<<"\n"; ++failed;
+            }
+        });
     }
-    return 0;
+    for(auto& t : drivers) t.join();
+    return failed? 2 : 0;
 }